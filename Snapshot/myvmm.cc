@@ -1,367 +1,798 @@
-#include <iostream>
-#include <string>
-#include <sstream>
-#include <fstream>
-#include <map>
-#include <bitset>
-#include <vector>
-#include <iomanip>
-#include <cstdint>
-#include <regex>
-#include <unistd.h>
-
-using namespace std;
-
-class VirtualMachine {
-	public:
-	    VirtualMachine();
-	    void configureVirtualMachine(int execSliceInInstructions);
-	    void readAssemblyInstructions(const string& filePath);
-	    void executeAssemblyInstructions(const string& virtualMachineName);
-	    void dumpProcessorState(const string& virtualMachineName);
-	    void loadSnapshot(const string& snapshotPath);
-        void createSnapshot(const string& snapshotPath);
-	
-	    int programCounter;
-	    vector<string> instructions;
-	
-	private:
-	    void executeAssemblyInstruction(const string& instruction, const string& virtualMachineName);
-	
-	    int virtualMachineExecSliceInInstructions;
-	    map<uint32_t, int32_t> memory;
-	    map<string, int32_t> registers;
-};
-
-VirtualMachine::VirtualMachine(): programCounter(0), virtualMachineExecSliceInInstructions(0) {
-  registers["$R0"] = 0;
-  
-  for (int i = 0; i < 32; ++i) {
-    string regName = "$" + to_string(i);
-    registers[regName] = 0;
-  }
-}
-
-void VirtualMachine::configureVirtualMachine(int execSliceInInstructions) {
-    this->virtualMachineExecSliceInInstructions = execSliceInInstructions;
-}
-
-void VirtualMachine::readAssemblyInstructions(const string& filePath) {
-    ifstream infile(filePath);
-    if (!infile.is_open()) {
-        cerr << "Error while opening file " << filePath << endl;
-        return;
-    }
-
-    string ln;
-    while (getline(infile, ln)) {
-        instructions.push_back(ln);
-    }
-}
-
-void VirtualMachine::executeAssemblyInstructions(const string& virtualMachineName) {
-    int counter = 0;
-    
-    while (programCounter < instructions.size() && counter < virtualMachineExecSliceInInstructions) {
-        executeAssemblyInstruction(instructions[programCounter], virtualMachineName);
-        counter++;
-		programCounter++;
-    }
-}
-
-void VirtualMachine::executeAssemblyInstruction(const string& assemblyInstruction, const string& virtualMachineName) {
-	regex opCodeRegex("([a-z]+)");
-    smatch opCodeMatch;
-    regex_search(assemblyInstruction, opCodeMatch, opCodeRegex);
-    string opcode = opCodeMatch.str(1);
-    
-    if (opcode == "li") {
-        regex liRegex("li\\s+(\\$\\d+)\\s*,\\s*(-?\\d+)");
-        smatch liMatch;
-        regex_search(assemblyInstruction, liMatch, liRegex);
-
-        string reg = liMatch.str(1);
-        int32_t immediate = stoi(liMatch.str(2));
-        registers[reg] = immediate;
-    } else if (opcode == "add") {
-        regex addRegex("add\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(\\$\\d+)");
-        smatch addMatch;
-        regex_search(assemblyInstruction, addMatch, addRegex);
-
-        string rd = addMatch.str(1);
-        string rs = addMatch.str(2);
-        string rt = addMatch.str(3);
-        registers[rd] = registers[rs] + registers[rt];
-    } else if (opcode == "addi") {
-        regex addiRegex("addi\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(-?\\d+)");
-        smatch addiMatch;
-        regex_search(assemblyInstruction, addiMatch, addiRegex);
-
-        string rt = addiMatch.str(1);
-        string rs = addiMatch.str(2);
-        int32_t immediate = stoi(addiMatch.str(3));
-        registers[rt] = registers[rs] + immediate;
-    } else if (opcode == "sub") {
-        regex subRegex("sub\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(\\$\\d+)");
-        smatch subMatch;
-        regex_search(assemblyInstruction, subMatch, subRegex);
-
-        string rd = subMatch.str(1);
-        string rs = subMatch.str(2);
-        string rt = subMatch.str(3);
-        registers[rd] = registers[rs] - registers[rt];
-    } else if (opcode == "mul") {
-        regex mulRegex("mul\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(\\$\\d+)");
-        smatch mulMatch;
-        regex_search(assemblyInstruction, mulMatch, mulRegex);
-
-        string rd = mulMatch.str(1);
-        string rs = mulMatch.str(2);
-        string rt = mulMatch.str(3);
-        registers[rd] = registers[rs] * registers[rt];
-    } else if (opcode == "and") {
-        regex andRegex("and\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(\\$\\d+)");
-        smatch andMatch;
-        regex_search(assemblyInstruction, andMatch, andRegex);
-
-        string rd = andMatch.str(1);
-        string rs = andMatch.str(2);
-        string rt = andMatch.str(3);
-        registers[rd] = registers[rs] & registers[rt];
-    } else if (opcode == "or") {
-        regex orRegex("or\\s+(\\$\\d+),\\s*(\\$\\d+)(?:,\\s*(\\$\\d+)|,\\s*(-?\\d+))");
-	    smatch orMatch;
-	    regex_search(assemblyInstruction, orMatch, orRegex);
-	
-	    string rd = orMatch.str(1);
-	    string rs = orMatch.str(2);
-	
-	    if (orMatch[3].matched) {
-	        string rt = orMatch.str(3);
-	        registers[rd] = registers[rs] | registers[rt];
-	    } else if (orMatch[4].matched) {
-	        int32_t immediate = stoi(orMatch.str(4));
-	        registers[rd] = registers[rs] | immediate;
-	    }
-    } else if (opcode == "xor") {
-        regex xorRegex("xor\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(\\$\\d+)");
-        smatch xorMatch;
-        regex_search(assemblyInstruction, xorMatch, xorRegex);
-
-        string rd = xorMatch.str(1);
-        string rs = xorMatch.str(2);
-        string rt = xorMatch.str(3);
-        registers[rd] = registers[rs] ^ registers[rt];
-    } else if (opcode == "sll") {
-        regex sllRegex("sll\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(\\d+)");
-        smatch sllMatch;
-        regex_search(assemblyInstruction, sllMatch, sllRegex);
-
-        string rd = sllMatch.str(1);
-        string rt = sllMatch.str(2);
-        int32_t shiftAmount = stoi(sllMatch.str(3));
-        registers[rd] = registers[rt] << shiftAmount;
-    } else if (opcode == "srl") {
-        regex srlRegex("srl\\s+(\\$\\d+),\\s*(\\$\\d+),\\s*(\\d+)");
-        smatch srlMatch;
-        regex_search(assemblyInstruction, srlMatch, srlRegex);
-
-        string rd = srlMatch.str(1);
-        string rt = srlMatch.str(2);
-        int32_t shiftAmount = stoi(srlMatch.str(3));
-        registers[rd] = registers[rt] >> shiftAmount;
-    } else if (opcode == "snapshot") {
-    	regex snapshotRegex("SNAPSHOT\\s+(\\S+)");
-        smatch snapshotMatch;
-        regex_search(assemblyInstruction, snapshotMatch, snapshotRegex);
-
-        string snapshotPath = assemblyInstruction.substr(assemblyInstruction.find(' ') + 1);
-        createSnapshot(snapshotPath);
-    } else if (opcode == "DUMP_PROCESSOR_STATE") {
-        dumpProcessorState(virtualMachineName);
-    }
-}
-        
-void VirtualMachine::dumpProcessorState(const string& virtualMachineName) {
-    cout << endl << "Register values for " + virtualMachineName << endl << endl;
-    
-	for (int i = 1; i <= 31; ++i) {
-        string reg = "$" + to_string(i);
-        cout << "R" << i << ": " << registers[reg] << endl;
-    }
-}
-
-void VirtualMachine::loadSnapshot(const string& snapshotPath) {
-    ifstream snapshotFile;
-  	snapshotFile.open(snapshotPath);
-
-  	if (!snapshotFile) {
-    	cout << "Unable to load snapshotFile";
-    	return;
-    }
-    
-    for (int i = 0; i < 32; ++i) {
-        string regName = "$" + to_string(i);
-        snapshotFile.read(reinterpret_cast<char*>(&registers[regName]), sizeof(int32_t));
-    }
-
-    snapshotFile.close();
-}
-
-void VirtualMachine::createSnapshot(const string& snapshotPath) {
-	ofstream snapshotFile;
-  	snapshotFile.open(snapshotPath);
-
-  	if (!snapshotFile) {
-    	cout << "Unable to create snapshotFile" << endl;
-    	return;
-  	}
-
-    for (int i = 0; i < 32; ++i) {
-        string regName = "$" + to_string(i);
-        snapshotFile.write(reinterpret_cast<const char*>(&registers[regName]), sizeof(int32_t));
-    }
-
-    snapshotFile.close();
-}
-
-int main(int argc, char *argv[]) {
-    string assembly_file_vm_1;
-    string assembly_file_vm_2;
-    string snapshot_file_vm_1;
-    string snapshot_file_vm_2;
-
-    int option;
-    
-    while ((option = getopt(argc, argv, "v:s:")) != -1) {
-        switch (option) {
-            case 'v':
-                if (assembly_file_vm_1.empty()) {
-                    assembly_file_vm_1 = optarg;
-                } else if (assembly_file_vm_2.empty()) {
-                    assembly_file_vm_2 = optarg;
-                } else {
-                    cerr << "Only two input files allowed" << endl;
-                    return 1;
-                }
-                break;
-            case 's':
-                if (snapshot_file_vm_1.empty()) {
-                    snapshot_file_vm_1 = optarg;
-                } else if (snapshot_file_vm_2.empty()) {
-                    snapshot_file_vm_2 = optarg;
-                } else {
-                    cerr << "Only two snapshot files allowed" << endl;
-                    return 1;
-                }
-                break;
-            default:
-                cerr << "Use " << argv[0] << " -v assembly_file_vm_1 -v assembly_file_vm_2 -s snapshot_file_vm_1 -s snapshot_file_vm_2" << endl;
-                return 1;
-        }
-    }
-
-    if (assembly_file_vm_1.empty() || assembly_file_vm_2.empty()) {
-        cerr << "Input Assembly Files" << endl;
-        cerr << "Use " << argv[0] << " -v assembly_file_vm_1 -v assembly_file_vm_2" << endl;
-        return 1;
-    }
-
-    VirtualMachine virtual_machine_1, virtual_machine_2;
-    int virtual_machine_1_exec_slice_in_instructions = 0;
-    int virtual_machine_2_exec_slice_in_instructions = 0;
-    string virtual_machine_1_binary, virtual_machine_2_binary;
-
-    ifstream config1(assembly_file_vm_1), config2(assembly_file_vm_2);
-    if (!config1.is_open() || !config2.is_open()) {
-        cerr << "Error opening configuration files" << endl;
-        return 1;
-    }
-
-    string line;
-    while (getline(config1, line)) {
-        if (line.find("vm_exec_slice_in_instructions=") != string::npos) {
-            virtual_machine_1_exec_slice_in_instructions = stoi(line.substr(line.find("=") + 1));
-        } else if (line.find("vm_binary=") != string::npos) {
-            virtual_machine_1_binary = line.substr(line.find("=") + 1);
-        }
-    }
-
-    virtual_machine_1.configureVirtualMachine(virtual_machine_1_exec_slice_in_instructions);
-    
-    ifstream file_vm1(snapshot_file_vm_1);
-    
-    if (file_vm1.good()) {
-		file_vm1.seekg(0, ios::end);
-		
-		if (file_vm1.tellg() == 0) {
-		    cout << "snapshot_file_vm_1 is empty" << endl;
-		} else {
-		    cout << "snapshot_file_vm_1 is not empty" << endl;
-			virtual_machine_1.loadSnapshot(snapshot_file_vm_1);
-			virtual_machine_1.readAssemblyInstructions(virtual_machine_1_binary);
-		}
-		
-		file_vm1.close();
-	}
-	else {
-		cout << "Unable to open snapshot_file_vm_1" << endl;
-		virtual_machine_1.readAssemblyInstructions(virtual_machine_1_binary);
-	}
-    
-	while (getline(config2, line)) {
-        if (line.find("vm_exec_slice_in_instructions=") != string::npos) {
-            virtual_machine_2_exec_slice_in_instructions = stoi(line.substr(line.find("=") + 1));
-        } else if (line.find("vm_binary=") != string::npos) {
-            virtual_machine_2_binary = line.substr(line.find("=") + 1);
-        }
-    }
-
-    virtual_machine_2.configureVirtualMachine(virtual_machine_2_exec_slice_in_instructions);
-    
-    ifstream file_vm2(snapshot_file_vm_2);
-    
-    if (file_vm2.good()) {	
-		file_vm2.seekg(0, ios::end);
-		
-		if (file_vm2.tellg() == 0) {
-		    cout << "snapshot_file_vm_2 is empty" << endl;
-		} else {
-		    cout << "snapshot_file_vm_2 is not empty" << endl;
-			virtual_machine_2.loadSnapshot(snapshot_file_vm_2);
-			virtual_machine_2.readAssemblyInstructions(virtual_machine_2_binary);
-		}
-		
-		file_vm2.close();
-	}
-	else {
-		cout << "Unable to open snapshot_file_vm_2" << endl;
-		virtual_machine_2.readAssemblyInstructions(virtual_machine_2_binary);
-	}
-	
-	cout << endl << "Context switch between Virtual Machines" << endl;
-	
-    while (virtual_machine_1.programCounter < virtual_machine_1.instructions.size() || virtual_machine_2.programCounter < virtual_machine_2.instructions.size()) {
-        if (virtual_machine_1.programCounter < virtual_machine_1.instructions.size()) {
-        	cout << endl << "Context Switch to Virtual Machine 1" << endl;
-        	cout << endl << "Before executing instructions in Virtual Machine 1 program counter value is " << virtual_machine_1.programCounter << endl;
-            virtual_machine_1.executeAssemblyInstructions("Virtual Machine 1");
-            cout << "After executing instructions in Virtual Machine 1 program counter value is " << virtual_machine_1.programCounter << endl;
-        }
-					
-        if (virtual_machine_2.programCounter < virtual_machine_2.instructions.size()) {
-        	cout << endl << "Context Switch to Virtual Machine 2" << endl;
-            cout << endl << "Before executing instructions in Virtual Machine 2 program counter value is " << virtual_machine_2.programCounter << endl;
-            virtual_machine_2.executeAssemblyInstructions("Virtual Machine 2");
-            cout << "After executing instructions in Virtual Machine 2 program counter value is " << virtual_machine_2.programCounter << endl;
-        }
-    }
-
-	cout << endl << "Dump Processor State" << endl;
-
-    virtual_machine_1.dumpProcessorState("Virtual Machine 1");
-    virtual_machine_2.dumpProcessorState("Virtual Machine 2");
-
-    return 0;
-}
-
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <unistd.h>
+
+#include "vmm/checkpoint_policy.h"
+#include "vmm/decoded_program.h"
+#include "vmm/execution_context.h"
+#include "vmm/instruction_trace.h"
+#include "vmm/io_engine.h"
+#include "vmm/manifest.h"
+#include "vmm/metrics.h"
+#include "vmm/replay_log.h"
+#include "vmm/state_export.h"
+#include "vmm/virtual_machine.h"
+#include "vmm/virtual_machine_batch.h"
+#include "vmm/worker_pool.h"
+
+using namespace std;
+
+struct StateExportOptions {
+    string path;
+    // Export only what changed since each VM started, i.e. since its
+    // snapshot, or since the previous export in baselinePath.
+    bool diffFromStart = false;
+    string baselinePath;
+};
+
+static ProcessorState captureProcessorState(const VirtualMachine& virtualMachine, const string& name) {
+    ProcessorState state;
+    state.name = name;
+    state.programCounter = virtualMachine.programCounter;
+
+    for (int reg = 0; reg < 32; ++reg) {
+        state.registers[reg] = virtualMachine.getRegister(reg);
+    }
+    return state;
+}
+
+// Takes the place of the per-register dump when a state file was given.
+static bool exportProcessorStates(const StateExportOptions& options, const vector<ProcessorState>& states, const vector<ProcessorState>& startStates) {
+    bool exported;
+
+    if (!options.baselinePath.empty()) {
+        vector<ProcessorState> baseline;
+        exported = readStateExport(options.baselinePath, baseline) && writeStateDiff(options.path, states, baseline);
+    } else if (options.diffFromStart) {
+        exported = writeStateDiff(options.path, states, startStates);
+    } else {
+        exported = writeStateExport(options.path, states);
+    }
+
+    if (exported) {
+        cout << endl << "Exported " << states.size() << " Virtual Machine states to " << options.path << endl;
+    }
+    return exported;
+}
+
+int runVirtualMachineBatches(const string& configFile, const vector<string>& snapshotFiles, bool optimize, const StateExportOptions& stateExport) {
+    vector<VirtualMachineManifest> manifests;
+    if (!loadManifest(configFile, "Virtual Machine", manifests)) {
+        return 1;
+    }
+
+    if (manifests.size() != 1) {
+        cerr << "Batch mode runs a single program, " << configFile << " describes " << manifests.size() << endl;
+        return 1;
+    }
+
+    int exec_slice_in_instructions = manifests[0].execSliceInInstructions;
+    const string& binary = manifests[0].binary;
+
+    shared_ptr<const DecodedProgram> sharedProgram = acquireDecodedProgram(binary, optimize, exec_slice_in_instructions);
+    if (!sharedProgram) {
+        return 1;
+    }
+
+    const DecodedProgram& program = *sharedProgram;
+    if (optimize) {
+        cout << "Optimized " << program.programLength() << " instructions down to " << program.code.size() << endl;
+    }
+
+    vector<VirtualMachineBatch<kBatchLanes>> batches;
+    vector<ProcessorState> startStates;
+    for (size_t first = 0; first < snapshotFiles.size(); first += kBatchLanes) {
+        batches.emplace_back(program, first, min(kBatchLanes, snapshotFiles.size() - first));
+        batches.back().configureVirtualMachine(exec_slice_in_instructions);
+
+        for (size_t lane = 0; lane < batches.back().activeLanes; ++lane) {
+            if (!batches.back().loadSnapshot(lane, snapshotFiles[first + lane])) {
+                return 1;
+            }
+            if (stateExport.diffFromStart) {
+                startStates.push_back(captureProcessorState(batches.back().extractVirtualMachine(lane), batches.back().virtualMachineName(lane)));
+            }
+        }
+    }
+
+    cout << endl << "Context switch between Virtual Machine batches of " << kBatchLanes << " lanes" << endl;
+
+    bool running = true;
+    while (running) {
+        running = false;
+
+        for (size_t i = 0; i < batches.size(); ++i) {
+            if (batches[i].programCounter < program.programLength()) {
+                cout << endl << "Context Switch to Virtual Machine Batch " << i + 1 << endl;
+                batches[i].executeAssemblyInstructions();
+                running = running || batches[i].programCounter < program.programLength();
+            }
+        }
+    }
+
+    if (!stateExport.path.empty()) {
+        vector<ProcessorState> states;
+        for (const auto& batch : batches) {
+            for (size_t lane = 0; lane < batch.activeLanes; ++lane) {
+                states.push_back(captureProcessorState(batch.extractVirtualMachine(lane), batch.virtualMachineName(lane)));
+            }
+        }
+        return exportProcessorStates(stateExport, states, startStates) ? 0 : 1;
+    }
+
+    cout << endl << "Dump Processor State" << endl;
+
+    for (const auto& batch : batches) {
+        for (size_t lane = 0; lane < batch.activeLanes; ++lane) {
+            batch.extractVirtualMachine(lane).dumpProcessorState(batch.virtualMachineName(lane));
+        }
+    }
+
+    return 0;
+}
+
+static void captureReplayStates(const vector<VirtualMachine*>& virtualMachines, vector<ReplayVirtualMachineState>& states) {
+    for (size_t i = 0; i < virtualMachines.size(); ++i) {
+        states[i].programCounter = virtualMachines[i]->programCounter;
+
+        for (int reg = 0; reg < 32; ++reg) {
+            states[i].registers[reg] = virtualMachines[i]->getRegister(reg);
+        }
+    }
+}
+
+static void restoreReplayState(VirtualMachine& virtualMachine, const ReplayVirtualMachineState& state) {
+    virtualMachine.configureVirtualMachine(state.execSliceInInstructions);
+    virtualMachine.readAssemblyInstructions(state.binaryPath);
+
+    if (state.optimize) {
+        virtualMachine.optimizeAssemblyInstructions();
+    }
+
+    for (int reg = 0; reg < 32; ++reg) {
+        virtualMachine.setRegister(reg, state.registers[reg]);
+    }
+    virtualMachine.programCounter = state.programCounter;
+}
+
+// Re-runs a recorded schedule from the checkpoint nearest to seekSlice.
+// Profiling, when asked for, starts at seekSlice itself.
+int replayVirtualMachines(const string& logPath, bool profile, uint64_t seekSlice) {
+    ReplayLogReader log;
+    if (!log.open(logPath)) {
+        return 1;
+    }
+
+    vector<ReplayVirtualMachineState> states;
+    uint64_t slice = log.seek(seekSlice, states);
+
+    vector<VirtualMachine> virtualMachines(states.size());
+    for (size_t i = 0; i < states.size(); ++i) {
+        restoreReplayState(virtualMachines[i], states[i]);
+    }
+
+    cout << "Replaying " << logPath << " from checkpoint at slice " << slice << endl;
+
+    bool profiling = false;
+    size_t virtualMachine;
+    int programCounter;
+    uint64_t firstSlice = slice;
+    auto start = chrono::steady_clock::now();
+
+    while (log.nextSlice(virtualMachine, programCounter)) {
+        if (profile && !profiling && slice >= seekSlice) {
+            for (auto& machine : virtualMachines) {
+                machine.enableProfiling();
+            }
+            profiling = true;
+        }
+
+        if (virtualMachines[virtualMachine].programCounter != programCounter) {
+            cerr << "Replay diverged at slice " << slice << ": " << states[virtualMachine].name << " is at " << virtualMachines[virtualMachine].programCounter << ", log expects " << programCounter << endl;
+            return 1;
+        }
+
+        virtualMachines[virtualMachine].executeAssemblyInstructions(states[virtualMachine].name);
+        slice++;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << endl << "Replayed " << slice - firstSlice << " slices in " << seconds * 1e3 << " ms" << endl;
+
+    cout << endl << "Dump Processor State" << endl;
+
+    for (size_t i = 0; i < virtualMachines.size(); ++i) {
+        virtualMachines[i].dumpProcessorState(states[i].name);
+    }
+
+    int status = 0;
+    if (!log.hasFinalState()) {
+        cerr << "Replay log ends without a final state" << endl;
+        status = 1;
+    } else {
+        for (size_t i = 0; i < virtualMachines.size(); ++i) {
+            const ReplayVirtualMachineState& recorded = log.finalState()[i];
+            bool matches = virtualMachines[i].programCounter == recorded.programCounter;
+
+            for (int reg = 0; reg < 32; ++reg) {
+                matches = matches && virtualMachines[i].getRegister(reg) == recorded.registers[reg];
+            }
+
+            if (!matches) {
+                cerr << "Replay diverged from the recorded final state of " << states[i].name << endl;
+                status = 1;
+            }
+        }
+    }
+
+    if (profile) {
+        cout << endl << "Dump Profile" << endl;
+
+        for (size_t i = 0; i < virtualMachines.size(); ++i) {
+            virtualMachines[i].profile().dump(states[i].name);
+        }
+    }
+
+    return status;
+}
+
+// Loads the VM's snapshot when there is one, then its program. The label
+// names the snapshot option in the messages; VMs from a manifest have none
+// and only mention a snapshot they were given. Fails if a device can't be
+// opened.
+static bool setupVirtualMachine(VirtualMachine& virtualMachine, const VirtualMachineManifest& manifest, const string& snapshotLabel, bool optimize, bool profile) {
+    virtualMachine.configureVirtualMachine(manifest.execSliceInInstructions);
+
+    if (!manifest.console.empty()) {
+        shared_ptr<VirtualIoDevice> console = openConsoleDevice(manifest.console);
+        if (!console) {
+            return false;
+        }
+        virtualMachine.attachDevice(kConsoleDevice, console);
+    }
+
+    if (!manifest.block.empty()) {
+        shared_ptr<VirtualIoDevice> block = openBlockDevice(manifest.block);
+        if (!block) {
+            return false;
+        }
+        virtualMachine.attachDevice(kBlockDevice, block);
+    }
+
+    if (manifest.hugePages) {
+        virtualMachine.guestMemory().enableHugePages();
+    }
+
+    if (manifest.memoryBytes > 0) {
+        virtualMachine.guestMemory().setSize(manifest.memoryBytes);
+    }
+
+    virtualMachine.setAsyncSnapshots(manifest.asyncSnapshots);
+
+    if (profile) {
+        virtualMachine.enableProfiling();
+    }
+
+    const string& snapshotFile = manifest.snapshot;
+    const string label = snapshotLabel.empty() ? manifest.snapshot : snapshotLabel;
+
+    if (snapshotFile.empty() && snapshotLabel.empty()) {
+        virtualMachine.readAssemblyInstructions(manifest.binary);
+
+        if (optimize) {
+            virtualMachine.optimizeAssemblyInstructions();
+        }
+        return true;
+    }
+    
+    ifstream file(snapshotFile);
+    
+    if (file.good()) {
+		file.seekg(0, ios::end);
+		
+		if (file.tellg() == 0) {
+		    cout << label << " is empty" << endl;
+		} else {
+		    cout << label << " is not empty" << endl;
+			virtualMachine.loadSnapshot(snapshotFile);
+			virtualMachine.readAssemblyInstructions(manifest.binary);
+		}
+		
+		file.close();
+	}
+	else {
+		cout << "Unable to open " << label << endl;
+		virtualMachine.readAssemblyInstructions(manifest.binary);
+	}
+
+    if (optimize) {
+        virtualMachine.optimizeAssemblyInstructions();
+    }
+
+    return true;
+}
+
+// Runs the VMs and their clones on NUMA-placed workers instead of the
+// round-robin loop. Each clone is rebuilt on its own worker from the
+// parent's manifest so all of its state is node-local; like clones on the
+// round-robin scheduler they get no devices.
+int runVirtualMachinesOnWorkers(const vector<VirtualMachineManifest>& manifests, const vector<string>& snapshotLabels, bool optimize, bool profile, bool metrics, size_t workerCount,
+                                const StateExportOptions& stateExport, const string& tracePath) {
+    WorkerPool pool(workerCount, true);
+
+    size_t total = 0;
+    vector<VirtualMachineManifest> cloneManifests = manifests;
+    for (auto& manifest : cloneManifests) {
+        total += 1 + manifest.clones;
+        manifest.console.clear();
+        manifest.block.clear();
+    }
+    bool devicesOpened = true;
+    vector<unique_ptr<CheckpointPolicy>> checkpointPolicies(total);
+    vector<ProcessorState> startStates(stateExport.diffFromStart ? total : 0);
+
+    auto spawn = [&](size_t parent, size_t copy) {
+        size_t index = pool.virtualMachineCount();
+        string name = manifests[parent].name;
+        if (copy > 0) {
+            name += ".";
+            name += to_string(copy);
+        }
+        bool checkpointing = copy == 0 && manifests[parent].checkpoint.enabled();
+
+        function<void(VirtualMachine&)> afterSlice;
+        if (checkpointing) {
+            afterSlice = [&checkpointPolicies, index](VirtualMachine& virtualMachine) {
+                if (checkpointPolicies[index]->due(virtualMachine.programCounter)) {
+                    checkpointPolicies[index]->checkpoint(virtualMachine);
+                }
+            };
+        }
+
+        pool.spawn(index, name, [&](VirtualMachine& virtualMachine) {
+            const VirtualMachineManifest& manifest = copy == 0 ? manifests[parent] : cloneManifests[parent];
+            devicesOpened = setupVirtualMachine(virtualMachine, manifest, snapshotLabels[parent], optimize, profile) && devicesOpened;
+            if (stateExport.diffFromStart) {
+                startStates[index] = captureProcessorState(virtualMachine, name);
+            }
+
+            if (metrics) {
+                virtualMachine.attachMetrics(MetricsRegistry::instance().registerVirtualMachine(name));
+            }
+            if (!tracePath.empty()) {
+                virtualMachine.enableTracing(name);
+            }
+        }, afterSlice, manifests[parent].weight);
+
+        if (checkpointing) {
+            checkpointPolicies[index].reset(new CheckpointPolicy(manifests[parent].checkpoint, index, total, pool.virtualMachine(index).programCounter));
+        }
+    };
+
+    // Same order as the round-robin scheduler: the configured VMs, then
+    // each one's clones.
+    for (size_t parent = 0; parent < manifests.size(); ++parent) {
+        spawn(parent, 0);
+    }
+    for (size_t parent = 0; parent < manifests.size(); ++parent) {
+        for (size_t copy = 1; copy <= manifests[parent].clones; ++copy) {
+            spawn(parent, copy);
+        }
+    }
+
+    if (!devicesOpened) {
+        return 1;
+    }
+
+    cout << endl << "Running " << total << " Virtual Machines on " << pool.workerCount() << " workers" << endl;
+
+    pool.runToCompletion();
+
+    cout << endl << "Workers stole " << pool.sameNodeSteals() << " Virtual Machines on the same node and " << pool.crossNodeSteals() << " across nodes" << endl;
+
+    if (!stateExport.path.empty()) {
+        vector<ProcessorState> states;
+        for (size_t i = 0; i < pool.virtualMachineCount(); ++i) {
+            states.push_back(captureProcessorState(pool.virtualMachine(i), pool.virtualMachineName(i)));
+        }
+        if (!exportProcessorStates(stateExport, states, startStates)) {
+            return 1;
+        }
+    } else {
+        cout << endl << "Dump Processor State" << endl;
+
+        for (size_t i = 0; i < pool.virtualMachineCount(); ++i) {
+            pool.virtualMachine(i).dumpProcessorState(pool.virtualMachineName(i));
+        }
+    }
+
+    if (profile) {
+        cout << endl << "Dump Profile" << endl;
+
+        for (size_t i = 0; i < pool.virtualMachineCount(); ++i) {
+            pool.virtualMachine(i).profile().dump(pool.virtualMachineName(i));
+        }
+    }
+
+    if (!tracePath.empty() && !writeInstructionTrace(tracePath)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// One VM's context under the round-robin scheduler. A VM of weight w runs
+// w slices each time it is resumed; one parked on I/O suspends until the
+// I/O completes and finishes its turn in a later round.
+static ExecutionContext runRoundRobinContext(size_t index, const vector<VirtualMachine*>& virtualMachines, vector<ReplayVirtualMachineState>& states, unsigned weight,
+                                             CheckpointPolicy& checkpointPolicy, ReplayLogWriter* replayWriter, const ContextScheduler& scheduler, uint64_t& checkpointRound) {
+    VirtualMachine& virtual_machine = *virtualMachines[index];
+    const string name = states[index].name;
+
+    while (virtual_machine.programCounter < virtual_machine.programLength()) {
+        for (unsigned slice = 0; slice < weight && virtual_machine.programCounter < virtual_machine.programLength(); ++slice) {
+            co_await IoCompletion{virtual_machine};
+
+            cout << endl << "Context Switch to " << name << endl;
+            cout << endl << "Before executing instructions in " << name << " program counter value is " << virtual_machine.programCounter << endl;
+            if (replayWriter) {
+                replayWriter->recordSlice(index, virtual_machine.programCounter);
+            }
+            virtual_machine.executeAssemblyInstructions(name);
+            if (replayWriter && replayWriter->checkpointDue()) {
+                captureReplayStates(virtualMachines, states);
+                replayWriter->recordCheckpoint(states);
+            }
+            cout << "After executing instructions in " << name << " program counter value is " << virtual_machine.programCounter << endl;
+
+            // At most one checkpoint per round; a VM that is due while
+            // another one writes simply goes in a later round.
+            if (checkpointRound != scheduler.round() && checkpointPolicy.due(virtual_machine.programCounter)) {
+                checkpointPolicy.checkpoint(virtual_machine);
+                checkpointRound = scheduler.round();
+            }
+        }
+
+        co_await SliceExpired{};
+    }
+}
+
+static void printUsage(const char* program) {
+    cerr << "Use " << program << " [-O] [-p] [-m metrics_socket] [-i io_uring|blocking] [-r record_log | -w workers] [-o state_file [-d | -D previous_state_file]] [-t trace_file] -v assembly_file_vm_1 -v assembly_file_vm_2 -s snapshot_file_vm_1 -s snapshot_file_vm_2" << endl;
+    cerr << "Or  " << program << " [-O] [-p] [-m metrics_socket] [-i io_uring|blocking] [-r record_log | -w workers] [-o state_file [-d | -D previous_state_file]] [-t trace_file] -c manifest" << endl;
+    cerr << "Or  " << program << " [-p] -R replay_log [-k slice]" << endl;
+    cerr << "Or  " << program << " -b [-O] [-o state_file [-d | -D previous_state_file]] -v assembly_file -s snapshot_file_vm_1 ... -s snapshot_file_vm_n" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    string assembly_file_vm_1;
+    string assembly_file_vm_2;
+    string manifest_file;
+    vector<string> snapshot_files;
+    bool batch_mode = false;
+    bool optimize = false;
+    bool profile = false;
+    string metrics_socket;
+    string record_log;
+    string replay_log;
+    uint64_t seek_slice = 0;
+    uint64_t workers = 0;
+    string trace_file;
+    StateExportOptions state_export;
+
+    int option;
+    
+    while ((option = getopt(argc, argv, "v:c:s:bOpm:r:R:k:w:i:o:dD:t:")) != -1) {
+        switch (option) {
+            case 'v':
+                if (assembly_file_vm_1.empty()) {
+                    assembly_file_vm_1 = optarg;
+                } else if (assembly_file_vm_2.empty()) {
+                    assembly_file_vm_2 = optarg;
+                } else {
+                    cerr << "Only two input files allowed" << endl;
+                    return 1;
+                }
+                break;
+            case 'c':
+                manifest_file = optarg;
+                break;
+            case 'b':
+                batch_mode = true;
+                break;
+            case 'O':
+                optimize = true;
+                break;
+            case 'p':
+                profile = true;
+                break;
+            case 's':
+                snapshot_files.push_back(optarg);
+                break;
+            case 'm':
+                metrics_socket = optarg;
+                break;
+            case 'r':
+                record_log = optarg;
+                break;
+            case 'R':
+                replay_log = optarg;
+                break;
+            case 'k':
+                if (!parseNumber(optarg, seek_slice, 0, numeric_limits<uint64_t>::max())) {
+                    cerr << "-k needs a slice number, not " << optarg << endl;
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                if (!parseNumber(optarg, workers, 1, kMaxWorkers)) {
+                    cerr << "-w needs a worker count from 1 to " << kMaxWorkers << ", not " << optarg << endl;
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'i':
+                if (string(optarg) != "io_uring" && string(optarg) != "blocking") {
+                    cerr << "I/O engine must be io_uring or blocking" << endl;
+                    return 1;
+                }
+                selectIoEngine(string(optarg) == "io_uring" ? IoEngineKind::Uring : IoEngineKind::Blocking);
+                break;
+            case 'o':
+                state_export.path = optarg;
+                break;
+            case 'd':
+                state_export.diffFromStart = true;
+                break;
+            case 'D':
+                state_export.baselinePath = optarg;
+                break;
+            case 't':
+                trace_file = optarg;
+                break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (state_export.path.empty() && (state_export.diffFromStart || !state_export.baselinePath.empty())) {
+        cerr << "-d and -D need a state file given with -o" << endl;
+        return 1;
+    }
+
+    if (!trace_file.empty() && (profile || batch_mode || !replay_log.empty())) {
+        cerr << "Tracing is not supported with -p, -b or -R" << endl;
+        return 1;
+    }
+
+    if (!replay_log.empty()) {
+        return replayVirtualMachines(replay_log, profile, seek_slice);
+    }
+
+    if (batch_mode) {
+        if (!record_log.empty()) {
+            cerr << "Recording is not supported in batch mode" << endl;
+            return 1;
+        }
+
+        if (assembly_file_vm_1.empty() || !assembly_file_vm_2.empty() || snapshot_files.empty()) {
+            cerr << "Use " << argv[0] << " -b [-O] -v assembly_file -s snapshot_file_vm_1 ... -s snapshot_file_vm_n" << endl;
+            return 1;
+        }
+
+        return runVirtualMachineBatches(assembly_file_vm_1, snapshot_files, optimize, state_export);
+    }
+
+    if (workers > 0 && !record_log.empty()) {
+        cerr << "Recording is not supported with workers" << endl;
+        return 1;
+    }
+
+    vector<VirtualMachineManifest> manifests;
+    vector<string> snapshot_labels;
+
+    if (!manifest_file.empty()) {
+        if (!assembly_file_vm_1.empty() || !snapshot_files.empty()) {
+            cerr << "A manifest names its own binaries and snapshots" << endl;
+            return 1;
+        }
+
+        if (!loadManifest(manifest_file, "Virtual Machine 1", manifests)) {
+            return 1;
+        }
+        snapshot_labels.resize(manifests.size());
+    } else {
+        if (snapshot_files.size() > 2) {
+            cerr << "Only two snapshot files allowed" << endl;
+            return 1;
+        }
+
+        if (assembly_file_vm_1.empty() || assembly_file_vm_2.empty()) {
+            cerr << "Input Assembly Files" << endl;
+            cerr << "Use " << argv[0] << " -v assembly_file_vm_1 -v assembly_file_vm_2" << endl;
+            return 1;
+        }
+
+        // Each -v file is a manifest of its own; -s overrides the snapshot
+        // of the VM it describes.
+        const string assembly_files[] = {assembly_file_vm_1, assembly_file_vm_2};
+        for (size_t i = 0; i < 2; ++i) {
+            string label = "snapshot_file_vm_" + to_string(i + 1);
+
+            if (!loadManifest(assembly_files[i], "Virtual Machine " + to_string(i + 1), manifests)) {
+                return 1;
+            }
+
+            if (i < snapshot_files.size()) {
+                manifests.back().snapshot = snapshot_files[i];
+            }
+            snapshot_labels.resize(manifests.size(), label);
+        }
+    }
+
+    if (!record_log.empty()) {
+        for (const auto& manifest : manifests) {
+            if (!manifest.console.empty() || !manifest.block.empty() || manifest.asyncSnapshots) {
+                cerr << manifest.name << " has devices or asynchronous snapshots, which a replay log cannot reproduce" << endl;
+                return 1;
+            }
+        }
+    }
+
+    unique_ptr<MetricsServer> metrics_server;
+    if (!metrics_socket.empty()) {
+        metrics_server.reset(new MetricsServer(metrics_socket));
+    }
+
+    if (workers > 0) {
+        return runVirtualMachinesOnWorkers(manifests, snapshot_labels, optimize, profile, metrics_server != nullptr, workers, state_export, trace_file);
+    }
+
+    vector<VirtualMachine> parents(manifests.size());
+    vector<vector<VirtualMachine>> clones(manifests.size());
+
+    for (size_t i = 0; i < manifests.size(); ++i) {
+        if (!setupVirtualMachine(parents[i], manifests[i], snapshot_labels[i], optimize, profile)) {
+            return 1;
+        }
+        if (metrics_server) {
+            parents[i].attachMetrics(MetricsRegistry::instance().registerVirtualMachine(manifests[i].name));
+        }
+    }
+	
+    // Clones start from their parent's state after its snapshot is loaded
+    // and are scheduled after the configured VMs.
+    for (size_t i = 0; i < manifests.size(); ++i) {
+        clones[i] = parents[i].cloneVirtualMachine(manifests[i].clones);
+    }
+
+    vector<VirtualMachine*> virtual_machines;
+    vector<ReplayVirtualMachineState> virtual_machine_states;
+    vector<CheckpointConfig> checkpoint_configs;
+    vector<unsigned> weights;
+
+    for (size_t i = 0; i < manifests.size(); ++i) {
+        ReplayVirtualMachineState state;
+        state.name = manifests[i].name;
+        state.binaryPath = manifests[i].binary;
+        state.execSliceInInstructions = manifests[i].execSliceInInstructions;
+
+        virtual_machines.push_back(&parents[i]);
+        virtual_machine_states.push_back(state);
+        checkpoint_configs.push_back(manifests[i].checkpoint);
+        weights.push_back(manifests[i].weight);
+    }
+
+    for (size_t parent = 0; parent < manifests.size(); ++parent) {
+        for (size_t i = 0; i < clones[parent].size(); ++i) {
+            ReplayVirtualMachineState state = virtual_machine_states[parent];
+            state.name += "." + to_string(i + 1);
+
+            if (metrics_server) {
+                clones[parent][i].attachMetrics(MetricsRegistry::instance().registerVirtualMachine(state.name));
+            }
+
+            virtual_machines.push_back(&clones[parent][i]);
+            virtual_machine_states.push_back(state);
+            checkpoint_configs.emplace_back();
+            weights.push_back(manifests[parent].weight);
+        }
+    }
+
+    if (!trace_file.empty()) {
+        for (size_t i = 0; i < virtual_machines.size(); ++i) {
+            virtual_machines[i]->enableTracing(virtual_machine_states[i].name);
+        }
+    }
+
+    ReplayLogWriter replay_writer;
+    bool recording = !record_log.empty();
+
+    if (recording) {
+        if (!replay_writer.open(record_log)) {
+            return 1;
+        }
+
+        captureReplayStates(virtual_machines, virtual_machine_states);
+        for (auto& state : virtual_machine_states) {
+            state.optimize = optimize;
+            replay_writer.recordVirtualMachine(state);
+        }
+    }
+
+    vector<ProcessorState> start_states;
+    if (state_export.diffFromStart) {
+        for (size_t i = 0; i < virtual_machines.size(); ++i) {
+            start_states.push_back(captureProcessorState(*virtual_machines[i], virtual_machine_states[i].name));
+        }
+    }
+
+    vector<CheckpointPolicy> checkpoint_policies;
+    for (size_t i = 0; i < virtual_machines.size(); ++i) {
+        checkpoint_policies.emplace_back(checkpoint_configs[i], i, virtual_machines.size(), virtual_machines[i]->programCounter);
+    }
+
+    ContextScheduler scheduler;
+    uint64_t checkpoint_round = 0;
+
+    for (size_t i = 0; i < virtual_machines.size(); ++i) {
+        scheduler.spawn(runRoundRobinContext(i, virtual_machines, virtual_machine_states, weights[i], checkpoint_policies[i],
+                                             recording ? &replay_writer : nullptr, scheduler, checkpoint_round));
+    }
+
+	cout << endl << "Context switch between Virtual Machines" << endl;
+	
+    while (scheduler.liveContexts() > 0) {
+        if (metrics_server) {
+            MetricsRegistry& registry = MetricsRegistry::instance();
+            registry.schedulerQueueDepth.set(scheduler.liveContexts());
+            registry.schedulerRounds.add(1);
+        }
+
+        scheduler.runRound();
+    }
+
+    if (recording) {
+        captureReplayStates(virtual_machines, virtual_machine_states);
+        replay_writer.recordFinal(virtual_machine_states);
+    }
+
+    if (!state_export.path.empty()) {
+        vector<ProcessorState> states;
+        for (size_t i = 0; i < virtual_machines.size(); ++i) {
+            states.push_back(captureProcessorState(*virtual_machines[i], virtual_machine_states[i].name));
+        }
+        if (!exportProcessorStates(state_export, states, start_states)) {
+            return 1;
+        }
+    } else {
+        cout << endl << "Dump Processor State" << endl;
+
+        for (size_t i = 0; i < virtual_machines.size(); ++i) {
+            virtual_machines[i]->dumpProcessorState(virtual_machine_states[i].name);
+        }
+    }
+
+    if (profile) {
+        cout << endl << "Dump Profile" << endl;
+
+        for (size_t i = 0; i < virtual_machines.size(); ++i) {
+            virtual_machines[i]->profile().dump(virtual_machine_states[i].name);
+        }
+    }
+
+    if (!trace_file.empty() && !writeInstructionTrace(trace_file)) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "vmm/manifest.h"
+#include "vmm/migration_session.h"
+#include "vmm/rate_limiter.h"
+#include "vmm/secure_channel.h"
+
+using namespace std;
+
+static void printUsage(const char* program) {
+    cerr << "Use " << program << " -s snapshot_file -d destination [-v config_file] [-l host_migration_mbit]" << endl;
+}
+
+// Starts a VM on a migration server from a snapshot or checkpoint file. The
+// file is streamed as it is on disk, never loaded into a VirtualMachine, and
+// the server resumes from the registers and program counter it holds.
+int main(int argc, char *argv[]) {
+    string snapshot_file;
+    string destination;
+    string config_file;
+    uint64_t host_migration_mbit = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:d:v:l:")) != -1) {
+        switch (option) {
+            case 's':
+                snapshot_file = optarg;
+                break;
+            case 'd':
+                destination = optarg;
+                break;
+            case 'v':
+                config_file = optarg;
+                break;
+            case 'l':
+                if (!parseNumber(optarg, host_migration_mbit, 0, 1000000)) {
+                    cerr << "-l needs a rate from 0 to 1000000 Mbit/s, not " << optarg << endl;
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                printUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (snapshot_file.empty() || destination.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Only the migration keys of the VM's config are used; without one the
+    // defaults apply.
+    VirtualMachineManifest manifest;
+
+    if (!config_file.empty()) {
+        vector<VirtualMachineManifest> manifests;
+        if (!loadManifest(config_file, "Virtual Machine 1", manifests)) {
+            return 1;
+        }
+        if (manifests.size() != 1) {
+            cerr << config_file << " must describe one virtual machine" << endl;
+            return 1;
+        }
+        manifest = manifests.front();
+    }
+
+    string migration_port = to_string(manifest.migrationPort);
+
+    MigrationSender sender(snapshot_file, MigrationImageFormat::Snapshot);
+    if (!sender.valid()) {
+        return 1;
+    }
+
+    migrationBandwidth().setRate(host_migration_mbit * 1000000 / 8);
+    MigrationRateLimiter limiter(manifest.migrationBytesPerSecond);
+    sender.setRateLimiter(&limiter);
+    if (manifest.migrationEncrypted) {
+        sender.setKey(manifest.migrationKey);
+    }
+
+    MigrationOutcome outcome = sender.run(destination, migration_port);
+
+    if (outcome == MigrationOutcome::Failed) {
+        cerr << "Unable to stream " << snapshot_file << " to " << destination << endl;
+        return 1;
+    }
+    if (outcome == MigrationOutcome::Unknown) {
+        cerr << "Lost " << destination << " after asking it to start " << snapshot_file << "; it may be running" << endl;
+        return 2;
+    }
+
+    cout << "Streamed " << snapshot_file << " to " << destination << ":" << migration_port << " in " << sender.pagesSent() << " pages";
+    if (sender.reconnects() > 0) {
+        cout << " after " << sender.reconnects() << " reconnects";
+    }
+    cout << endl;
+
+    return 0;
+}
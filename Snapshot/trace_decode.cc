@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <unistd.h>
+
+#include "vmm/decoded_program.h"
+#include "vmm/instruction_trace.h"
+
+using namespace std;
+
+// Prints an instruction trace written by vmm -t, one instruction per line
+// and thread by thread, oldest first.
+int main(int argc, char *argv[]) {
+    string trace_file;
+    string virtual_machine_name;
+    uint64_t last_records = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "t:v:n:")) != -1) {
+        switch (option) {
+            case 't':
+                trace_file = optarg;
+                break;
+            case 'v':
+                virtual_machine_name = optarg;
+                break;
+            case 'n':
+                last_records = stoull(optarg);
+                break;
+            default:
+                cerr << "Use " << argv[0] << " -t trace_file [-v vm_name] [-n last_records]" << endl;
+                return 1;
+        }
+    }
+
+    if (trace_file.empty()) {
+        cerr << "Use " << argv[0] << " -t trace_file [-v vm_name] [-n last_records]" << endl;
+        return 1;
+    }
+
+    InstructionTrace trace;
+    if (!readInstructionTrace(trace_file, trace)) {
+        return 1;
+    }
+
+    for (size_t thread = 0; thread < trace.threads.size(); ++thread) {
+        const InstructionTrace::Thread& records = trace.threads[thread];
+        cout << "Thread " << thread << ": " << records.records.size() << " records";
+        if (records.overwritten > 0) {
+            cout << ", " << records.overwritten << " older ones overwritten";
+        }
+        cout << endl;
+
+        // -n counts the records shown, so with -v it skips other VMs'.
+        size_t first = records.records.size();
+        for (uint64_t shown = 0; first > 0 && (last_records == 0 || shown < last_records); ) {
+            const InstructionTraceRecord& record = records.records[--first];
+            if (virtual_machine_name.empty() || (record.virtualMachine < trace.virtualMachineNames.size() && trace.virtualMachineNames[record.virtualMachine] == virtual_machine_name)) {
+                shown++;
+            }
+        }
+        if (last_records == 0) {
+            first = 0;
+        }
+
+        for (size_t i = first; i < records.records.size(); ++i) {
+            const InstructionTraceRecord& record = records.records[i];
+            bool named = record.virtualMachine < trace.virtualMachineNames.size();
+            if (!virtual_machine_name.empty() && (!named || trace.virtualMachineNames[record.virtualMachine] != virtual_machine_name)) {
+                continue;
+            }
+
+            cout << "[thread " << thread << "] " << (named ? trace.virtualMachineNames[record.virtualMachine] : "VM " + to_string(record.virtualMachine))
+                 << " pc " << record.programCounter << ": ";
+
+            if (record.opcode < kOpcodeCount) {
+                cout << opcodeName(static_cast<Opcode>(record.opcode));
+            } else {
+                cout << "opcode " << static_cast<int>(record.opcode);
+            }
+
+            if (record.reg != kTraceNoRegister) {
+                cout << " $" << static_cast<int>(record.reg) << " = " << record.value;
+            }
+            cout << endl;
+        }
+    }
+
+    return 0;
+}
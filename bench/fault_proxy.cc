@@ -0,0 +1,160 @@
+#include "bench/fault_proxy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+static const size_t kForwardBufferBytes = 64 * 1024;
+
+FaultProxy::FaultProxy(uint16_t targetPort, uint64_t dropAfterBytes, int drops, FaultMode mode)
+    : targetPort(targetPort), dropAfterBytes(dropAfterBytes), drops(drops), mode(mode), listener(-1), listenPort(0), stopping(false), accepted(0), cut(0) {
+}
+
+FaultProxy::~FaultProxy() {
+    stopping = true;
+    if (listener >= 0) {
+        shutdown(listener, SHUT_RDWR);
+    }
+    if (acceptor.joinable()) {
+        acceptor.join();
+    }
+    if (listener >= 0) {
+        close(listener);
+    }
+
+    lock_guard<mutex> lock(forwarderMutex);
+    for (auto& forwarder : forwarders) {
+        forwarder.join();
+    }
+}
+
+bool FaultProxy::start(uint16_t port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    socklen_t addressLength = sizeof(address);
+    int reuse = 1;
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    bool listening = listener >= 0 && setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0 &&
+                     bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && listen(listener, 8) == 0 &&
+                     getsockname(listener, reinterpret_cast<sockaddr*>(&address), &addressLength) == 0;
+
+    if (!listening) {
+        cerr << "Unable to listen on port " << port << endl;
+        return false;
+    }
+
+    listenPort = ntohs(address.sin_port);
+    acceptor = thread(&FaultProxy::acceptConnections, this);
+    return true;
+}
+
+uint16_t FaultProxy::port() const {
+    return listenPort;
+}
+
+int FaultProxy::connections() const {
+    return accepted;
+}
+
+int FaultProxy::dropped() const {
+    return cut;
+}
+
+void FaultProxy::acceptConnections() {
+    while (!stopping) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            return;
+        }
+
+        bool drop = accepted++ < drops && dropAfterBytes > 0;
+        lock_guard<mutex> lock(forwarderMutex);
+        forwarders.emplace_back(&FaultProxy::forward, this, client, drop);
+    }
+}
+
+// Pumps both directions until either side closes, or, when dropping, until
+// the upstream budget is spent. A stalled connection is then held open,
+// unread, until the proxy stops.
+void FaultProxy::forward(int client, bool drop) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(targetPort);
+
+    int target = socket(AF_INET, SOCK_STREAM, 0);
+    if (target < 0 || connect(target, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (target >= 0) {
+            close(target);
+        }
+        close(client);
+        return;
+    }
+
+    vector<char> buffer(kForwardBufferBytes);
+    uint64_t upstream = 0;
+    bool open = true;
+
+    while (open) {
+        pollfd fds[2] = {{client, POLLIN, 0}, {target, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            break;
+        }
+
+        for (int i = 0; i < 2 && open; ++i) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            size_t limit = buffer.size();
+            if (i == 0 && drop) {
+                limit = min<uint64_t>(limit, dropAfterBytes - upstream);
+            }
+
+            ssize_t bytes = read(fds[i].fd, buffer.data(), limit);
+            if (bytes <= 0) {
+                open = false;
+                break;
+            }
+
+            int peer = i == 0 ? target : client;
+            for (ssize_t written = 0; written < bytes;) {
+                ssize_t chunk = write(peer, buffer.data() + written, bytes - written);
+                if (chunk <= 0) {
+                    open = false;
+                    break;
+                }
+                written += chunk;
+            }
+
+            if (i == 0) {
+                upstream += bytes;
+                if (drop && upstream >= dropAfterBytes) {
+                    cut++;
+                    open = false;
+                }
+            }
+        }
+    }
+
+    if (drop && mode == FaultMode::Stall && upstream >= dropAfterBytes) {
+        while (!stopping) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+
+    shutdown(client, SHUT_RDWR);
+    shutdown(target, SHUT_RDWR);
+    close(client);
+    close(target);
+}
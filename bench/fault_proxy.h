@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class FaultMode {
+    // Both sides see the connection closed.
+    Close,
+    // Nothing more is forwarded either way, but both sides stay open, as
+    // when a link goes silent without a FIN or RST reaching either end.
+    Stall,
+};
+
+// Loopback TCP proxy that breaks connections mid-stream, for exercising
+// migration resume. Each of the first drops connections is closed or
+// stalled once dropAfterBytes have gone from the client to the target,
+// which may be in the middle of a frame; later connections are forwarded
+// whole. Stalled connections stay open until the proxy is destroyed.
+class FaultProxy {
+	public:
+	    FaultProxy(uint16_t targetPort, uint64_t dropAfterBytes, int drops, FaultMode mode = FaultMode::Close);
+	    ~FaultProxy();
+
+	    // Listens on listenPort, or on a free port for 0.
+	    bool start(uint16_t listenPort = 0);
+	    uint16_t port() const;
+
+	    int connections() const;
+	    int dropped() const;
+
+	private:
+	    void acceptConnections();
+	    void forward(int client, bool drop);
+
+	    uint16_t targetPort;
+	    uint64_t dropAfterBytes;
+	    int drops;
+	    FaultMode mode;
+	    int listener;
+	    uint16_t listenPort;
+	    std::atomic<bool> stopping;
+	    std::atomic<int> accepted;
+	    std::atomic<int> cut;
+	    std::thread acceptor;
+	    std::mutex forwarderMutex;
+	    std::vector<std::thread> forwarders;
+};
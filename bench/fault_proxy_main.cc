@@ -0,0 +1,42 @@
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "bench/fault_proxy.h"
+
+using namespace std;
+
+// Stands between the migration client and server, e.g. with the client's
+// vm_migration_port set to the listen port and the server on the target.
+int main(int argc, char *argv[]) {
+    uint16_t listen_port = 0;
+    uint16_t target_port = 8080;
+    uint64_t drop_after_bytes = 0;
+    int drops = 0;
+    FaultMode mode = FaultMode::Close;
+    int option;
+
+    while ((option = getopt(argc, argv, "l:t:b:d:s")) != -1) {
+        switch (option) {
+            case 'l': listen_port = static_cast<uint16_t>(stoi(optarg)); break;
+            case 't': target_port = static_cast<uint16_t>(stoi(optarg)); break;
+            case 'b': drop_after_bytes = stoull(optarg); break;
+            case 'd': drops = stoi(optarg); break;
+            case 's': mode = FaultMode::Stall; break;
+            default:
+                cerr << "Use " << argv[0] << " -l listen_port [-t target_port] [-b drop_after_bytes] [-d drops] [-s]" << endl;
+                return 1;
+        }
+    }
+
+    FaultProxy proxy(target_port, drop_after_bytes, drops, mode);
+    if (!proxy.start(listen_port)) {
+        return 1;
+    }
+
+    cout << "Forwarding port " << proxy.port() << " to " << target_port << ", " << (mode == FaultMode::Stall ? "stalling" : "cutting") << " the first " << drops << " connections after " << drop_after_bytes << " bytes" << endl;
+
+    while (true) {
+        pause();
+    }
+}
@@ -0,0 +1,574 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "vmm/decoded_program.h"
+#include "vmm/lanes.h"
+#include "vmm/migration_session.h"
+#include "vmm/state_export.h"
+#include "vmm/virtual_machine.h"
+#include "vmm/virtual_machine_batch.h"
+
+using namespace std;
+
+// Differential fuzzing of the execution engines. Each input is turned into
+// a guest program over the existing opcodes, run by a reference interpreter
+// written straight from the assembly semantics, and then by every engine;
+// all of them must end with the same registers and program counter. Three
+// of the runs also checkpoint, export or migrate the VM at input-chosen
+// slice boundaries and continue in a fresh VM restored from the result.
+//
+// Built with -DVMM_LIBFUZZER=ON the harness is a libFuzzer target, which
+// AFL++ can drive as well; otherwise it replays the input files it is given,
+// or generates inputs from a seed and reports executions per second.
+
+static const size_t kMaxFuzzInstructions = 4096;
+
+struct FuzzInstruction {
+    Opcode opcode;
+    int rd;
+    int rs;
+    int rt;
+    int32_t immediate;
+};
+
+struct FuzzProgram {
+    int execSliceInInstructions = 1;
+    // Bit n % 64 set round-trips the VM after its nth slice.
+    uint64_t roundTripMask = 0;
+    vector<FuzzInstruction> instructions;
+};
+
+struct FuzzState {
+    int32_t registers[32] = {};
+    int32_t programCounter = 0;
+    // Registers at the last SNAPSHOT, which every engine must have written.
+    bool snapshotted = false;
+    int32_t snapshot[32] = {};
+};
+
+// Reads the input a byte at a time; past the end every byte is 0.
+struct FuzzInput {
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+
+    bool exhausted() const { return position >= size; }
+    uint8_t byte() { return position < size ? data[position++] : 0; }
+
+    uint32_t word() {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(byte()) << (8 * i);
+        }
+        return value;
+    }
+};
+
+// Scratch files live in one directory per process and go with it. They are
+// unlinked before each rewrite: ext4 flushes a file truncated by O_TRUNC
+// when it is closed, which would otherwise dominate the run time.
+class FuzzDirectory {
+	public:
+	    FuzzDirectory();
+	    ~FuzzDirectory();
+
+	    bool valid() const;
+	    string path(const string& name) const;
+	    // Leaves the files behind, e.g. the program that diverged.
+	    void keep();
+
+	private:
+	    string directory;
+	    bool kept;
+};
+
+FuzzDirectory::FuzzDirectory() : kept(false) {
+    char directoryTemplate[] = "/tmp/vmm-fuzz-XXXXXX";
+    if (mkdtemp(directoryTemplate) == nullptr) {
+        cerr << "Unable to create fuzzing directory" << endl;
+        return;
+    }
+    directory = directoryTemplate;
+}
+
+FuzzDirectory::~FuzzDirectory() {
+    if (directory.empty() || kept) {
+        return;
+    }
+
+    for (const char* name : {"program.asm", "checkpoint.bin", "state.bin", "snapshot"}) {
+        unlink(path(name).c_str());
+    }
+    for (size_t lane = 0; lane < kBatchLanes; ++lane) {
+        unlink(path("snapshot." + to_string(lane)).c_str());
+    }
+    rmdir(directory.c_str());
+}
+
+bool FuzzDirectory::valid() const {
+    return !directory.empty();
+}
+
+string FuzzDirectory::path(const string& name) const {
+    return directory + "/" + name;
+}
+
+void FuzzDirectory::keep() {
+    kept = true;
+}
+
+static FuzzDirectory& fuzzDirectory() {
+    static FuzzDirectory directory;
+    return directory;
+}
+
+static FuzzProgram decodeFuzzInput(FuzzInput& input) {
+    static const Opcode opcodes[] = {
+        Opcode::Li, Opcode::Add, Opcode::Addi, Opcode::Sub, Opcode::Mul, Opcode::And, Opcode::Or, Opcode::Ori,
+        Opcode::Xor, Opcode::Sll, Opcode::Srl, Opcode::In, Opcode::Out, Opcode::Doorbell
+    };
+
+    FuzzProgram program;
+    program.execSliceInInstructions = 1 + input.byte() % 32;
+    program.roundTripMask = input.word() | static_cast<uint64_t>(input.word()) << 32;
+
+    while (!input.exhausted() && program.instructions.size() < kMaxFuzzInstructions) {
+        // SNAPSHOT costs a file write per engine, so it gets one selector in 256.
+        uint8_t selector = input.byte();
+        FuzzInstruction instruction = {selector == 0xff ? Opcode::Snapshot : opcodes[selector % size(opcodes)], 0, 0, 0, 0};
+
+        switch (instruction.opcode) {
+            case Opcode::Li:
+                instruction.rd = input.byte() % 32;
+                instruction.immediate = static_cast<int32_t>(input.word());
+                break;
+            case Opcode::Addi:
+            case Opcode::Ori:
+                instruction.rd = input.byte() % 32;
+                instruction.rs = input.byte() % 32;
+                instruction.immediate = static_cast<int32_t>(input.word());
+                break;
+            case Opcode::Sll:
+            case Opcode::Srl:
+                instruction.rd = input.byte() % 32;
+                instruction.rt = input.byte() % 32;
+                instruction.immediate = input.byte() % 32;
+                break;
+            case Opcode::In:
+            case Opcode::Out:
+                instruction.rd = instruction.rs = input.byte() % 32;
+                instruction.immediate = input.byte() % kIoDevices;
+                break;
+            case Opcode::Doorbell:
+                instruction.immediate = input.byte() % kIoDevices;
+                break;
+            case Opcode::Snapshot:
+                break;
+            default:
+                instruction.rd = input.byte() % 32;
+                instruction.rs = input.byte() % 32;
+                instruction.rt = input.byte() % 32;
+                break;
+        }
+
+        program.instructions.push_back(instruction);
+    }
+
+    return program;
+}
+
+static bool writeFuzzProgram(const FuzzProgram& program, const string& programPath, const string& snapshotPath) {
+    ostringstream text;
+
+    for (const auto& instruction : program.instructions) {
+        int rd = instruction.rd;
+        int rs = instruction.rs;
+        int rt = instruction.rt;
+        int32_t immediate = instruction.immediate;
+
+        switch (instruction.opcode) {
+            case Opcode::Li: text << "li $" << rd << ", " << immediate; break;
+            case Opcode::Add: text << "add $" << rd << ", $" << rs << ", $" << rt; break;
+            case Opcode::Addi: text << "addi $" << rd << ", $" << rs << ", " << immediate; break;
+            case Opcode::Sub: text << "sub $" << rd << ", $" << rs << ", $" << rt; break;
+            case Opcode::Mul: text << "mul $" << rd << ", $" << rs << ", $" << rt; break;
+            case Opcode::And: text << "and $" << rd << ", $" << rs << ", $" << rt; break;
+            case Opcode::Or: text << "or $" << rd << ", $" << rs << ", $" << rt; break;
+            case Opcode::Ori: text << "or $" << rd << ", $" << rs << ", " << immediate; break;
+            case Opcode::Xor: text << "xor $" << rd << ", $" << rs << ", $" << rt; break;
+            case Opcode::Sll: text << "sll $" << rd << ", $" << rt << ", " << immediate; break;
+            case Opcode::Srl: text << "srl $" << rd << ", $" << rt << ", " << immediate; break;
+            case Opcode::In: text << "in $" << rd << ", " << immediate; break;
+            case Opcode::Out: text << "out $" << rs << ", " << immediate; break;
+            case Opcode::Doorbell: text << "doorbell " << immediate; break;
+            case Opcode::Snapshot: text << "SNAPSHOT " << snapshotPath; break;
+            default: break;
+        }
+        text << "\n";
+    }
+
+    unlink(programPath.c_str());
+    ofstream file(programPath, ios::binary | ios::trunc);
+    file << text.str();
+    file.close();
+
+    if (!file) {
+        cerr << "Unable to write fuzz program " << programPath << endl;
+        return false;
+    }
+    return true;
+}
+
+// The guest ISA as the original text interpreter defines it, with 32-bit
+// wraparound for add, sub and mul and an arithmetic srl. No devices are
+// attached, so in reads 0.
+static FuzzState runReference(const FuzzProgram& program) {
+    FuzzState state;
+    int32_t* registers = state.registers;
+
+    for (const auto& instruction : program.instructions) {
+        uint32_t rs = static_cast<uint32_t>(registers[instruction.rs]);
+        uint32_t rt = static_cast<uint32_t>(registers[instruction.rt]);
+        uint32_t immediate = static_cast<uint32_t>(instruction.immediate);
+        int32_t& rd = registers[instruction.rd];
+
+        switch (instruction.opcode) {
+            case Opcode::Li: rd = instruction.immediate; break;
+            case Opcode::Add: rd = static_cast<int32_t>(rs + rt); break;
+            case Opcode::Addi: rd = static_cast<int32_t>(rs + immediate); break;
+            case Opcode::Sub: rd = static_cast<int32_t>(rs - rt); break;
+            case Opcode::Mul: rd = static_cast<int32_t>(rs * rt); break;
+            case Opcode::And: rd = static_cast<int32_t>(rs & rt); break;
+            case Opcode::Or: rd = static_cast<int32_t>(rs | rt); break;
+            case Opcode::Ori: rd = static_cast<int32_t>(rs | immediate); break;
+            case Opcode::Xor: rd = static_cast<int32_t>(rs ^ rt); break;
+            case Opcode::Sll: rd = static_cast<int32_t>(rt << instruction.immediate); break;
+            case Opcode::Srl: rd = static_cast<int32_t>(rt) >> instruction.immediate; break;
+            case Opcode::In: rd = 0; break;
+            case Opcode::Snapshot:
+                state.snapshotted = true;
+                memcpy(state.snapshot, registers, sizeof(state.snapshot));
+                break;
+            default: break;
+        }
+    }
+
+    state.programCounter = static_cast<int32_t>(program.instructions.size());
+    return state;
+}
+
+enum class FuzzEngine { Decoded, Optimized, Profiled, Batch, Checkpoint, StateExport, Migration };
+
+static const char* fuzzEngineName(FuzzEngine engine) {
+    switch (engine) {
+        case FuzzEngine::Decoded: return "decoded";
+        case FuzzEngine::Optimized: return "optimized";
+        case FuzzEngine::Profiled: return "profiled";
+        case FuzzEngine::Batch: return "batch";
+        case FuzzEngine::Checkpoint: return "checkpoint round-trip";
+        case FuzzEngine::StateExport: return "state export round-trip";
+        case FuzzEngine::Migration: return "migration round-trip";
+    }
+    return "unknown";
+}
+
+static bool roundTripAfter(const FuzzProgram& program, size_t slice) {
+    return (program.roundTripMask >> (slice % 64)) & 1;
+}
+
+static VirtualMachine loadFuzzVirtualMachine(const FuzzProgram& program, const string& programPath, bool optimize) {
+    VirtualMachine virtualMachine;
+    virtualMachine.configureVirtualMachine(program.execSliceInInstructions);
+    virtualMachine.readAssemblyInstructions(programPath);
+    if (optimize) {
+        virtualMachine.optimizeAssemblyInstructions();
+    }
+    return virtualMachine;
+}
+
+// Checkpoints round-trip through createCheckpoint and loadSnapshot, state
+// exports through writeStateExport and readStateExport, and migrations
+// through the image serializeVirtualMachineState sends; each resumes in a
+// VM that has only read the program.
+static bool restoreFuzzVirtualMachine(VirtualMachine& virtualMachine, const FuzzProgram& program, const string& programPath, FuzzEngine engine) {
+    VirtualMachine restored = loadFuzzVirtualMachine(program, programPath, engine == FuzzEngine::Checkpoint);
+
+    if (engine == FuzzEngine::Checkpoint) {
+        string checkpointPath = fuzzDirectory().path("checkpoint.bin");
+        unlink(checkpointPath.c_str());
+        if (!virtualMachine.createCheckpoint(checkpointPath)) {
+            return false;
+        }
+        restored.loadSnapshot(checkpointPath);
+    } else if (engine == FuzzEngine::Migration) {
+        int32_t registers[32];
+        for (int i = 0; i < 32; ++i) {
+            registers[i] = virtualMachine.getRegister(i);
+        }
+
+        // A destination resumes after the MIGRATE whose counter it is sent;
+        // here the image carries the counter of the next instruction.
+        vector<uint8_t> image = serializeVirtualMachineState(registers, virtualMachine.programCounter);
+        int32_t programCounter = -1;
+        if (!deserializeVirtualMachineState(image, registers, programCounter)) {
+            return false;
+        }
+        for (int i = 0; i < 32; ++i) {
+            restored.setRegister(i, registers[i]);
+        }
+        restored.programCounter = programCounter;
+    } else {
+        string statePath = fuzzDirectory().path("state.bin");
+        vector<ProcessorState> states(1);
+        states[0].name = "fuzz";
+        states[0].programCounter = virtualMachine.programCounter;
+        for (int i = 0; i < 32; ++i) {
+            states[0].registers[i] = virtualMachine.getRegister(i);
+        }
+
+        unlink(statePath.c_str());
+        if (!writeStateExport(statePath, states) || !readStateExport(statePath, states) || states.size() != 1) {
+            return false;
+        }
+        for (int i = 0; i < 32; ++i) {
+            restored.setRegister(i, states[0].registers[i]);
+        }
+        restored.programCounter = states[0].programCounter;
+    }
+
+    virtualMachine = move(restored);
+    return true;
+}
+
+static bool runVirtualMachine(const FuzzProgram& program, const string& programPath, FuzzEngine engine, FuzzState& state) {
+    VirtualMachine virtualMachine = loadFuzzVirtualMachine(program, programPath, engine == FuzzEngine::Optimized || engine == FuzzEngine::Checkpoint);
+    if (engine == FuzzEngine::Profiled) {
+        virtualMachine.enableProfiling();
+    }
+
+    bool roundTrips = engine == FuzzEngine::Checkpoint || engine == FuzzEngine::StateExport || engine == FuzzEngine::Migration;
+    for (size_t slice = 0; virtualMachine.programCounter < static_cast<int>(virtualMachine.programLength()); ++slice) {
+        virtualMachine.executeAssemblyInstructions("fuzz");
+
+        if (roundTrips && roundTripAfter(program, slice) && !restoreFuzzVirtualMachine(virtualMachine, program, programPath, engine)) {
+            cerr << "Unable to round-trip the VM after slice " << slice << endl;
+            return false;
+        }
+    }
+
+    for (int i = 0; i < 32; ++i) {
+        state.registers[i] = virtualMachine.getRegister(i);
+    }
+    state.programCounter = virtualMachine.programCounter;
+    return true;
+}
+
+// Every lane runs the same program; lane 0 also round-trips through its
+// snapshot at the chosen slice boundaries and must still match the others.
+static bool runBatch(const FuzzProgram& program, const string& programPath, FuzzState& state) {
+    auto decodedProgram = acquireDecodedProgram(programPath, false, 0);
+    if (!decodedProgram) {
+        return false;
+    }
+
+    VirtualMachineBatch<kBatchLanes> batch(*decodedProgram, 0, kBatchLanes);
+    batch.configureVirtualMachine(program.execSliceInInstructions);
+    string lanePath = fuzzDirectory().path("state.bin");
+
+    for (size_t slice = 0; batch.programCounter < static_cast<int>(decodedProgram->programLength()); ++slice) {
+        batch.executeAssemblyInstructions();
+
+        if (roundTripAfter(program, slice)) {
+            unlink(lanePath.c_str());
+            batch.createSnapshot(0, lanePath);
+            if (!batch.loadSnapshot(0, lanePath)) {
+                return false;
+            }
+        }
+    }
+
+    for (size_t lane = 0; lane < kBatchLanes; ++lane) {
+        VirtualMachine virtualMachine = batch.extractVirtualMachine(lane);
+        FuzzState laneState;
+        for (int i = 0; i < 32; ++i) {
+            laneState.registers[i] = virtualMachine.getRegister(i);
+        }
+
+        if (lane == 0) {
+            state = laneState;
+            state.programCounter = virtualMachine.programCounter;
+        } else if (memcmp(laneState.registers, state.registers, sizeof(state.registers)) != 0) {
+            cerr << "batch lane " << lane << " differs from lane 0" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compareFuzzState(FuzzEngine engine, const FuzzState& expected, const FuzzState& actual) {
+    if (actual.programCounter != expected.programCounter) {
+        cerr << fuzzEngineName(engine) << " stopped at pc " << actual.programCounter << " instead of " << expected.programCounter << endl;
+        return false;
+    }
+
+    for (int i = 0; i < 32; ++i) {
+        if (actual.registers[i] != expected.registers[i]) {
+            cerr << fuzzEngineName(engine) << " left $" << i << " = " << actual.registers[i] << " instead of " << expected.registers[i] << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compareSnapshot(FuzzEngine engine, const FuzzState& expected, const string& snapshotPath) {
+    if (!expected.snapshotted) {
+        return true;
+    }
+
+    ifstream file(snapshotPath, ios::binary);
+    int32_t snapshot[32] = {};
+    file.read(reinterpret_cast<char*>(snapshot), sizeof(snapshot));
+
+    if (file.gcount() != static_cast<streamsize>(sizeof(snapshot)) || memcmp(snapshot, expected.snapshot, sizeof(snapshot)) != 0) {
+        cerr << fuzzEngineName(engine) << " wrote a different SNAPSHOT than the reference" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Runs one input through every engine. Returns false on any divergence,
+// after printing the first one; instructions counts guest instructions run.
+static bool fuzzOne(const uint8_t* data, size_t size, uint64_t& instructions) {
+    FuzzDirectory& directory = fuzzDirectory();
+    if (!directory.valid()) {
+        return false;
+    }
+
+    FuzzInput input{data, size};
+    FuzzProgram program = decodeFuzzInput(input);
+    string programPath = directory.path("program.asm");
+    string snapshotPath = directory.path("snapshot");
+
+    if (!writeFuzzProgram(program, programPath, snapshotPath)) {
+        return false;
+    }
+
+    FuzzState expected = runReference(program);
+
+    for (FuzzEngine engine : {FuzzEngine::Decoded, FuzzEngine::Optimized, FuzzEngine::Profiled, FuzzEngine::Batch, FuzzEngine::Checkpoint, FuzzEngine::StateExport, FuzzEngine::Migration}) {
+        string engineSnapshotPath = engine == FuzzEngine::Batch ? snapshotPath + ".1" : snapshotPath;
+        unlink(engineSnapshotPath.c_str());
+
+        FuzzState actual;
+        bool ran = engine == FuzzEngine::Batch ? runBatch(program, programPath, actual) : runVirtualMachine(program, programPath, engine, actual);
+
+        if (!ran || !compareFuzzState(engine, expected, actual) || !compareSnapshot(engine, expected, engineSnapshotPath)) {
+            cerr << "Slice " << program.execSliceInInstructions << ", " << program.instructions.size() << " instructions, program in " << programPath << endl;
+            directory.keep();
+            return false;
+        }
+        instructions += program.instructions.size();
+    }
+
+    return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    uint64_t instructions = 0;
+    if (!fuzzOne(data, size, instructions)) {
+        abort();
+    }
+    return 0;
+}
+
+#ifndef VMM_LIBFUZZER
+static bool readFuzzInput(const string& inputPath, string& input) {
+    ifstream file(inputPath, ios::binary);
+    if (!file) {
+        cerr << "Unable to open fuzz input " << inputPath << endl;
+        return false;
+    }
+
+    input.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    return true;
+}
+
+static bool writeFuzzInput(const string& inputPath, const string& input) {
+    ofstream file(inputPath, ios::binary | ios::trunc);
+    file.write(input.data(), input.size());
+    file.close();
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t iterations = 10000;
+    uint32_t seed = 1;
+    size_t max_instructions = 256;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:r:l:")) != -1) {
+        switch (option) {
+            case 'n': iterations = stoull(optarg); break;
+            case 'r': seed = stoul(optarg); break;
+            case 'l': max_instructions = max(1ul, min(stoul(optarg), kMaxFuzzInstructions)); break;
+            default:
+                cerr << "Use " << argv[0] << " [-n iterations] [-r seed] [-l max_instructions] [input_file...]" << endl;
+                return 1;
+        }
+    }
+
+    uint64_t executions = 0;
+    uint64_t instructions = 0;
+    auto start = chrono::steady_clock::now();
+
+    if (optind < argc) {
+        // Replays a corpus or crash files, one execution each.
+        for (int i = optind; i < argc; ++i) {
+            string input;
+            if (!readFuzzInput(argv[i], input)) {
+                return 1;
+            }
+            if (!fuzzOne(reinterpret_cast<const uint8_t*>(input.data()), input.size(), instructions)) {
+                cerr << argv[i] << " diverges" << endl;
+                return 1;
+            }
+            executions++;
+        }
+    } else {
+        // Header bytes, then about five bytes per instruction.
+        mt19937 random(seed);
+        string input;
+
+        for (; executions < iterations; ++executions) {
+            input.resize(9 + random() % (max_instructions * 5));
+            for (auto& byte : input) {
+                byte = static_cast<char>(random());
+            }
+
+            if (!fuzzOne(reinterpret_cast<const uint8_t*>(input.data()), input.size(), instructions)) {
+                string crashPath = "crash-" + to_string(seed) + "-" + to_string(executions);
+                if (writeFuzzInput(crashPath, input)) {
+                    cerr << "Input saved to " << crashPath << endl;
+                }
+                return 1;
+            }
+        }
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "fuzz_executions: " << executions << endl;
+    cout << "fuzz_executions_per_second: " << executions / seconds << endl;
+    cout << "fuzz_guest_instructions_per_second: " << instructions / seconds << endl;
+    return 0;
+}
+#endif
@@ -0,0 +1,45 @@
+#include "bench/resumable_migration.h"
+
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vmm/migration_session.h"
+
+using namespace std;
+using asio::ip::tcp;
+
+ResumableMigration runResumableMigration(size_t imageBytes, uint64_t dropAfterBytes, int drops, FaultMode mode, chrono::milliseconds ioTimeout) {
+    ResumableMigration result;
+    vector<uint8_t> image(imageBytes);
+    mt19937 random(1);
+    for (auto& byte : image) {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    asio::io_context context;
+    tcp::acceptor acceptor(context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    MigrationReceiver receiver;
+    bool received = false;
+    thread destination([&]() {
+        received = receiver.run(context, acceptor);
+    });
+
+    FaultProxy proxy(acceptor.local_endpoint().port(), dropAfterBytes, drops, mode);
+    MigrationSender sender(image);
+    sender.setRetries(drops + 3, chrono::milliseconds(10));
+    sender.setIoTimeout(ioTimeout);
+    bool cutOver = proxy.start() && sender.run("127.0.0.1", to_string(proxy.port())) == MigrationOutcome::CutOver;
+
+    if (!cutOver) {
+        // Ends the receiver's wait for another connection.
+        asio::post(context, [&]() { acceptor.close(); });
+    }
+    destination.join();
+
+    result.intact = cutOver && received && receiver.image() == image;
+    result.reconnects = sender.reconnects();
+    result.resentPercent = (static_cast<double>(sender.pagesSent()) / sender.pageCount() - 1) * 100;
+    return result;
+}
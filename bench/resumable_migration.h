@@ -0,0 +1,21 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "bench/fault_proxy.h"
+
+struct ResumableMigration {
+    bool intact = false;
+    int reconnects = 0;
+    // Pages sent beyond one copy of each, as a share of the image.
+    double resentPercent = 0;
+};
+
+// Migrates a random image of imageBytes over loopback through a FaultProxy
+// that closes or stalls the first drops connections after dropAfterBytes,
+// and checks that it arrives whole. The sender gives up on a connection
+// after ioTimeout; the receiver keeps the default, so a stalled connection
+// there must be dropped when the sender reconnects.
+ResumableMigration runResumableMigration(size_t imageBytes, uint64_t dropAfterBytes, int drops, FaultMode mode = FaultMode::Close, std::chrono::milliseconds ioTimeout = std::chrono::milliseconds(500));
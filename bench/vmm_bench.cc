@@ -0,0 +1,813 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "bench/resumable_migration.h"
+#include "bench/workload_generator.h"
+#include "vmm/decoded_program.h"
+#include "vmm/execution_context.h"
+#include "vmm/io_engine.h"
+#include "vmm/rate_limiter.h"
+#include "vmm/virtual_machine.h"
+#include "vmm/scheduler_arena.h"
+#include "vmm/secure_channel.h"
+#include "vmm/state_export.h"
+#include "vmm/virtual_machine_batch.h"
+#include "vmm/worker_pool.h"
+
+using namespace std;
+
+struct BenchmarkOptions {
+    size_t instructions = 2000000;
+    size_t virtualMachines = 64;
+    int execSliceInInstructions = 4;
+    size_t snapshots = 2000;
+    int trials = 3;
+    size_t workers = max(1u, thread::hardware_concurrency());
+    uint32_t seed = 1;
+    bool json = false;
+    string emitDirectory;
+};
+
+const int kWholeProgramSlice = 1 << 30;
+const size_t kClones = 1000;
+const uint32_t kGuestPagesPerVirtualMachine = 256;
+const int kGuestLoadsPerSlice = 64;
+const uint32_t kGuestLoadBenchWords = 16 << 20;
+const size_t kGuestLoads = 4 << 20;
+const size_t kConsoleRecords = 20000;
+const size_t kBlockGuests = 100;
+const size_t kBlockReadsPerGuest = 400;
+const size_t kBlockReadsPerDoorbell = 4;
+
+// Counts heap allocations made by the calling thread so the benchmark can
+// check that the execute loop stays allocation-free once warm.
+thread_local size_t threadAllocations = 0;
+
+// The replacements are kept out of line; inlined, GCC pairs malloc and free
+// with the operator new and delete calls around them and warns at every
+// container in this file.
+__attribute__((noinline)) void* operator new(size_t size) {
+    threadAllocations++;
+
+    if (void* pointer = malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+__attribute__((noinline)) void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+template <typename Function>
+static double bestSeconds(int trials, Function function) {
+    double best = 0;
+
+    for (int trial = 0; trial < trials; ++trial) {
+        auto start = chrono::steady_clock::now();
+        function();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        best = trial == 0 ? seconds : min(best, seconds);
+    }
+
+    return best;
+}
+
+static double runToCompletion(const string& binary, int trials, bool traced = false) {
+    return bestSeconds(trials, [&]() {
+        VirtualMachine virtualMachine;
+        virtualMachine.configureVirtualMachine(kWholeProgramSlice);
+        virtualMachine.readAssemblyInstructions(binary);
+        if (traced) {
+            virtualMachine.enableTracing("Benchmark");
+        }
+
+        while (virtualMachine.programCounter < virtualMachine.programLength()) {
+            virtualMachine.executeAssemblyInstructions("Benchmark");
+        }
+    });
+}
+
+static double runBatchToCompletion(const DecodedProgram& program, int trials) {
+    return bestSeconds(trials, [&]() {
+        VirtualMachineBatch<kBatchLanes> batch(program, 0, kBatchLanes);
+        batch.configureVirtualMachine(kWholeProgramSlice);
+
+        while (batch.programCounter < program.programLength()) {
+            batch.executeAssemblyInstructions();
+        }
+    });
+}
+
+// Allocations made by executeAssemblyInstructions after the first slice,
+// with the program already decoded.
+static size_t steadyStateAllocations(const string& binary, int execSliceInInstructions) {
+    VirtualMachine virtualMachine;
+    virtualMachine.configureVirtualMachine(execSliceInInstructions);
+    virtualMachine.readAssemblyInstructions(binary);
+    virtualMachine.executeAssemblyInstructions("Benchmark");
+
+    size_t allocations = threadAllocations;
+    while (virtualMachine.programCounter < virtualMachine.programLength()) {
+        virtualMachine.executeAssemblyInstructions("Benchmark");
+    }
+
+    return threadAllocations - allocations;
+}
+
+static ExecutionContext benchmarkContext(VirtualMachine& virtualMachine, size_t& slices) {
+    while (virtualMachine.programCounter < virtualMachine.programLength()) {
+        co_await IoCompletion{virtualMachine};
+        virtualMachine.executeAssemblyInstructions("Benchmark");
+        slices++;
+        co_await SliceExpired{};
+    }
+}
+
+// With contexts every VM runs as an execution context resumed by the
+// ContextScheduler, as in the monitor; otherwise a plain loop picks them.
+static pair<double, size_t> runRoundRobin(const string& binary, const BenchmarkOptions& options, int execSliceInInstructions, bool contexts = false) {
+    size_t slices = 0;
+    double seconds = bestSeconds(options.trials, [&]() {
+        vector<VirtualMachine> virtualMachines(options.virtualMachines);
+        for (auto& virtualMachine : virtualMachines) {
+            virtualMachine.configureVirtualMachine(execSliceInInstructions);
+            virtualMachine.readAssemblyInstructions(binary);
+        }
+
+        slices = 0;
+        if (contexts) {
+            ContextScheduler scheduler;
+            for (auto& virtualMachine : virtualMachines) {
+                scheduler.spawn(benchmarkContext(virtualMachine, slices));
+            }
+            while (scheduler.runRound()) {
+            }
+            return;
+        }
+
+        bool running = true;
+        while (running) {
+            running = false;
+
+            for (auto& virtualMachine : virtualMachines) {
+                if (virtualMachine.programCounter < virtualMachine.programLength()) {
+                    virtualMachine.executeAssemblyInstructions("Benchmark");
+                    slices++;
+                    running = true;
+                }
+            }
+        }
+    });
+
+    return make_pair(seconds, slices);
+}
+
+static atomic<int32_t> guestLoadSink;
+
+// Round robin on a worker pool where every slice is followed by random loads
+// from the VM's 1 MiB of guest memory. Without placement all VMs are built
+// on the calling thread, so on a multi-node host most workers read remote
+// memory; with it each VM lives on its home worker's node.
+static pair<double, size_t> runOnWorkers(const string& binary, const BenchmarkOptions& options, bool numaPlacement) {
+    double best = 0;
+    size_t slices = 0;
+
+    for (int trial = 0; trial < options.trials; ++trial) {
+        WorkerPool pool(options.workers, numaPlacement);
+        atomic<size_t> slicesRun(0);
+
+        for (size_t i = 0; i < options.virtualMachines; ++i) {
+            pool.spawn(i, "Benchmark", [&](VirtualMachine& virtualMachine) {
+                virtualMachine.configureVirtualMachine(options.execSliceInInstructions);
+                virtualMachine.readAssemblyInstructions(binary);
+
+                for (uint32_t page = 0; page < kGuestPagesPerVirtualMachine; ++page) {
+                    for (uint32_t word = 0; word < GuestMemory::kPageWords; word += 16) {
+                        virtualMachine.guestMemory().store(page * GuestMemory::kPageWords + word, word);
+                    }
+                }
+            }, [&](VirtualMachine& virtualMachine) {
+                uint32_t address = virtualMachine.programCounter * 2654435761u;
+                int32_t sum = 0;
+
+                for (int load = 0; load < kGuestLoadsPerSlice; ++load) {
+                    address = address * 1664525u + 1013904223u;
+                    sum += virtualMachine.guestMemory().load(address % (kGuestPagesPerVirtualMachine * GuestMemory::kPageWords));
+                }
+
+                guestLoadSink.store(sum, memory_order_relaxed);
+                slicesRun.fetch_add(1, memory_order_relaxed);
+            });
+        }
+
+        auto start = chrono::steady_clock::now();
+        pool.runToCompletion();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        best = trial == 0 ? seconds : min(best, seconds);
+        slices = slicesRun.load();
+    }
+
+    return make_pair(best, slices);
+}
+
+// Random word loads over 64 MiB of guest memory in 4 KiB or 2 MiB pages.
+static double guestLoadNanoseconds(bool hugePages, int trials) {
+    GuestMemory memory;
+    if (hugePages) {
+        memory.enableHugePages();
+    }
+
+    for (uint32_t address = 0; address < kGuestLoadBenchWords; address += GuestMemory::kPageWords) {
+        memory.store(address, address);
+    }
+
+    uint32_t address = 1;
+    int32_t sum = 0;
+    double seconds = bestSeconds(trials, [&]() {
+        for (size_t load = 0; load < kGuestLoads; ++load) {
+            address = address * 1664525u + 1013904223u;
+            sum += memory.load(address % kGuestLoadBenchWords);
+        }
+    });
+
+    guestLoadSink.store(sum, memory_order_relaxed);
+    return seconds * 1e9 / kGuestLoads;
+}
+
+// Console records written to /dev/null, including the wait for the last
+// batch to be serviced.
+static double consoleNanosecondsPerRecord(const string& binary, int trials) {
+    double seconds = bestSeconds(trials, [&]() {
+        VirtualMachine virtualMachine;
+        virtualMachine.configureVirtualMachine(kWholeProgramSlice);
+        virtualMachine.attachDevice(kConsoleDevice, openConsoleDevice("/dev/null"));
+        virtualMachine.readAssemblyInstructions(binary);
+
+        while (virtualMachine.programCounter < virtualMachine.programLength()) {
+            virtualMachine.executeAssemblyInstructions("Benchmark");
+        }
+    });
+
+    return seconds * 1e9 / kConsoleRecords;
+}
+
+static double threadCpuSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// I/O-heavy guests sharing one scheduler thread, scheduled like vmm does:
+// VMs parked on I/O sit their rounds out and the thread sleeps only when
+// every VM waits. Returns reads per second and the share of the wall time
+// the scheduler thread spent on a CPU.
+static pair<double, double> runBlockReads(const string& binary, const string& disk, IoEngineKind engine, const BenchmarkOptions& options) {
+    selectIoEngine(engine);
+    double cpuSeconds = 0;
+
+    double seconds = bestSeconds(options.trials, [&]() {
+        vector<VirtualMachine> virtualMachines(kBlockGuests);
+        for (auto& virtualMachine : virtualMachines) {
+            virtualMachine.configureVirtualMachine(options.execSliceInInstructions);
+            virtualMachine.attachDevice(kBlockDevice, openBlockDevice(disk));
+            virtualMachine.readAssemblyInstructions(binary);
+        }
+
+        double cpuStart = threadCpuSeconds();
+        bool running = true;
+        while (running) {
+            pollIoCompletions();
+            uint64_t generation = ioCompletionGeneration();
+            bool ran = false;
+            running = false;
+
+            for (auto& virtualMachine : virtualMachines) {
+                if (virtualMachine.programCounter >= virtualMachine.programLength()) {
+                    continue;
+                }
+                running = true;
+
+                if (!virtualMachine.waitingOnIo()) {
+                    virtualMachine.executeAssemblyInstructions("Benchmark");
+                    ran = true;
+                }
+            }
+
+            if (running && !ran) {
+                waitForIoCompletion(generation);
+            }
+        }
+        cpuSeconds = threadCpuSeconds() - cpuStart;
+    });
+
+    selectIoEngine(IoEngineKind::Uring);
+    return make_pair(kBlockGuests * kBlockReadsPerGuest / seconds, min(1.0, cpuSeconds / seconds));
+}
+
+static const int kMigrationStreams = 2;
+static const size_t kMigrationStreamBytes = 16 << 20;
+static const size_t kMigrationChunkBytes = 64 * 1024;
+
+// Concurrent migration streams over socketpairs, each held to its own
+// limit and all sharing the host-wide one. Returns the combined bytes per
+// second they achieved.
+static double runLimitedMigrations(uint64_t streamBytesPerSecond, uint64_t hostBytesPerSecond) {
+    migrationBandwidth().setRate(hostBytesPerSecond);
+    auto start = chrono::steady_clock::now();
+
+    vector<thread> streams;
+    for (int stream = 0; stream < kMigrationStreams; ++stream) {
+        streams.emplace_back([&]() {
+            int sockets[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+                return;
+            }
+
+            thread receiver([&]() {
+                vector<char> buffer(kMigrationChunkBytes);
+                while (read(sockets[1], buffer.data(), buffer.size()) > 0) {
+                }
+            });
+
+            MigrationRateLimiter limiter(streamBytesPerSecond);
+            vector<char> chunk(kMigrationChunkBytes);
+            for (size_t sent = 0; sent < kMigrationStreamBytes; sent += chunk.size()) {
+                limiter.throttle(chunk.size());
+                for (size_t written = 0; written < chunk.size();) {
+                    ssize_t bytes = write(sockets[0], chunk.data() + written, chunk.size() - written);
+                    if (bytes <= 0) {
+                        break;
+                    }
+                    written += bytes;
+                }
+            }
+
+            close(sockets[0]);
+            receiver.join();
+            close(sockets[1]);
+        });
+    }
+
+    for (auto& stream : streams) {
+        stream.join();
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    migrationBandwidth().setRate(0);
+    return kMigrationStreams * kMigrationStreamBytes / seconds;
+}
+
+static const size_t kLoopbackStreamBytes = 64 << 20;
+static const size_t kLoopbackFrameBytes = 64 * 1024;
+
+static bool loopbackConnection(int& sender, int& receiver) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    bool connected = listener >= 0 && bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && listen(listener, 1) == 0 &&
+                     getsockname(listener, reinterpret_cast<sockaddr*>(&address), &addressLength) == 0;
+
+    sender = connected ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+    connected = connected && sender >= 0 && connect(sender, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    receiver = connected ? accept(listener, nullptr, nullptr) : -1;
+
+    if (listener >= 0) {
+        close(listener);
+    }
+    return connected && receiver >= 0;
+}
+
+static bool transferAll(int fd, uint8_t* data, size_t length, bool writing) {
+    for (size_t done = 0; done < length;) {
+        ssize_t bytes = writing ? write(fd, data + done, length - done) : read(fd, data + done, length - done);
+        if (bytes <= 0) {
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+// Parallel streams over TCP loopback in migration-sized frames. Encrypted,
+// every frame is sealed by the sender and opened by the receiver, each
+// stream with its own channels. Returns the combined payload bytes per
+// second, or 0 if a stream failed.
+static double runLoopbackStreams(bool encrypted, int streams, int trials) {
+    SecureKey key;
+    key.fill(0x42);
+    atomic<bool> failed(false);
+
+    double seconds = bestSeconds(trials, [&]() {
+        vector<thread> senders;
+
+        for (int stream = 0; stream < streams; ++stream) {
+            senders.emplace_back([&]() {
+                // Both ends live in this process, so their hellos are
+                // exchanged directly rather than over the connection.
+                unique_ptr<SecureChannel> channel(encrypted ? new SecureChannel(key, true) : nullptr);
+                unique_ptr<SecureChannel> peer(encrypted ? new SecureChannel(key, false) : nullptr);
+                if (encrypted && (!channel->accept(peer->hello()) || !peer->accept(channel->hello()))) {
+                    failed = true;
+                    return;
+                }
+
+                int sender = -1;
+                int receiver = -1;
+                if (!loopbackConnection(sender, receiver)) {
+                    failed = true;
+                    return;
+                }
+
+                thread reader([&]() {
+                    SecureChannel* channel = peer.get();
+                    vector<uint8_t> frame(kSecureFrameHeaderBytes + kLoopbackFrameBytes + kSecureTagBytes);
+                    vector<uint8_t> payload;
+                    size_t frameBytes = encrypted ? frame.size() : kLoopbackFrameBytes;
+
+                    for (size_t received = 0; received < kLoopbackStreamBytes; received += kLoopbackFrameBytes) {
+                        payload.clear();
+                        if (!transferAll(receiver, frame.data(), frameBytes, false) || (channel && !channel->open(frame.data(), frameBytes, payload))) {
+                            failed = true;
+                            return;
+                        }
+                    }
+                });
+
+                vector<uint8_t> chunk(kLoopbackFrameBytes, 0x5a);
+                vector<uint8_t> frame;
+
+                for (size_t sent = 0; sent < kLoopbackStreamBytes; sent += chunk.size()) {
+                    frame.clear();
+                    if (channel && !channel->seal(chunk.data(), chunk.size(), frame)) {
+                        failed = true;
+                        break;
+                    }
+
+                    vector<uint8_t>& wire = channel ? frame : chunk;
+                    if (!transferAll(sender, wire.data(), wire.size(), true)) {
+                        failed = true;
+                        break;
+                    }
+                }
+
+                shutdown(sender, SHUT_WR);
+                reader.join();
+                close(sender);
+                close(receiver);
+            });
+        }
+
+        for (auto& sender : senders) {
+            sender.join();
+        }
+    });
+
+    return failed ? 0 : streams * kLoopbackStreamBytes / seconds;
+}
+
+// Sealing alone on one thread, the per-core ceiling of an encrypted stream.
+static double sealBytesPerSecond(int trials) {
+    SecureKey key;
+    key.fill(0x42);
+    SecureChannel channel(key, true);
+    SecureChannel peer(key, false);
+    channel.accept(peer.hello());
+    static const uint8_t chunk[kLoopbackFrameBytes] = {};
+    vector<uint8_t> frame;
+
+    double seconds = bestSeconds(trials, [&]() {
+        for (size_t sealed = 0; sealed < kLoopbackStreamBytes; sealed += sizeof(chunk)) {
+            frame.clear();
+            channel.seal(chunk, sizeof(chunk), frame);
+        }
+    });
+
+    return kLoopbackStreamBytes / seconds;
+}
+
+static string benchVirtualMachineName(size_t index) {
+    string name = "Virtual Machine ";
+    name += to_string(index + 1);
+    return name;
+}
+
+// The per-register dump flushes a line at a time; cout goes to /dev/null
+// so only that cost is measured.
+static double dumpStateSeconds(vector<VirtualMachine>& virtualMachines, int trials) {
+    ofstream sink("/dev/null");
+    streambuf* console = cout.rdbuf(sink.rdbuf());
+
+    double seconds = bestSeconds(trials, [&]() {
+        for (size_t i = 0; i < virtualMachines.size(); ++i) {
+            virtualMachines[i].dumpProcessorState(benchVirtualMachineName(i));
+        }
+    });
+
+    cout.rdbuf(console);
+    return seconds;
+}
+
+static double exportStateSeconds(const vector<VirtualMachine>& virtualMachines, const string& exportPath, int trials) {
+    return bestSeconds(trials, [&]() {
+        vector<ProcessorState> states(virtualMachines.size());
+
+        for (size_t i = 0; i < virtualMachines.size(); ++i) {
+            states[i].name = benchVirtualMachineName(i);
+            states[i].programCounter = virtualMachines[i].programCounter;
+            for (int reg = 0; reg < 32; ++reg) {
+                states[i].registers[reg] = virtualMachines[i].getRegister(reg);
+            }
+        }
+        writeStateExport(exportPath, states);
+    });
+}
+
+static long peakResidentSetKilobytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool emitWorkloads(const BenchmarkOptions& options) {
+    WorkloadOptions workload;
+    workload.instructions = options.instructions;
+    workload.seed = options.seed;
+    workload.snapshotDirectory = options.emitDirectory;
+
+    for (WorkloadMix mix : {WorkloadMix::Arithmetic, WorkloadMix::Shift, WorkloadMix::Snapshot}) {
+        string binary = options.emitDirectory + "/" + workloadMixName(mix) + ".asm";
+        if (!generateWorkload(mix, workload, binary) || !generateVirtualMachineConfig(options.emitDirectory + "/" + workloadMixName(mix) + ".cfg", binary, kWholeProgramSlice)) {
+            return false;
+        }
+    }
+
+    workload.instructions = max<size_t>(1, options.instructions / options.virtualMachines);
+    string binary = options.emitDirectory + "/round_robin.asm";
+    if (!generateWorkload(WorkloadMix::RoundRobin, workload, binary)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < options.virtualMachines; ++i) {
+        if (!generateVirtualMachineConfig(options.emitDirectory + "/round_robin_" + to_string(i + 1) + ".cfg", binary, options.execSliceInInstructions)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:m:s:p:t:r:w:je:")) != -1) {
+        switch (option) {
+            case 'n': options.instructions = stoul(optarg); break;
+            case 'm': options.virtualMachines = max(1ul, stoul(optarg)); break;
+            case 's': options.execSliceInInstructions = max(1, stoi(optarg)); break;
+            case 'p': options.snapshots = max(1ul, stoul(optarg)); break;
+            case 't': options.trials = max(1, stoi(optarg)); break;
+            case 'r': options.seed = stoul(optarg); break;
+            case 'w': options.workers = max(1ul, stoul(optarg)); break;
+            case 'j': options.json = true; break;
+            case 'e': options.emitDirectory = optarg; break;
+            default:
+                cerr << "Use " << argv[0] << " [-n instructions] [-m virtual_machines] [-s slice] [-p snapshots] [-t trials] [-r seed] [-w workers] [-j] [-e emit_directory]" << endl;
+                return 1;
+        }
+    }
+
+    if (!options.emitDirectory.empty()) {
+        return emitWorkloads(options) ? 0 : 1;
+    }
+
+    char directoryTemplate[] = "/tmp/vmm-bench-XXXXXX";
+    if (mkdtemp(directoryTemplate) == nullptr) {
+        cerr << "Unable to create benchmark directory" << endl;
+        return 1;
+    }
+    string directory = directoryTemplate;
+    vector<string> files;
+
+    WorkloadOptions workload;
+    workload.instructions = options.instructions;
+    workload.seed = options.seed;
+    workload.snapshotDirectory = directory;
+
+    vector<pair<string, double>> results;
+    size_t executeAllocations = 0;
+
+    for (WorkloadMix mix : {WorkloadMix::Arithmetic, WorkloadMix::Shift, WorkloadMix::Snapshot}) {
+        string binary = directory + "/" + workloadMixName(mix) + ".asm";
+        files.push_back(binary);
+        if (!generateWorkload(mix, workload, binary)) {
+            return 1;
+        }
+
+        auto start = chrono::steady_clock::now();
+        shared_ptr<const DecodedProgram> program = acquireDecodedProgram(binary, false, 0);
+        program->ensureDecoded(program->code.size());
+        double decodeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        double mips = options.instructions / runToCompletion(binary, options.trials) / 1e6;
+        results.emplace_back(string(workloadMixName(mix)) + "_mips", mips);
+        executeAllocations += steadyStateAllocations(binary, options.execSliceInInstructions);
+
+        if (mix == WorkloadMix::Arithmetic) {
+            results.emplace_back("decode_ns_per_instruction", decodeSeconds * 1e9 / options.instructions);
+            results.emplace_back("arithmetic_batch_lane_mips", options.instructions * kBatchLanes / runBatchToCompletion(*program, options.trials) / 1e6);
+#if !defined(VMM_NO_INSTRUCTION_TRACE)
+            // arithmetic_mips is the cost of tracing compiled in but off;
+            // compare it with a VMM_INSTRUCTION_TRACE=OFF build.
+            results.emplace_back("arithmetic_traced_mips", options.instructions / runToCompletion(binary, options.trials, true) / 1e6);
+#endif
+        }
+    }
+
+    workload.instructions = max<size_t>(1, options.instructions / options.virtualMachines);
+    string roundRobinBinary = directory + "/round_robin.asm";
+    files.push_back(roundRobinBinary);
+    if (!generateWorkload(WorkloadMix::RoundRobin, workload, roundRobinBinary)) {
+        return 1;
+    }
+
+    // The same VMs run the same binary once with tiny slices and once with a
+    // single slice each; the difference is what the extra switches cost.
+    pair<double, size_t> roundRobin = runRoundRobin(roundRobinBinary, options, options.execSliceInInstructions);
+    pair<double, size_t> wholeProgram = runRoundRobin(roundRobinBinary, options, kWholeProgramSlice);
+    results.emplace_back("round_robin_ns_per_slice", roundRobin.first * 1e9 / roundRobin.second);
+    results.emplace_back("context_switch_ns", (roundRobin.first - wholeProgram.first) * 1e9 / max<size_t>(1, roundRobin.second - wholeProgram.second));
+    pair<double, size_t> coroutineRoundRobin = runRoundRobin(roundRobinBinary, options, options.execSliceInInstructions, true);
+    results.emplace_back("coroutine_round_robin_ns_per_slice", coroutineRoundRobin.first * 1e9 / coroutineRoundRobin.second);
+
+    pair<double, size_t> placed = runOnWorkers(roundRobinBinary, options, true);
+    pair<double, size_t> unplaced = runOnWorkers(roundRobinBinary, options, false);
+    results.emplace_back("numa_nodes", numaNodeCount());
+    results.emplace_back("numa_placed_ns_per_slice", placed.first * 1e9 / max<size_t>(1, placed.second));
+    results.emplace_back("numa_unplaced_ns_per_slice", unplaced.first * 1e9 / max<size_t>(1, unplaced.second));
+
+    results.emplace_back("guest_load_ns_4k_pages", guestLoadNanoseconds(false, options.trials));
+    results.emplace_back("guest_load_ns_2m_pages", guestLoadNanoseconds(true, options.trials));
+
+    // One doorbell per record against one per ring's worth of records.
+    workload.instructions = kConsoleRecords;
+    for (size_t interval : {size_t(1), size_t(kIoRingEntries)}) {
+        string consoleBinary = directory + "/console_" + to_string(interval) + ".asm";
+        files.push_back(consoleBinary);
+        workload.doorbellInterval = interval;
+        if (!generateWorkload(WorkloadMix::Console, workload, consoleBinary)) {
+            return 1;
+        }
+        results.emplace_back(interval == 1 ? "console_ns_per_record_unbatched" : "console_ns_per_record_batched", consoleNanosecondsPerRecord(consoleBinary, options.trials));
+    }
+
+    // The same reads once through io_uring with parking and once with
+    // pread blocking the scheduler thread.
+    string blockBinary = directory + "/block_read.asm";
+    string blockDisk = directory + "/block.disk";
+    files.push_back(blockBinary);
+    files.push_back(blockDisk);
+    workload.instructions = kBlockReadsPerGuest;
+    workload.doorbellInterval = kBlockReadsPerDoorbell;
+    if (!generateWorkload(WorkloadMix::BlockRead, workload, blockBinary)) {
+        return 1;
+    }
+
+    // A sparse disk, so reads cost the I/O path rather than the media.
+    int diskFd = open(blockDisk.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (diskFd < 0 || ftruncate(diskFd, static_cast<off_t>(workload.blockDeviceWords) * sizeof(int32_t)) != 0) {
+        cerr << "Unable to create " << blockDisk << endl;
+        return 1;
+    }
+    close(diskFd);
+
+    results.emplace_back("io_engine_uring", ioEngine() == IoEngineKind::Uring);
+    for (IoEngineKind engine : {IoEngineKind::Uring, IoEngineKind::Blocking}) {
+        pair<double, double> blockReads = runBlockReads(blockBinary, blockDisk, engine, options);
+        results.emplace_back(string("block_iops_") + ioEngineName(engine), blockReads.first);
+        results.emplace_back(string("block_scheduler_utilization_") + ioEngineName(engine), blockReads.second);
+    }
+
+    // Two streams limited to 80 MB/s each under a 100 MB/s host cap should
+    // together achieve the cap, not 160 MB/s.
+    const uint64_t migrationStreamRate = 80000000;
+    const uint64_t migrationHostRate = 100000000;
+    results.emplace_back("migration_target_mbit", migrationHostRate * 8 / 1e6);
+    results.emplace_back("migration_achieved_mbit", runLimitedMigrations(migrationStreamRate, migrationHostRate) * 8 / 1e6);
+
+    if (secureChannelAvailable()) {
+        int streams = max(2u, thread::hardware_concurrency());
+        double plaintext = runLoopbackStreams(false, streams, options.trials);
+        double encrypted = runLoopbackStreams(true, streams, options.trials);
+        results.emplace_back("loopback_plaintext_mbyte_per_s", plaintext / 1e6);
+        results.emplace_back("loopback_aes_gcm_mbyte_per_s", encrypted / 1e6);
+        results.emplace_back("loopback_aes_gcm_overhead_percent", plaintext > 0 ? (1 - encrypted / plaintext) * 100 : 0);
+        results.emplace_back("aes_gcm_seal_mbyte_per_s", sealBytesPerSecond(options.trials) / 1e6);
+    }
+
+    // 8 MiB through a proxy cutting the first two connections at 3 MiB.
+    ResumableMigration resumable = runResumableMigration(8 << 20, 3 << 20, 2);
+    results.emplace_back("resumable_migration_intact", resumable.intact);
+    results.emplace_back("resumable_migration_reconnects", resumable.reconnects);
+    results.emplace_back("resumable_migration_resent_percent", resumable.resentPercent);
+
+    // The same, with the two connections left hanging instead of closed.
+    ResumableMigration stalled = runResumableMigration(8 << 20, 3 << 20, 2, FaultMode::Stall);
+    results.emplace_back("stalled_migration_intact", stalled.intact);
+    results.emplace_back("stalled_migration_reconnects", stalled.reconnects);
+
+    VirtualMachine parent;
+    parent.configureVirtualMachine(options.execSliceInInstructions);
+    parent.readAssemblyInstructions(roundRobinBinary);
+    double cloneSeconds = bestSeconds(options.trials, [&]() {
+        vector<VirtualMachine> clones = parent.cloneVirtualMachine(kClones);
+    });
+    results.emplace_back("clone_1000_vms_ms", cloneSeconds * 1e3);
+
+    vector<VirtualMachine> stateMachines = parent.cloneVirtualMachine(kClones);
+    string stateBinary = directory + "/state.bin";
+    string stateCsv = directory + "/state.csv";
+    files.push_back(stateBinary);
+    files.push_back(stateCsv);
+    results.emplace_back("dump_state_1000_vms_ms", dumpStateSeconds(stateMachines, options.trials) * 1e3);
+    results.emplace_back("export_state_1000_vms_ms", exportStateSeconds(stateMachines, stateBinary, options.trials) * 1e3);
+    results.emplace_back("export_state_csv_1000_vms_ms", exportStateSeconds(stateMachines, stateCsv, options.trials) * 1e3);
+
+    string latencySnapshot = directory + "/latency.bin";
+    files.push_back(latencySnapshot);
+    VirtualMachine snapshotMachine;
+    double snapshotSeconds = bestSeconds(options.trials, [&]() {
+        for (size_t i = 0; i < options.snapshots; ++i) {
+            snapshotMachine.createSnapshot(latencySnapshot);
+        }
+    });
+    results.emplace_back("snapshot_latency_us", snapshotSeconds * 1e6 / options.snapshots);
+    results.emplace_back("execute_allocations", executeAllocations);
+    results.emplace_back("peak_rss_kb", peakResidentSetKilobytes());
+
+    for (int i = 0; i < 4; ++i) {
+        files.push_back(directory + "/snapshot_" + to_string(i) + ".bin");
+    }
+    for (const auto& file : files) {
+        remove(file.c_str());
+    }
+    rmdir(directory.c_str());
+
+    if (options.json) {
+        cout << "{" << endl;
+        cout << "  \"benchmark\": \"vmm-bench\"," << endl;
+        cout << "  \"instructions\": " << options.instructions << "," << endl;
+        cout << "  \"virtual_machines\": " << options.virtualMachines << "," << endl;
+        cout << "  \"slice\": " << options.execSliceInInstructions << "," << endl;
+        cout << "  \"seed\": " << options.seed << "," << endl;
+        cout << "  \"workers\": " << options.workers << "," << endl;
+        cout << "  \"batch_lanes\": " << kBatchLanes << "," << endl;
+#if defined(VMM_NO_INSTRUCTION_TRACE)
+        cout << "  \"instruction_trace\": false," << endl;
+#else
+        cout << "  \"instruction_trace\": true," << endl;
+#endif
+        cout << "  \"results\": {" << endl;
+        for (size_t i = 0; i < results.size(); ++i) {
+            cout << "    \"" << results[i].first << "\": " << results[i].second << (i + 1 < results.size() ? "," : "") << endl;
+        }
+        cout << "  }" << endl;
+        cout << "}" << endl;
+    } else {
+        for (const auto& result : results) {
+            cout << result.first << ": " << result.second << endl;
+        }
+    }
+
+    if (executeAllocations > 0) {
+        cerr << "executeAssemblyInstructions allocated " << executeAllocations << " times after warm-up" << endl;
+        return 1;
+    }
+
+    return 0;
+}
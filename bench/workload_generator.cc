@@ -0,0 +1,102 @@
+#include "bench/workload_generator.h"
+
+#include <fstream>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+const char* workloadMixName(WorkloadMix mix) {
+    switch (mix) {
+        case WorkloadMix::Arithmetic: return "arithmetic";
+        case WorkloadMix::Shift: return "shift";
+        case WorkloadMix::Snapshot: return "snapshot";
+        case WorkloadMix::RoundRobin: return "round_robin";
+        case WorkloadMix::Console: return "console";
+        case WorkloadMix::BlockRead: return "block_read";
+    }
+    return "unknown";
+}
+
+static string reg(mt19937& random) {
+    string name = "$";
+    name += to_string(1 + random() % 15);
+    return name;
+}
+
+static void writeArithmeticInstruction(ofstream& program, mt19937& random) {
+    switch (random() % 9) {
+        case 0: program << "li " << reg(random) << ", " << static_cast<int>(random() % 2001) - 1000 << "\n"; break;
+        case 1: program << "add " << reg(random) << ", " << reg(random) << ", " << reg(random) << "\n"; break;
+        case 2: program << "addi " << reg(random) << ", " << reg(random) << ", " << static_cast<int>(random() % 201) - 100 << "\n"; break;
+        case 3: program << "sub " << reg(random) << ", " << reg(random) << ", " << reg(random) << "\n"; break;
+        case 4: program << "mul " << reg(random) << ", " << reg(random) << ", " << reg(random) << "\n"; break;
+        case 5: program << "and " << reg(random) << ", " << reg(random) << ", " << reg(random) << "\n"; break;
+        case 6: program << "or " << reg(random) << ", " << reg(random) << ", " << reg(random) << "\n"; break;
+        case 7: program << "or " << reg(random) << ", " << reg(random) << ", " << random() % 256 << "\n"; break;
+        case 8: program << "xor " << reg(random) << ", " << reg(random) << ", " << reg(random) << "\n"; break;
+    }
+}
+
+static void writeShiftInstruction(ofstream& program, mt19937& random) {
+    switch (random() % 10) {
+        case 0: program << "li " << reg(random) << ", " << static_cast<int>(random() % 2001) - 1000 << "\n"; break;
+        case 1:
+        case 2: program << "add " << reg(random) << ", " << reg(random) << ", " << reg(random) << "\n"; break;
+        case 3:
+        case 4:
+        case 5:
+        case 6: program << "sll " << reg(random) << ", " << reg(random) << ", " << random() % 32 << "\n"; break;
+        default: program << "srl " << reg(random) << ", " << reg(random) << ", " << random() % 32 << "\n"; break;
+    }
+}
+
+bool generateWorkload(WorkloadMix mix, const WorkloadOptions& options, const string& filePath) {
+    ofstream program(filePath);
+    if (!program.is_open()) {
+        cerr << "Error while creating workload " << filePath << endl;
+        return false;
+    }
+
+    static const char* roundRobinCycle[] = {"addi $1, $1, 1", "add $2, $2, $1", "xor $3, $3, $2", "sll $4, $3, 1"};
+
+    mt19937 random(options.seed);
+    for (size_t i = 0; i < options.instructions; ++i) {
+        if (mix == WorkloadMix::RoundRobin) {
+            program << roundRobinCycle[i % 4] << "\n";
+        } else if (mix == WorkloadMix::BlockRead) {
+            program << "li $1, 0\nout $1, 1\nli $2, " << random() % options.blockDeviceWords << "\nout $2, 1\nli $3, 1\nout $3, 1\n";
+            if (i % options.doorbellInterval == options.doorbellInterval - 1 || i + 1 == options.instructions) {
+                program << "doorbell 1\n";
+                for (size_t read = i - i % options.doorbellInterval; read <= i; ++read) {
+                    program << "in $4, 1\nin $5, 1\n";
+                }
+            }
+        } else if (mix == WorkloadMix::Console) {
+            program << "out " << reg(random) << ", 0\n";
+            if (i % options.doorbellInterval == options.doorbellInterval - 1 || i + 1 == options.instructions) {
+                program << "doorbell 0\n";
+            }
+        } else if (mix == WorkloadMix::Snapshot && options.snapshotInterval > 0 && i % options.snapshotInterval == options.snapshotInterval - 1) {
+            program << "SNAPSHOT " << options.snapshotDirectory << "/snapshot_" << (i / options.snapshotInterval) % 4 << ".bin\n";
+        } else if (mix == WorkloadMix::Shift) {
+            writeShiftInstruction(program, random);
+        } else {
+            writeArithmeticInstruction(program, random);
+        }
+    }
+
+    return program.good();
+}
+
+bool generateVirtualMachineConfig(const string& filePath, const string& binaryPath, int execSliceInInstructions) {
+    ofstream config(filePath);
+    if (!config.is_open()) {
+        cerr << "Error while creating configuration " << filePath << endl;
+        return false;
+    }
+
+    config << "vm_exec_slice_in_instructions=" << execSliceInInstructions << "\n";
+    config << "vm_binary=" << binaryPath << "\n";
+    return config.good();
+}
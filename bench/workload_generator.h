@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class WorkloadMix {
+    Arithmetic,
+    Shift,
+    Snapshot,
+    // A fixed four-instruction cycle, so per-instruction cost does not depend
+    // on how finely the scheduler slices it and only switch overhead differs.
+    RoundRobin,
+    // Console records, one out per instruction and a doorbell after every
+    // doorbellInterval of them.
+    Console,
+    // One-word block reads at random offsets below blockDeviceWords,
+    // doorbellInterval per doorbell, each batch drained before the next.
+    BlockRead
+};
+
+struct WorkloadOptions {
+    size_t instructions = 1000000;
+    uint32_t seed = 1;
+    // SNAPSHOT-heavy mix: one SNAPSHOT every snapshotInterval instructions,
+    // cycling through four files in snapshotDirectory.
+    size_t snapshotInterval = 64;
+    std::string snapshotDirectory = ".";
+    size_t doorbellInterval = 1;
+    uint32_t blockDeviceWords = 1 << 22;
+};
+
+const char* workloadMixName(WorkloadMix mix);
+
+// Writes a synthetic guest program for the given instruction mix. The
+// generator only uses mt19937's raw output, so a seed produces the same file
+// on every platform and the numbers stay comparable across commits.
+bool generateWorkload(WorkloadMix mix, const WorkloadOptions& options, const std::string& filePath);
+
+// Writes a per-VM configuration file in the format vmm reads with -v.
+bool generateVirtualMachineConfig(const std::string& filePath, const std::string& binaryPath, int execSliceInInstructions);
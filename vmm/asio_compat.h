@@ -0,0 +1,15 @@
+#pragma once
+
+// The migration programs are written against standalone asio; hosts that
+// only ship Boost get the same API through the asio namespace alias.
+#if defined(VMM_USE_BOOST_ASIO)
+// Older Boost headers use std::exchange without including <utility>,
+// which C++20 standard headers no longer pull in for them.
+#include <utility>
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+typedef boost::system::error_code AsioErrorCode;
+#else
+#include <asio.hpp>
+typedef asio::error_code AsioErrorCode;
+#endif
@@ -0,0 +1,88 @@
+#include "vmm/checkpoint_policy.h"
+#include "vmm/virtual_machine.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+bool CheckpointConfig::enabled() const {
+    return !pathPrefix.empty() && (intervalInstructions > 0 || intervalMilliseconds > 0);
+}
+
+CheckpointPolicy::CheckpointPolicy(const CheckpointConfig& config, size_t virtualMachine, size_t virtualMachines, int startProgramCounter)
+    : config(config), nextProgramCounter(UINT64_MAX), nextDeadline(chrono::steady_clock::time_point::max()) {
+    if (!config.enabled()) {
+        return;
+    }
+
+    virtualMachines = max<size_t>(1, virtualMachines);
+
+    if (config.intervalInstructions > 0) {
+        nextProgramCounter = startProgramCounter + config.intervalInstructions * (virtualMachine + 1) / virtualMachines;
+    }
+
+    if (config.intervalMilliseconds > 0) {
+        nextDeadline = chrono::steady_clock::now() + chrono::milliseconds(config.intervalMilliseconds * (virtualMachine + 1) / virtualMachines);
+    }
+}
+
+// Makes renames in the directory holding path durable.
+static bool syncDirectory(const string& path) {
+    size_t slash = path.find_last_of('/');
+    string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+
+    int directoryFile = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directoryFile < 0) {
+        return false;
+    }
+
+    bool synced = fsync(directoryFile) == 0;
+    close(directoryFile);
+    return synced;
+}
+
+bool CheckpointPolicy::due(int programCounter) const {
+    if (static_cast<uint64_t>(programCounter) >= nextProgramCounter) {
+        return true;
+    }
+
+    return config.intervalMilliseconds > 0 && chrono::steady_clock::now() >= nextDeadline;
+}
+
+bool CheckpointPolicy::checkpoint(VirtualMachine& virtualMachine) {
+    if (config.intervalInstructions > 0) {
+        nextProgramCounter = virtualMachine.programCounter + config.intervalInstructions;
+    }
+
+    if (config.intervalMilliseconds > 0) {
+        nextDeadline = chrono::steady_clock::now() + chrono::milliseconds(config.intervalMilliseconds);
+    }
+
+    // Write beside the slot and rename over it so a crash mid-write leaves
+    // the previous checkpoint in that slot intact. createCheckpoint syncs
+    // the file before the rename, and the directory is synced before
+    // .latest moves to it, so .latest never names a truncated file.
+    string slot = config.pathPrefix + "." + to_string(sequence++ % config.retention);
+    string temporary = slot + ".tmp";
+
+    if (!virtualMachine.createCheckpoint(temporary) || rename(temporary.c_str(), slot.c_str()) != 0 || !syncDirectory(slot)) {
+        cerr << "Unable to write checkpoint " << slot << endl;
+        return false;
+    }
+
+    string latest = config.pathPrefix + ".latest";
+    string latestTemporary = latest + ".tmp";
+    string target = slot.substr(slot.find_last_of('/') + 1);
+
+    unlink(latestTemporary.c_str());
+    if (symlink(target.c_str(), latestTemporary.c_str()) != 0 || rename(latestTemporary.c_str(), latest.c_str()) != 0 || !syncDirectory(latest)) {
+        cerr << "Unable to update " << latest << endl;
+        return false;
+    }
+
+    return true;
+}
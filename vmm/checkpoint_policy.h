@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+class VirtualMachine;
+
+// Monitor-driven checkpoints, configured per VM in its manifest:
+//
+//   vm_checkpoint_instructions=N   checkpoint every N retired instructions
+//   vm_checkpoint_ms=T             checkpoint every T milliseconds
+//   vm_checkpoint_path=PREFIX      files are PREFIX.0 .. PREFIX.<retention-1>
+//   vm_checkpoint_retention=K      ring size, 2 when unset
+//
+// PREFIX.latest is a symlink to the newest complete checkpoint, so a
+// restarted monitor can pass it straight to -s. A checkpoint holds the
+// registers and program counter only, so VMs with devices, whose state
+// lives in guest memory, cannot be checkpointed.
+struct CheckpointConfig {
+    uint64_t intervalInstructions = 0;
+    uint64_t intervalMilliseconds = 0;
+    std::string pathPrefix;
+    unsigned retention = 2;
+
+    bool enabled() const;
+};
+
+class CheckpointPolicy {
+	public:
+	    // The first checkpoint of VM i out of n is moved forward by i/n of an
+	    // interval so the VMs don't all write in the same scheduler round.
+	    CheckpointPolicy(const CheckpointConfig& config, size_t virtualMachine, size_t virtualMachines, int startProgramCounter);
+
+	    // Only reads the clock when a time interval is configured.
+	    bool due(int programCounter) const;
+	    bool checkpoint(VirtualMachine& virtualMachine);
+
+	private:
+	    CheckpointConfig config;
+	    uint64_t nextProgramCounter;
+	    std::chrono::steady_clock::time_point nextDeadline;
+	    uint64_t sequence = 0;
+};
@@ -0,0 +1,574 @@
+#include "vmm/decoded_program.h"
+#include "vmm/lanes.h"
+
+#include <iostream>
+#include <map>
+#include <charconv>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+const char* opcodeName(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::Nop: return "nop";
+        case Opcode::Li: return "li";
+        case Opcode::Add: return "add";
+        case Opcode::Addi: return "addi";
+        case Opcode::Sub: return "sub";
+        case Opcode::Mul: return "mul";
+        case Opcode::And: return "and";
+        case Opcode::Or: return "or";
+        case Opcode::Ori: return "ori";
+        case Opcode::Xor: return "xor";
+        case Opcode::Sll: return "sll";
+        case Opcode::Srl: return "srl";
+        case Opcode::In: return "in";
+        case Opcode::Out: return "out";
+        case Opcode::Doorbell: return "doorbell";
+        case Opcode::Snapshot: return "SNAPSHOT";
+        case Opcode::Migrate: return "MIGRATE";
+        case Opcode::DumpProcessorState: return "DUMP_PROCESSOR_STATE";
+    }
+    return "unknown";
+}
+
+static void skipOperandSeparators(string_view& text) {
+    while (!text.empty() && (isspace(static_cast<unsigned char>(text.front())) || text.front() == ',')) {
+        text.remove_prefix(1);
+    }
+}
+
+static bool decodeRegister(string_view& text, uint8_t& reg) {
+    skipOperandSeparators(text);
+    if (text.size() < 2 || text.front() != '$') {
+        return false;
+    }
+    text.remove_prefix(1);
+
+    int value = 0;
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != errc() || value < 0 || value > 31) {
+        return false;
+    }
+    text.remove_prefix(result.ptr - text.data());
+    reg = static_cast<uint8_t>(value);
+    return true;
+}
+
+static bool decodeImmediate(string_view& text, int32_t& immediate) {
+    skipOperandSeparators(text);
+    auto result = from_chars(text.data(), text.data() + text.size(), immediate);
+    if (result.ec != errc()) {
+        return false;
+    }
+    text.remove_prefix(result.ptr - text.data());
+    return true;
+}
+
+DecodedInstruction decodeAssemblyInstruction(string_view assemblyInstruction, int programCounter, DecodedProgram& program) {
+    DecodedInstruction decoded = {Opcode::Nop, 0, 0, 0, 0};
+    string_view operands = assemblyInstruction;
+    skipOperandSeparators(operands);
+
+    size_t mnemonicLength = 0;
+    while (mnemonicLength < operands.size() && (isalpha(static_cast<unsigned char>(operands[mnemonicLength])) || operands[mnemonicLength] == '_')) {
+        mnemonicLength++;
+    }
+    string_view mnemonic = operands.substr(0, mnemonicLength);
+    operands.remove_prefix(mnemonicLength);
+
+    bool valid = true;
+    if (mnemonic == "li") {
+        decoded.opcode = Opcode::Li;
+        valid = decodeRegister(operands, decoded.rd) && decodeImmediate(operands, decoded.immediate);
+    } else if (mnemonic == "add" || mnemonic == "sub" || mnemonic == "mul" || mnemonic == "and" || mnemonic == "xor") {
+        decoded.opcode = mnemonic == "add" ? Opcode::Add : mnemonic == "sub" ? Opcode::Sub : mnemonic == "mul" ? Opcode::Mul : mnemonic == "and" ? Opcode::And : Opcode::Xor;
+        valid = decodeRegister(operands, decoded.rd) && decodeRegister(operands, decoded.rs) && decodeRegister(operands, decoded.rt);
+    } else if (mnemonic == "addi") {
+        decoded.opcode = Opcode::Addi;
+        valid = decodeRegister(operands, decoded.rd) && decodeRegister(operands, decoded.rs) && decodeImmediate(operands, decoded.immediate);
+    } else if (mnemonic == "or") {
+        valid = decodeRegister(operands, decoded.rd) && decodeRegister(operands, decoded.rs);
+        skipOperandSeparators(operands);
+        if (valid && !operands.empty() && operands.front() == '$') {
+            decoded.opcode = Opcode::Or;
+            valid = decodeRegister(operands, decoded.rt);
+        } else {
+            decoded.opcode = Opcode::Ori;
+            valid = valid && decodeImmediate(operands, decoded.immediate);
+        }
+    } else if (mnemonic == "sll" || mnemonic == "srl") {
+        decoded.opcode = mnemonic == "sll" ? Opcode::Sll : Opcode::Srl;
+        valid = decodeRegister(operands, decoded.rd) && decodeRegister(operands, decoded.rt) && decodeImmediate(operands, decoded.immediate);
+        decoded.immediate &= 31;
+    } else if (mnemonic == "in" || mnemonic == "out") {
+        decoded.opcode = mnemonic == "in" ? Opcode::In : Opcode::Out;
+        valid = decodeRegister(operands, mnemonic == "in" ? decoded.rd : decoded.rs) && decodeImmediate(operands, decoded.immediate);
+        valid = valid && decoded.immediate >= 0 && decoded.immediate < kIoDevices;
+    } else if (mnemonic == "doorbell") {
+        decoded.opcode = Opcode::Doorbell;
+        valid = decodeImmediate(operands, decoded.immediate) && decoded.immediate >= 0 && decoded.immediate < kIoDevices;
+    } else if (mnemonic == "SNAPSHOT" || mnemonic == "MIGRATE") {
+        skipOperandSeparators(operands);
+        while (!operands.empty() && isspace(static_cast<unsigned char>(operands.back()))) {
+            operands.remove_suffix(1);
+        }
+        decoded.immediate = programCounter;
+        if (mnemonic == "SNAPSHOT") {
+            decoded.opcode = Opcode::Snapshot;
+            program.addSnapshotPath(programCounter, operands);
+        } else {
+            decoded.opcode = Opcode::Migrate;
+            program.addMigrationDestination(programCounter, operands);
+        }
+        valid = !operands.empty();
+    } else if (mnemonic == "DUMP_PROCESSOR_STATE") {
+        decoded.opcode = Opcode::DumpProcessorState;
+    }
+
+    if (!valid) {
+        cerr << "Unable to decode instruction " << assemblyInstruction << endl;
+        decoded = {Opcode::Nop, 0, 0, 0, 0};
+    }
+
+    return decoded;
+}
+
+// Memory-mapped assembly text that is decoded chunk by chunk into the
+// program's code array. Background threads decode a bounded window ahead of
+// the furthest instruction a VM has asked for, everything past it is left
+// undecoded until reached, and each chunk's text is released once decoded.
+class AssemblySource {
+	public:
+	    AssemblySource(DecodedProgram& program, const char* text, size_t textSize, int fd);
+	    ~AssemblySource();
+	    void ensureDecoded(size_t endProgramCounter);
+
+	private:
+	    enum ChunkState { Pending, Decoding, Decoded };
+
+	    void countLines();
+	    void decodeChunk(size_t chunk);
+	    void decodeAhead();
+	    void releaseText(const char* begin, const char* end);
+
+	    DecodedProgram& program;
+	    const char* text;
+	    size_t textSize;
+	    int fd;
+	    vector<const char*> chunkBegins;
+	    vector<size_t> chunkProgramCounters;
+	    unique_ptr<atomic<int>[]> chunkStates;
+	    atomic<size_t> decodedPrefix;
+
+	    mutex decodeMutex;
+	    condition_variable decodeProgress;
+	    size_t nextChunk;
+	    size_t requestedChunk;
+	    size_t decodedChunks;
+	    bool stopping;
+	    vector<thread> workers;
+};
+
+const size_t kAssemblyChunkBytes = 4 << 20;
+const size_t kReadaheadChunks = 4;
+
+AssemblySource::AssemblySource(DecodedProgram& program, const char* text, size_t textSize, int fd)
+    : program(program), text(text), textSize(textSize), fd(fd), decodedPrefix(0), nextChunk(0), requestedChunk(0), decodedChunks(0), stopping(false) {
+    const char* end = text + textSize;
+    const char* begin = text;
+
+    while (begin < end) {
+        chunkBegins.push_back(begin);
+        const char* boundary = begin + min(kAssemblyChunkBytes, static_cast<size_t>(end - begin));
+        const char* newline = boundary < end ? static_cast<const char*>(memchr(boundary, '\n', end - boundary)) : nullptr;
+        begin = newline ? newline + 1 : end;
+    }
+    chunkBegins.push_back(end);
+
+    size_t chunks = chunkBegins.size() - 1;
+    chunkStates.reset(new atomic<int>[chunks]);
+    for (size_t i = 0; i < chunks; ++i) {
+        chunkStates[i] = Pending;
+    }
+
+    countLines();
+    program.code.resize(chunkProgramCounters.back());
+
+    size_t threads = max(1u, thread::hardware_concurrency()) - 1;
+    for (size_t i = 0; i < min(threads, chunks); ++i) {
+        workers.emplace_back(&AssemblySource::decodeAhead, this);
+    }
+}
+
+AssemblySource::~AssemblySource() {
+    {
+        lock_guard<mutex> lock(decodeMutex);
+        stopping = true;
+    }
+    decodeProgress.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (text != nullptr) {
+        munmap(const_cast<char*>(text), textSize);
+        close(fd);
+    }
+}
+
+void AssemblySource::countLines() {
+    size_t chunks = chunkBegins.size() - 1;
+    vector<size_t> lines(chunks, 0);
+    size_t threads = min(static_cast<size_t>(max(1u, thread::hardware_concurrency())), chunks);
+    vector<thread> counters;
+
+    for (size_t t = 0; t < threads; ++t) {
+        counters.emplace_back([&, t]() {
+            for (size_t chunk = t; chunk < chunks; chunk += threads) {
+                const char* begin = chunkBegins[chunk];
+                const char* end = chunkBegins[chunk + 1];
+                lines[chunk] = end[-1] != '\n' ? 1 : 0;
+
+                for (const char* line = begin; (line = static_cast<const char*>(memchr(line, '\n', end - line))) != nullptr; ++line) {
+                    lines[chunk]++;
+                }
+                releaseText(begin, end);
+            }
+        });
+    }
+
+    for (auto& counter : counters) {
+        counter.join();
+    }
+
+    chunkProgramCounters.assign(1, 0);
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        chunkProgramCounters.push_back(chunkProgramCounters.back() + lines[chunk]);
+    }
+}
+
+void AssemblySource::ensureDecoded(size_t endProgramCounter) {
+    endProgramCounter = min(endProgramCounter, chunkProgramCounters.back());
+    if (endProgramCounter <= decodedPrefix.load(memory_order_acquire)) {
+        return;
+    }
+
+    size_t first = upper_bound(chunkProgramCounters.begin(), chunkProgramCounters.end(), decodedPrefix.load()) - chunkProgramCounters.begin() - 1;
+    size_t last = upper_bound(chunkProgramCounters.begin(), chunkProgramCounters.end(), endProgramCounter - 1) - chunkProgramCounters.begin() - 1;
+    {
+        lock_guard<mutex> lock(decodeMutex);
+        requestedChunk = max(requestedChunk, last);
+    }
+    decodeProgress.notify_all();
+
+    for (size_t chunk = first; chunk <= last; ++chunk) {
+        int expected = Pending;
+        if (chunkStates[chunk].compare_exchange_strong(expected, Decoding)) {
+            decodeChunk(chunk);
+        }
+    }
+
+    unique_lock<mutex> lock(decodeMutex);
+    decodeProgress.wait(lock, [&]() { return decodedPrefix.load() >= endProgramCounter; });
+}
+
+void AssemblySource::decodeAhead() {
+    for (;;) {
+        size_t chunk;
+        {
+            unique_lock<mutex> lock(decodeMutex);
+            decodeProgress.wait(lock, [&]() {
+                return stopping || nextChunk + 1 >= chunkBegins.size() || nextChunk <= requestedChunk + kReadaheadChunks;
+            });
+
+            if (stopping || nextChunk + 1 >= chunkBegins.size()) {
+                return;
+            }
+            chunk = nextChunk++;
+        }
+
+        int expected = Pending;
+        if (chunkStates[chunk].compare_exchange_strong(expected, Decoding)) {
+            decodeChunk(chunk);
+        }
+    }
+}
+
+void AssemblySource::decodeChunk(size_t chunk) {
+    const char* line = chunkBegins[chunk];
+    const char* end = chunkBegins[chunk + 1];
+    size_t programCounter = chunkProgramCounters[chunk];
+
+    while (line < end) {
+        const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+        const char* lineEnd = newline ? newline : end;
+        program.code[programCounter] = decodeAssemblyInstruction(string_view(line, lineEnd - line), static_cast<int>(programCounter), program);
+        programCounter++;
+        line = newline ? newline + 1 : end;
+    }
+
+    releaseText(chunkBegins[chunk], end);
+
+    lock_guard<mutex> lock(decodeMutex);
+    chunkStates[chunk] = Decoded;
+    decodedChunks++;
+
+    size_t prefixChunk = upper_bound(chunkProgramCounters.begin(), chunkProgramCounters.end(), decodedPrefix.load()) - chunkProgramCounters.begin() - 1;
+    while (prefixChunk + 1 < chunkBegins.size() && chunkStates[prefixChunk] == Decoded) {
+        prefixChunk++;
+    }
+    decodedPrefix.store(chunkProgramCounters[prefixChunk], memory_order_release);
+
+    if (decodedChunks + 1 == chunkBegins.size()) {
+        munmap(const_cast<char*>(text), textSize);
+        close(fd);
+        text = nullptr;
+    }
+    decodeProgress.notify_all();
+}
+
+void AssemblySource::releaseText(const char* begin, const char* end) {
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t last = reinterpret_cast<uintptr_t>(end) & ~(pageSize - 1);
+
+    if (first < last) {
+        madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+    }
+}
+
+DecodedProgram::DecodedProgram() = default;
+
+DecodedProgram::~DecodedProgram() = default;
+
+size_t DecodedProgram::instructionIndexAt(int programCounter) const {
+    if (programCounters.empty()) {
+        return min(static_cast<size_t>(max(programCounter, 0)), code.size());
+    }
+    return lower_bound(programCounters.begin(), programCounters.end(), programCounter) - programCounters.begin();
+}
+
+void DecodedProgram::ensureDecoded(size_t endInstruction) const {
+    if (source) {
+        source->ensureDecoded(endInstruction);
+    }
+}
+
+void DecodedProgram::addSnapshotPath(int programCounter, string_view snapshotPath) {
+    lock_guard<mutex> lock(operandsMutex);
+    snapshotPaths[programCounter] = string(snapshotPath);
+}
+
+// Returns a reference so SNAPSHOT doesn't copy the path on every execution;
+// references into an unordered_map survive later inserts.
+const string& DecodedProgram::snapshotPath(int programCounter) const {
+    static const string noPath;
+
+    lock_guard<mutex> lock(operandsMutex);
+    auto path = snapshotPaths.find(programCounter);
+    return path != snapshotPaths.end() ? path->second : noPath;
+}
+
+void DecodedProgram::addMigrationDestination(int programCounter, string_view destination) {
+    lock_guard<mutex> lock(operandsMutex);
+    migrationDestinations[programCounter] = string(destination);
+}
+
+const string& DecodedProgram::migrationDestination(int programCounter) const {
+    static const string noDestination;
+
+    lock_guard<mutex> lock(operandsMutex);
+    auto destination = migrationDestinations.find(programCounter);
+    return destination != migrationDestinations.end() ? destination->second : noDestination;
+}
+
+bool loadAssemblyInstructions(const string& filePath, DecodedProgram& program) {
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error while opening file " << filePath << endl;
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        cerr << "Error while opening file " << filePath << endl;
+        close(fd);
+        return false;
+    } else if (fileStat.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* text = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) {
+        cerr << "Error while mapping file " << filePath << endl;
+        close(fd);
+        return false;
+    }
+    madvise(text, fileStat.st_size, MADV_SEQUENTIAL);
+
+    program.source.reset(new AssemblySource(program, static_cast<const char*>(text), fileStat.st_size, fd));
+    return true;
+}
+
+// in writes rd but also consumes a completion, so it is never dropped.
+static bool writesRegister(Opcode opcode) {
+    return opcode != Opcode::Nop && opcode != Opcode::In && opcode != Opcode::Out && opcode != Opcode::Doorbell &&
+           opcode != Opcode::Snapshot && opcode != Opcode::Migrate && opcode != Opcode::DumpProcessorState;
+}
+
+static uint32_t registersRead(const DecodedInstruction& instruction) {
+    switch (instruction.opcode) {
+        case Opcode::Add:
+        case Opcode::Sub:
+        case Opcode::Mul:
+        case Opcode::And:
+        case Opcode::Or:
+        case Opcode::Xor:
+            return (1u << instruction.rs) | (1u << instruction.rt);
+        case Opcode::Addi:
+        case Opcode::Ori:
+            return 1u << instruction.rs;
+        case Opcode::Sll:
+        case Opcode::Srl:
+            return 1u << instruction.rt;
+        default:
+            return 0;
+    }
+}
+
+void optimizeDecodedProgram(DecodedProgram& program, int execSliceInInstructions) {
+    program.ensureDecoded(program.code.size());
+    program.source.reset();
+
+    const size_t length = program.code.size();
+    vector<bool> removed(length, false);
+
+    bool known[32] = {};
+    int32_t constants[32] = {};
+
+    for (size_t i = 0; i < length; ++i) {
+        DecodedInstruction& instruction = program.code[i];
+        const bool rsKnown = known[instruction.rs];
+        const bool rtKnown = known[instruction.rt];
+        const int32_t rs = constants[instruction.rs];
+        const int32_t rt = constants[instruction.rt];
+        bool folded = true;
+        int32_t result = 0;
+
+        switch (instruction.opcode) {
+            case Opcode::Li: result = instruction.immediate; break;
+            case Opcode::Add: folded = rsKnown && rtKnown; result = ScalarLanes::add(rs, rt); break;
+            case Opcode::Addi: folded = rsKnown; result = ScalarLanes::add(rs, instruction.immediate); break;
+            case Opcode::Sub: folded = rsKnown && rtKnown; result = ScalarLanes::sub(rs, rt); break;
+            case Opcode::Mul: folded = rsKnown && rtKnown; result = ScalarLanes::mul(rs, rt); break;
+            case Opcode::And: folded = rsKnown && rtKnown; result = ScalarLanes::bitAnd(rs, rt); break;
+            case Opcode::Or: folded = rsKnown && rtKnown; result = ScalarLanes::bitOr(rs, rt); break;
+            case Opcode::Ori: folded = rsKnown; result = ScalarLanes::bitOr(rs, instruction.immediate); break;
+            case Opcode::Xor: folded = rsKnown && rtKnown; result = ScalarLanes::bitXor(rs, rt); break;
+            case Opcode::Sll: folded = rtKnown; result = ScalarLanes::shiftLeft(rt, instruction.immediate); break;
+            case Opcode::Srl: folded = rtKnown; result = ScalarLanes::shiftRight(rt, instruction.immediate); break;
+            case Opcode::In: known[instruction.rd] = false; continue;
+            case Opcode::Nop: removed[i] = true; continue;
+            default: continue;
+        }
+
+        if (!folded) {
+            known[instruction.rd] = false;
+            continue;
+        }
+
+        if (known[instruction.rd] && constants[instruction.rd] == result) {
+            removed[i] = true;
+            continue;
+        }
+
+        instruction = {Opcode::Li, instruction.rd, 0, 0, result};
+        known[instruction.rd] = true;
+        constants[instruction.rd] = result;
+    }
+
+    const uint32_t allRegisters = 0xffffffffu;
+    uint32_t live = allRegisters;
+    int block = -1;
+
+    for (size_t i = length; i-- > 0;) {
+        int instructionBlock = execSliceInInstructions > 0 ? program.programCounterAt(i) / execSliceInInstructions : 0;
+        if (instructionBlock != block) {
+            live = allRegisters;
+            block = instructionBlock;
+        }
+
+        const DecodedInstruction& instruction = program.code[i];
+        if (removed[i]) {
+            continue;
+        } else if (!writesRegister(instruction.opcode)) {
+            live = allRegisters;
+        } else if (!(live & (1u << instruction.rd))) {
+            removed[i] = true;
+        } else {
+            live &= ~(1u << instruction.rd);
+            live |= registersRead(instruction);
+        }
+    }
+
+    DecodedCode code;
+    vector<int> programCounters;
+    for (size_t i = 0; i < length; ++i) {
+        if (!removed[i]) {
+            code.push_back(program.code[i]);
+            programCounters.push_back(program.programCounterAt(i));
+        }
+    }
+
+    program.sourceLength = program.programLength();
+    program.code = move(code);
+    program.programCounters = move(programCounters);
+}
+
+shared_ptr<const DecodedProgram> acquireDecodedProgram(const string& filePath, bool optimize, int execSliceInInstructions) {
+    static mutex programCacheMutex;
+    static map<string, weak_ptr<const DecodedProgram>> programCache;
+
+    struct stat fileStat;
+    if (stat(filePath.c_str(), &fileStat) != 0) {
+        cerr << "Error while opening file " << filePath << endl;
+        return nullptr;
+    }
+
+    string key = to_string(fileStat.st_dev) + ":" + to_string(fileStat.st_ino) + ":" + to_string(fileStat.st_size) + ":" +
+                 to_string(fileStat.st_mtim.tv_sec) + "." + to_string(fileStat.st_mtim.tv_nsec) + ":" +
+                 (optimize ? to_string(execSliceInInstructions) : string("-"));
+
+    lock_guard<mutex> lock(programCacheMutex);
+    if (auto cached = programCache[key].lock()) {
+        return cached;
+    }
+
+    auto program = make_shared<DecodedProgram>();
+    if (!loadAssemblyInstructions(filePath, *program)) {
+        programCache.erase(key);
+        return nullptr;
+    }
+
+    if (optimize) {
+        optimizeDecodedProgram(*program, execSliceInInstructions);
+    }
+
+    for (auto entry = programCache.begin(); entry != programCache.end();) {
+        entry = entry->second.expired() ? programCache.erase(entry) : next(entry);
+    }
+    programCache[key] = program;
+    return program;
+}
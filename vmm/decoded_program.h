@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum class Opcode : uint8_t {
+    Nop,
+    Li,
+    Add,
+    Addi,
+    Sub,
+    Mul,
+    And,
+    Or,
+    Ori,
+    Xor,
+    Sll,
+    Srl,
+    In,
+    Out,
+    Doorbell,
+    Snapshot,
+    Migrate,
+    DumpProcessorState
+};
+
+const size_t kOpcodeCount = static_cast<size_t>(Opcode::DumpProcessorState) + 1;
+
+const char* opcodeName(Opcode opcode);
+
+// in, out and doorbell name one of this many device slots.
+const int32_t kIoDevices = 8;
+
+struct DecodedInstruction {
+    Opcode opcode;
+    uint8_t rd;
+    uint8_t rs;
+    uint8_t rt;
+    int32_t immediate;
+};
+
+// Leaves resized elements uninitialized so pages of a large code array are
+// only touched once the chunk that fills them has been decoded.
+template <typename T>
+struct UninitializedAllocator : std::allocator<T> {
+    template <typename U> struct rebind { typedef UninitializedAllocator<U> other; };
+
+    UninitializedAllocator() = default;
+    template <typename U> UninitializedAllocator(const UninitializedAllocator<U>&) {}
+
+    template <typename U> void construct(U* element) { ::new (static_cast<void*>(element)) U; }
+    template <typename U, typename... Args> void construct(U* element, Args&&... args) { ::new (static_cast<void*>(element)) U(std::forward<Args>(args)...); }
+};
+
+typedef std::vector<DecodedInstruction, UninitializedAllocator<DecodedInstruction>> DecodedCode;
+
+class AssemblySource;
+
+struct DecodedProgram {
+    DecodedProgram();
+    ~DecodedProgram();
+
+    DecodedCode code;
+    // Source line of each entry in code once optimizeDecodedProgram has
+    // dropped instructions; empty while code holds one entry per line.
+    std::vector<int> programCounters;
+    size_t sourceLength = 0;
+    // Set while the assembly file is still being decoded in the background.
+    std::unique_ptr<AssemblySource> source;
+
+    size_t programLength() const { return programCounters.empty() ? code.size() : sourceLength; }
+    int programCounterAt(size_t index) const { return programCounters.empty() ? static_cast<int>(index) : programCounters[index]; }
+    size_t instructionIndexAt(int programCounter) const;
+    void ensureDecoded(size_t endInstruction) const;
+    void addSnapshotPath(int programCounter, std::string_view snapshotPath);
+    const std::string& snapshotPath(int programCounter) const;
+    void addMigrationDestination(int programCounter, std::string_view destination);
+    const std::string& migrationDestination(int programCounter) const;
+
+	private:
+	    mutable std::mutex operandsMutex;
+	    std::unordered_map<int, std::string> snapshotPaths;
+	    std::unordered_map<int, std::string> migrationDestinations;
+};
+
+DecodedInstruction decodeAssemblyInstruction(std::string_view assemblyInstruction, int programCounter, DecodedProgram& program);
+bool loadAssemblyInstructions(const std::string& filePath, DecodedProgram& program);
+
+// Folds known constants through li/add/addi/sub/mul/and/or/xor/sll/srl and
+// drops writes that are overwritten before anything reads them. Slice
+// boundaries, I/O, SNAPSHOT, MIGRATE and DUMP_PROCESSOR_STATE observe every
+// register, so the register file there matches the unoptimized program
+// exactly, and programCounters keeps the source line of every surviving
+// instruction.
+void optimizeDecodedProgram(DecodedProgram& program, int execSliceInInstructions);
+
+// Process-wide cache of decoded programs keyed by the binary's identity and
+// modification time, so VMs running the same binary share one immutable
+// decoded copy. Entries are weak and a program is freed with its last VM.
+std::shared_ptr<const DecodedProgram> acquireDecodedProgram(const std::string& filePath, bool optimize, int execSliceInInstructions);
@@ -0,0 +1,110 @@
+#include "vmm/execution_context.h"
+#include "vmm/io_engine.h"
+
+#include <utility>
+
+using namespace std;
+
+ExecutionContext::ExecutionContext(coroutine_handle<promise_type> handle) : handle(handle) {
+}
+
+ExecutionContext::ExecutionContext(ExecutionContext&& other) noexcept : handle(exchange(other.handle, nullptr)) {
+}
+
+ExecutionContext& ExecutionContext::operator=(ExecutionContext&& other) noexcept {
+    if (this != &other) {
+        if (handle) {
+            handle.destroy();
+        }
+        handle = exchange(other.handle, nullptr);
+    }
+    return *this;
+}
+
+ExecutionContext::~ExecutionContext() {
+    if (handle) {
+        handle.destroy();
+    }
+}
+
+void ExecutionContext::resume() {
+    handle.resume();
+}
+
+bool ExecutionContext::done() const {
+    return !handle || handle.done();
+}
+
+bool ExecutionContext::runnable() const {
+    const promise_type& promise = handle.promise();
+    return promise.suspension != Suspension::WaitingOnIo || !promise.waitingFor->waitingOnIo();
+}
+
+void ContextScheduler::spawn(ExecutionContext context) {
+    if (context.done()) {
+        return;
+    }
+
+    contexts.push_back(move(context));
+    ready.push_back(contexts.size() - 1);
+    live++;
+}
+
+// Waiting contexts rejoin in the order they started waiting.
+void ContextScheduler::wakeCompleted() {
+    size_t kept = 0;
+
+    for (size_t index : waiting) {
+        if (contexts[index].runnable()) {
+            ready.push_back(index);
+        } else {
+            waiting[kept++] = index;
+        }
+    }
+    waiting.resize(kept);
+}
+
+bool ContextScheduler::runRound() {
+    while (live > 0) {
+        uint64_t generation = ioCompletionGeneration();
+        pollIoCompletions();
+        wakeCompleted();
+
+        if (!ready.empty()) {
+            break;
+        }
+        waitForIoCompletion(generation);
+    }
+
+    if (live == 0) {
+        return false;
+    }
+
+    rounds++;
+
+    for (size_t picks = ready.size(); picks > 0; --picks) {
+        size_t index = ready.front();
+        ready.pop_front();
+
+        ExecutionContext& context = contexts[index];
+        context.resume();
+
+        if (context.done()) {
+            live--;
+        } else if (context.runnable()) {
+            ready.push_back(index);
+        } else {
+            waiting.push_back(index);
+        }
+    }
+
+    return live > 0;
+}
+
+size_t ContextScheduler::liveContexts() const {
+    return live;
+}
+
+uint64_t ContextScheduler::round() const {
+    return rounds;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <vector>
+
+#include "vmm/virtual_machine.h"
+
+// A VM's execution context: a coroutine that runs the VM's slices and
+// suspends whenever it gives up the host thread, at the end of a slice or
+// while the VM is parked on I/O. It starts suspended; a scheduler resumes it
+// and reads back why it suspended.
+class ExecutionContext {
+	public:
+	    enum class Suspension { SliceExpired, WaitingOnIo };
+
+	    struct promise_type {
+	        Suspension suspension = Suspension::SliceExpired;
+	        const VirtualMachine* waitingFor = nullptr;
+
+	        ExecutionContext get_return_object() { return ExecutionContext(std::coroutine_handle<promise_type>::from_promise(*this)); }
+	        std::suspend_always initial_suspend() noexcept { return {}; }
+	        std::suspend_always final_suspend() noexcept { return {}; }
+	        void return_void() {}
+	        void unhandled_exception() { std::terminate(); }
+	    };
+
+	    ExecutionContext() = default;
+	    ExecutionContext(ExecutionContext&& other) noexcept;
+	    ExecutionContext& operator=(ExecutionContext&& other) noexcept;
+	    ~ExecutionContext();
+
+	    void resume();
+	    bool done() const;
+	    // False while the context waits on I/O that has not completed.
+	    bool runnable() const;
+
+	private:
+	    explicit ExecutionContext(std::coroutine_handle<promise_type> handle);
+
+	    std::coroutine_handle<promise_type> handle;
+};
+
+// co_await SliceExpired{} hands the host thread back at the end of a slice.
+struct SliceExpired {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<ExecutionContext::promise_type> context) const noexcept {
+        context.promise().suspension = ExecutionContext::Suspension::SliceExpired;
+    }
+    void await_resume() const noexcept {}
+};
+
+// co_await IoCompletion{vm} suspends only while vm is parked on a busy
+// device or an asynchronous snapshot write.
+struct IoCompletion {
+    const VirtualMachine& virtualMachine;
+
+    bool await_ready() const noexcept { return !virtualMachine.waitingOnIo(); }
+    void await_suspend(std::coroutine_handle<ExecutionContext::promise_type> context) const noexcept {
+        context.promise().suspension = ExecutionContext::Suspension::WaitingOnIo;
+        context.promise().waitingFor = &virtualMachine;
+    }
+    void await_resume() const noexcept {}
+};
+
+// Resumes contexts from a FIFO ready queue in rounds: a round resumes once
+// each context that was ready when it began. Contexts waiting on I/O are
+// kept off the queue and rejoin its back once their I/O completes.
+class ContextScheduler {
+	public:
+	    void spawn(ExecutionContext context);
+
+	    // Runs one round, first sleeping until some I/O completes if every
+	    // live context is waiting. Returns false once all have finished.
+	    bool runRound();
+
+	    size_t liveContexts() const;
+	    // Starts at 1 with the first round.
+	    uint64_t round() const;
+
+	private:
+	    void wakeCompleted();
+
+	    std::vector<ExecutionContext> contexts;
+	    std::deque<size_t> ready;
+	    std::vector<size_t> waiting;
+	    size_t live = 0;
+	    uint64_t rounds = 0;
+};
@@ -0,0 +1,90 @@
+#include "vmm/guest_memory.h"
+#include "vmm/huge_page_resource.h"
+#include "vmm/scheduler_arena.h"
+
+#include <cstring>
+
+using namespace std;
+
+const uint32_t kPageShift = 10;
+const uint32_t kHugePageShift = 19;
+const size_t kPageAlignment = 64;
+
+GuestMemory::GuestMemory() : arena(schedulerArena()), pageResource(arena), pageShift(kPageShift), addressMask(UINT32_MAX) {
+}
+
+void GuestMemory::enableHugePages() {
+    if (!pages) {
+        pageResource = hugePageResource();
+        pageShift = kHugePageShift;
+    }
+}
+
+bool GuestMemory::hugePages() const {
+    return pageShift == kHugePageShift;
+}
+
+uint32_t GuestMemory::pageWords() const {
+    return 1u << pageShift;
+}
+
+void GuestMemory::setSize(uint64_t bytes) {
+    uint64_t words = bytes / sizeof(int32_t);
+    addressMask = words == 0 || words > (uint64_t(1) << 32) ? UINT32_MAX : static_cast<uint32_t>(words - 1);
+}
+
+int32_t GuestMemory::load(uint32_t address) const {
+    address &= addressMask;
+
+    if (!pages) {
+        return 0;
+    }
+
+    auto page = pages->find(address >> pageShift);
+    return page == pages->end() ? 0 : page->second.get()[address & (pageWords() - 1)];
+}
+
+void GuestMemory::store(uint32_t address, int32_t value) {
+    address &= addressMask;
+
+    // The polymorphic allocator hands itself on to the page tables it
+    // constructs, so their nodes come from the arena as well.
+    pmr::polymorphic_allocator<char> allocator(arena);
+
+    if (!pages) {
+        pages = allocate_shared<PageTable>(allocator);
+    } else if (pages.use_count() > 1) {
+        pages = allocate_shared<PageTable>(allocator, *pages);
+    }
+
+    shared_ptr<int32_t>& page = (*pages)[address >> pageShift];
+    if (!page) {
+        page = allocatePage(nullptr);
+    } else if (page.use_count() > 1) {
+        page = allocatePage(page.get());
+    }
+
+    page.get()[address & (pageWords() - 1)] = value;
+}
+
+size_t GuestMemory::residentPages() const {
+    return pages ? pages->size() : 0;
+}
+
+// Page words live apart from the reference count so a huge page is exactly
+// one 2 MiB block; the count itself comes from the arena.
+shared_ptr<int32_t> GuestMemory::allocatePage(const int32_t* contents) const {
+    pmr::memory_resource* resource = pageResource;
+    size_t bytes = pageWords() * sizeof(int32_t);
+    int32_t* words = static_cast<int32_t*>(resource->allocate(bytes, kPageAlignment));
+
+    if (contents) {
+        memcpy(words, contents, bytes);
+    } else {
+        memset(words, 0, bytes);
+    }
+
+    return shared_ptr<int32_t>(words, [resource, bytes](int32_t* page) {
+        resource->deallocate(page, bytes, kPageAlignment);
+    }, pmr::polymorphic_allocator<char>(arena));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <memory_resource>
+
+// Word-addressed guest memory in 4 KiB pages, or 2 MiB pages once huge pages
+// are enabled. Copies share the page table and every page until one side
+// writes, so cloning a VM costs a reference count and memory grows only with
+// the pages a clone dirties; the page size is also the copy-on-write
+// granularity. Small pages come from the scheduler arena of the node that
+// created the memory. Reference counts decide ownership, so copies sharing
+// pages must not be stored to from two threads at once.
+class GuestMemory {
+	public:
+	    GuestMemory();
+
+	    int32_t load(uint32_t address) const;
+	    void store(uint32_t address, int32_t value);
+	    size_t residentPages() const;
+
+	    // Limits the memory to bytes, a power of two; addresses wrap
+	    // around its end. Unlimited memory spans all 2^32 words.
+	    void setSize(uint64_t bytes);
+
+	    // Switches to 2 MiB pages from hugePageResource(); only takes effect
+	    // before the first store.
+	    void enableHugePages();
+	    bool hugePages() const;
+	    uint32_t pageWords() const;
+
+	    static const uint32_t kPageWords = 1024;
+	    static const uint32_t kHugePageWords = 512 * 1024;
+
+	private:
+	    typedef std::pmr::map<uint32_t, std::shared_ptr<int32_t>> PageTable;
+
+	    std::shared_ptr<int32_t> allocatePage(const int32_t* contents) const;
+
+	    std::pmr::memory_resource* arena;
+	    std::pmr::memory_resource* pageResource;
+	    uint32_t pageShift;
+	    uint32_t addressMask;
+	    std::shared_ptr<PageTable> pages;
+};
@@ -0,0 +1,87 @@
+#include "vmm/huge_page_resource.h"
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+using namespace std;
+
+const size_t kHugePageBytes = 2 << 20;
+
+namespace {
+
+class HugePageResource : public pmr::memory_resource {
+	public:
+	    HugePageBacking backing() const { return lastBacking.load(memory_order_relaxed); }
+
+	private:
+	    static size_t roundUp(size_t bytes) { return (bytes + kHugePageBytes - 1) & ~(kHugePageBytes - 1); }
+
+	    void* do_allocate(size_t bytes, size_t) override {
+	        bytes = roundUp(bytes);
+
+	        if (explicitPages.load(memory_order_relaxed)) {
+	            void* pointer = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	            if (pointer != MAP_FAILED) {
+	                lastBacking.store(HugePageBacking::Explicit, memory_order_relaxed);
+	                return pointer;
+	            }
+	            explicitPages.store(false, memory_order_relaxed);
+	        }
+
+	        // Over-map by one huge page and trim so the block starts on a
+	        // 2 MiB boundary, which transparent huge pages need.
+	        void* mapping = mmap(nullptr, bytes + kHugePageBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	        if (mapping == MAP_FAILED) {
+	            throw bad_alloc();
+	        }
+
+	        uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+	        uintptr_t aligned = (start + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+	        if (aligned > start) {
+	            munmap(mapping, aligned - start);
+	        }
+	        munmap(reinterpret_cast<void*>(aligned + bytes), start + kHugePageBytes - aligned);
+
+	        void* pointer = reinterpret_cast<void*>(aligned);
+	        bool transparent = madvise(pointer, bytes, MADV_HUGEPAGE) == 0;
+	        lastBacking.store(transparent ? HugePageBacking::Transparent : HugePageBacking::None, memory_order_relaxed);
+	        return pointer;
+	    }
+
+	    void do_deallocate(void* pointer, size_t bytes, size_t) override {
+	        munmap(pointer, roundUp(bytes));
+	    }
+
+	    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+	        return this == &other;
+	    }
+
+	    atomic<bool> explicitPages{true};
+	    atomic<HugePageBacking> lastBacking{HugePageBacking::None};
+};
+
+HugePageResource& resource() {
+    static HugePageResource hugePages;
+    return hugePages;
+}
+
+}
+
+pmr::memory_resource* hugePageResource() {
+    return &resource();
+}
+
+HugePageBacking hugePageBacking() {
+    return resource().backing();
+}
+
+const char* hugePageBackingName(HugePageBacking backing) {
+    switch (backing) {
+        case HugePageBacking::Explicit: return "explicit";
+        case HugePageBacking::Transparent: return "transparent";
+        case HugePageBacking::None: return "none";
+    }
+    return "none";
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <memory_resource>
+
+enum class HugePageBacking { Explicit, Transparent, None };
+
+// Blocks rounded up to 2 MiB for guest memory. Explicit huge pages
+// (MAP_HUGETLB) are tried first; once the kernel refuses them, blocks are
+// 2 MiB-aligned mappings advised with MADV_HUGEPAGE, and plain pages if
+// even that is refused. Memory may be released from any thread.
+std::pmr::memory_resource* hugePageResource();
+
+// What backed the most recent block, for diagnostics and benchmarks.
+HugePageBacking hugePageBacking();
+const char* hugePageBackingName(HugePageBacking backing);
@@ -0,0 +1,188 @@
+#include "vmm/instruction_trace.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+
+using namespace std;
+
+static const char kTraceMagic[] = "VMMTRACE";
+static const uint8_t kTraceVersion = 1;
+static const uint32_t kMaxTraceName = 4096;
+
+// Rings and names outlive the threads and VMs that created them.
+struct InstructionTraceRegistry {
+    mutex registryMutex;
+    vector<string> names;
+    vector<unique_ptr<InstructionTraceRing>> rings;
+};
+
+static InstructionTraceRegistry& traceRegistry() {
+    static InstructionTraceRegistry registry;
+    return registry;
+}
+
+InstructionTraceRing::InstructionTraceRing() : records(new InstructionTraceRecord[kInstructionTraceRecords]), head(0) {
+}
+
+uint64_t InstructionTraceRing::recorded() const {
+    return head;
+}
+
+vector<InstructionTraceRecord> InstructionTraceRing::snapshot() const {
+    uint64_t kept = min<uint64_t>(head, kInstructionTraceRecords);
+    vector<InstructionTraceRecord> ordered;
+    ordered.reserve(kept);
+
+    for (uint64_t i = head - kept; i < head; ++i) {
+        ordered.push_back(records[i & (kInstructionTraceRecords - 1)]);
+    }
+    return ordered;
+}
+
+uint32_t registerTracedVirtualMachine(const string& virtualMachineName) {
+    InstructionTraceRegistry& registry = traceRegistry();
+    lock_guard<mutex> lock(registry.registryMutex);
+
+    registry.names.push_back(virtualMachineName);
+    return static_cast<uint32_t>(registry.names.size() - 1);
+}
+
+InstructionTraceRing& threadInstructionTrace() {
+    thread_local InstructionTraceRing* ring = nullptr;
+
+    if (!ring) {
+        InstructionTraceRegistry& registry = traceRegistry();
+        lock_guard<mutex> lock(registry.registryMutex);
+
+        registry.rings.emplace_back(new InstructionTraceRing());
+        ring = registry.rings.back().get();
+    }
+    return *ring;
+}
+
+static void putInteger(string& out, uint64_t value, size_t bytes) {
+    out.append(reinterpret_cast<const char*>(&value), bytes);
+}
+
+bool writeInstructionTrace(const string& tracePath) {
+    InstructionTraceRegistry& registry = traceRegistry();
+    lock_guard<mutex> lock(registry.registryMutex);
+
+    string out;
+    out.append(kTraceMagic, sizeof(kTraceMagic) - 1);
+    out.push_back(static_cast<char>(kTraceVersion));
+
+    putInteger(out, registry.names.size(), sizeof(uint32_t));
+    for (const auto& name : registry.names) {
+        putInteger(out, name.size(), sizeof(uint32_t));
+        out += name;
+    }
+
+    putInteger(out, registry.rings.size(), sizeof(uint32_t));
+    for (const auto& ring : registry.rings) {
+        vector<InstructionTraceRecord> records = ring->snapshot();
+        putInteger(out, records.size(), sizeof(uint64_t));
+        putInteger(out, ring->recorded() - records.size(), sizeof(uint64_t));
+        out.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(InstructionTraceRecord));
+    }
+
+    ofstream file(tracePath, ios::binary | ios::trunc);
+    if (!file) {
+        cerr << "Unable to create instruction trace " << tracePath << endl;
+        return false;
+    }
+
+    file.write(out.data(), out.size());
+    file.close();
+
+    if (!file) {
+        cerr << "Unable to write instruction trace " << tracePath << endl;
+        return false;
+    }
+    return true;
+}
+
+// Bounds-checked reads over a whole trace held in memory; any overrun
+// clears ok.
+struct TraceReader {
+    const string& data;
+    size_t position = 0;
+    bool ok = true;
+
+    bool read(void* value, size_t bytes) {
+        if (!ok || data.size() - position < bytes) {
+            ok = false;
+            return false;
+        }
+        memcpy(value, data.data() + position, bytes);
+        position += bytes;
+        return true;
+    }
+
+    uint64_t integer(size_t bytes) {
+        uint64_t value = 0;
+        read(&value, bytes);
+        return value;
+    }
+};
+
+bool readInstructionTrace(const string& tracePath, InstructionTrace& trace) {
+    ifstream file(tracePath, ios::binary);
+    if (!file) {
+        cerr << "Unable to open instruction trace " << tracePath << endl;
+        return false;
+    }
+
+    string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    TraceReader reader{data};
+
+    size_t magicBytes = sizeof(kTraceMagic) - 1;
+    if (data.compare(0, magicBytes, kTraceMagic) != 0) {
+        cerr << tracePath << " is not an instruction trace" << endl;
+        return false;
+    }
+    reader.position = magicBytes;
+
+    uint8_t version = static_cast<uint8_t>(reader.integer(1));
+    if (version != kTraceVersion) {
+        cerr << tracePath << " is not an instruction trace of version " << static_cast<int>(kTraceVersion) << endl;
+        return false;
+    }
+
+    uint64_t names = reader.integer(sizeof(uint32_t));
+    trace.virtualMachineNames.clear();
+    for (uint64_t i = 0; i < names && reader.ok; ++i) {
+        uint64_t nameBytes = reader.integer(sizeof(uint32_t));
+        if (nameBytes > kMaxTraceName || nameBytes > data.size() - reader.position) {
+            reader.ok = false;
+            break;
+        }
+        trace.virtualMachineNames.push_back(data.substr(reader.position, nameBytes));
+        reader.position += nameBytes;
+    }
+
+    uint64_t threads = reader.integer(sizeof(uint32_t));
+    trace.threads.clear();
+    for (uint64_t i = 0; i < threads && reader.ok; ++i) {
+        InstructionTrace::Thread thread;
+        uint64_t records = reader.integer(sizeof(uint64_t));
+        thread.overwritten = reader.integer(sizeof(uint64_t));
+
+        if (records > (data.size() - reader.position) / sizeof(InstructionTraceRecord)) {
+            reader.ok = false;
+            break;
+        }
+        thread.records.resize(records);
+        reader.read(thread.records.data(), records * sizeof(InstructionTraceRecord));
+        trace.threads.push_back(move(thread));
+    }
+
+    if (!reader.ok) {
+        cerr << tracePath << " is truncated" << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vmm/decoded_program.h"
+
+// Per-instruction trace of the VMs tracing is enabled on. Each host thread
+// appends to its own ring, so recording takes no lock and a ring that wraps
+// keeps its newest records. writeInstructionTrace collects every thread's
+// ring into one file, which vmm-trace decodes.
+//
+//   header   "VMMTRACE" version:u8 vms:u32 { nameBytes:u32 name } threads:u32
+//   thread   records:u64 overwritten:u64 { record } oldest first
+//
+// Records are InstructionTraceRecord as laid out in memory and integers are
+// in host byte order, like snapshots.
+
+const size_t kInstructionTraceRecords = 1 << 20;
+const uint8_t kTraceNoRegister = 0xff;
+
+struct InstructionTraceRecord {
+    // Index into the trace's VM names.
+    uint32_t virtualMachine;
+    // Source line; with -O only the instructions the optimizer kept appear.
+    int32_t programCounter;
+    uint8_t opcode;
+    // The register the instruction wrote and its new value, or
+    // kTraceNoRegister.
+    uint8_t reg;
+    uint16_t reserved;
+    int32_t value;
+};
+
+static_assert(sizeof(InstructionTraceRecord) == 16, "trace records are written as they are in memory");
+
+class InstructionTraceRing {
+	public:
+	    InstructionTraceRing();
+
+	    void record(uint32_t virtualMachine, int32_t programCounter, const DecodedInstruction& instruction, const int32_t* registers);
+	    uint64_t recorded() const;
+	    // The retained records, oldest first.
+	    std::vector<InstructionTraceRecord> snapshot() const;
+
+	private:
+	    std::unique_ptr<InstructionTraceRecord[]> records;
+	    uint64_t head;
+};
+
+// Inline, as it runs after every traced instruction. li through in are the
+// opcodes that write rd.
+inline void InstructionTraceRing::record(uint32_t virtualMachine, int32_t programCounter, const DecodedInstruction& instruction, const int32_t* registers) {
+    InstructionTraceRecord& entry = records[head++ & (kInstructionTraceRecords - 1)];
+    bool writes = instruction.opcode >= Opcode::Li && instruction.opcode <= Opcode::In;
+
+    entry.virtualMachine = virtualMachine;
+    entry.programCounter = programCounter;
+    entry.opcode = static_cast<uint8_t>(instruction.opcode);
+    entry.reg = writes ? instruction.rd : kTraceNoRegister;
+    entry.reserved = 0;
+    entry.value = writes ? registers[instruction.rd] : 0;
+}
+
+// Returns the ID the named VM's records carry.
+uint32_t registerTracedVirtualMachine(const std::string& virtualMachineName);
+
+// The calling thread's ring, created on first use and kept after the thread
+// exits so it can still be written out.
+InstructionTraceRing& threadInstructionTrace();
+
+// Writes every thread's ring; call once the traced VMs have stopped.
+bool writeInstructionTrace(const std::string& tracePath);
+
+struct InstructionTrace {
+    struct Thread {
+        uint64_t overwritten = 0;
+        std::vector<InstructionTraceRecord> records;
+    };
+
+    std::vector<std::string> virtualMachineNames;
+    std::vector<Thread> threads;
+};
+
+bool readInstructionTrace(const std::string& tracePath, InstructionTrace& trace);
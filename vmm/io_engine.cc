@@ -0,0 +1,312 @@
+#include "vmm/io_engine.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+const unsigned kUringEntries = 1024;
+
+static atomic<IoEngineKind> selectedEngine(IoEngineKind::Uring);
+static atomic<uint64_t> completionGeneration(0);
+static mutex completionMutex;
+static condition_variable completionReady;
+
+static void completeRequest(IoRequest& request, int64_t result) {
+    request.result = result;
+    request.outstanding->fetch_sub(1, memory_order_release);
+}
+
+// Raw io_uring through the syscalls, with the kernel's shared submission
+// and completion rings mapped into the process. Submissions come from any
+// scheduler thread under a lock; the reaper thread alone consumes
+// completions.
+class UringEngine {
+	public:
+	    static UringEngine* instance();
+	    void submit(IoRequest* requests, size_t count);
+	    bool consumeCompletions(bool wait);
+
+	private:
+	    UringEngine();
+	    ~UringEngine();
+	    bool setup();
+	    void enter(unsigned toSubmit, unsigned minComplete, unsigned flags);
+	    io_uring_sqe* nextEntry();
+	    void reap();
+
+	    int ringFd = -1;
+	    void* submissionRing = MAP_FAILED;
+	    void* completionRing = MAP_FAILED;
+	    size_t submissionRingBytes = 0;
+	    size_t completionRingBytes = 0;
+	    io_uring_sqe* entries = static_cast<io_uring_sqe*>(MAP_FAILED);
+	    size_t entriesBytes = 0;
+
+	    unsigned* submissionHead = nullptr;
+	    unsigned* submissionTail = nullptr;
+	    unsigned submissionMask = 0;
+	    unsigned submissionEntries = 0;
+	    unsigned* submissionArray = nullptr;
+	    unsigned* completionHead = nullptr;
+	    unsigned* completionTail = nullptr;
+	    unsigned completionMask = 0;
+	    io_uring_cqe* completions = nullptr;
+
+	    mutex submitMutex;
+	    mutex completionQueueMutex;
+	    unsigned unsubmitted = 0;
+	    atomic<bool> stopping{false};
+	    thread reaper;
+};
+
+UringEngine* UringEngine::instance() {
+    static UringEngine engine;
+    return engine.ringFd >= 0 ? &engine : nullptr;
+}
+
+UringEngine::UringEngine() {
+    if (!setup()) {
+        if (ringFd >= 0) {
+            close(ringFd);
+            ringFd = -1;
+        }
+        return;
+    }
+
+    reaper = thread([this]() { reap(); });
+}
+
+UringEngine::~UringEngine() {
+    if (ringFd < 0) {
+        return;
+    }
+
+    // A no-op with no request attached wakes the reaper to see stopping.
+    {
+        lock_guard<mutex> lock(submitMutex);
+        stopping = true;
+        io_uring_sqe* entry = nextEntry();
+        memset(entry, 0, sizeof(*entry));
+        entry->opcode = IORING_OP_NOP;
+        unsubmitted++;
+        enter(unsubmitted, 0, 0);
+        unsubmitted = 0;
+    }
+    reaper.join();
+
+    munmap(entries, entriesBytes);
+    if (completionRing != submissionRing) {
+        munmap(completionRing, completionRingBytes);
+    }
+    munmap(submissionRing, submissionRingBytes);
+    close(ringFd);
+}
+
+bool UringEngine::setup() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, kUringEntries, &params));
+    if (ringFd < 0) {
+        return false;
+    }
+
+    submissionRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    completionRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) {
+        submissionRingBytes = completionRingBytes = max(submissionRingBytes, completionRingBytes);
+    }
+
+    submissionRing = mmap(nullptr, submissionRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (submissionRing == MAP_FAILED) {
+        return false;
+    }
+
+    completionRing = singleMap ? submissionRing : mmap(nullptr, completionRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (completionRing == MAP_FAILED) {
+        munmap(submissionRing, submissionRingBytes);
+        return false;
+    }
+
+    entriesBytes = params.sq_entries * sizeof(io_uring_sqe);
+    entries = static_cast<io_uring_sqe*>(mmap(nullptr, entriesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+    if (entries == MAP_FAILED) {
+        if (completionRing != submissionRing) {
+            munmap(completionRing, completionRingBytes);
+        }
+        munmap(submissionRing, submissionRingBytes);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(submissionRing);
+    submissionHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    submissionTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    submissionMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    submissionEntries = params.sq_entries;
+    submissionArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    char* cq = static_cast<char*>(completionRing);
+    completionHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    completionTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    completionMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    completions = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+void UringEngine::enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    while (syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0) < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+    }
+}
+
+// Called with submitMutex held; flushes the ring to the kernel when full.
+io_uring_sqe* UringEngine::nextEntry() {
+    unsigned tail = *submissionTail;
+
+    if (tail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE) == submissionEntries) {
+        enter(unsubmitted, 0, 0);
+        unsubmitted = 0;
+    }
+
+    unsigned index = tail & submissionMask;
+    submissionArray[index] = index;
+    __atomic_store_n(submissionTail, tail + 1, __ATOMIC_RELEASE);
+    return &entries[index];
+}
+
+void UringEngine::submit(IoRequest* requests, size_t count) {
+    lock_guard<mutex> lock(submitMutex);
+
+    for (size_t i = 0; i < count; ++i) {
+        IoRequest& request = requests[i];
+        if (request.operation == IoRequest::Invalid) {
+            continue;
+        }
+
+        io_uring_sqe* entry = nextEntry();
+        memset(entry, 0, sizeof(*entry));
+        entry->opcode = request.operation == IoRequest::Read ? IORING_OP_READ : IORING_OP_WRITE;
+        entry->fd = request.fd;
+        entry->addr = reinterpret_cast<uint64_t>(request.buffer);
+        entry->len = request.length;
+        entry->off = request.offset;
+        entry->user_data = reinterpret_cast<uint64_t>(&request);
+        unsubmitted++;
+    }
+
+    enter(unsubmitted, 0, 0);
+    unsubmitted = 0;
+}
+
+// Cached reads often complete inside the submitting io_uring_enter, so
+// schedulers poll before sleeping and only wait for the reaper when the
+// kernel really is still working.
+bool UringEngine::consumeCompletions(bool wait) {
+    unique_lock<mutex> lock(completionQueueMutex, defer_lock);
+    if (wait) {
+        lock.lock();
+    } else if (!lock.try_lock()) {
+        return false;
+    }
+
+    unsigned head = *completionHead;
+    unsigned tail = __atomic_load_n(completionTail, __ATOMIC_ACQUIRE);
+    bool completed = false;
+
+    for (; head != tail; ++head) {
+        const io_uring_cqe& completion = completions[head & completionMask];
+        if (completion.user_data != 0) {
+            completeRequest(*reinterpret_cast<IoRequest*>(completion.user_data), completion.res);
+            completed = true;
+        }
+    }
+    __atomic_store_n(completionHead, head, __ATOMIC_RELEASE);
+    lock.unlock();
+
+    if (completed) {
+        {
+            lock_guard<mutex> generationLock(completionMutex);
+            completionGeneration++;
+        }
+        completionReady.notify_all();
+    }
+
+    return completed;
+}
+
+void UringEngine::reap() {
+    while (!stopping) {
+        enter(0, 1, IORING_ENTER_GETEVENTS);
+        consumeCompletions(true);
+    }
+}
+
+void selectIoEngine(IoEngineKind kind) {
+    selectedEngine = kind;
+}
+
+IoEngineKind ioEngine() {
+    if (selectedEngine == IoEngineKind::Uring && !UringEngine::instance()) {
+        return IoEngineKind::Blocking;
+    }
+    return selectedEngine;
+}
+
+const char* ioEngineName(IoEngineKind kind) {
+    return kind == IoEngineKind::Uring ? "io_uring" : "blocking";
+}
+
+void submitIoRequests(IoRequest* requests, size_t count) {
+    if (ioEngine() == IoEngineKind::Uring) {
+        UringEngine::instance()->submit(requests, count);
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        IoRequest& request = requests[i];
+        ssize_t bytes = 0;
+        if (request.operation == IoRequest::Read) {
+            bytes = request.offset < 0 ? read(request.fd, request.buffer, request.length) : pread(request.fd, request.buffer, request.length, request.offset);
+        } else if (request.operation == IoRequest::Write) {
+            bytes = request.offset < 0 ? write(request.fd, request.buffer, request.length) : pwrite(request.fd, request.buffer, request.length, request.offset);
+        } else {
+            continue;
+        }
+        completeRequest(request, bytes < 0 ? -errno : bytes);
+    }
+}
+
+void pollIoCompletions() {
+    if (ioEngine() == IoEngineKind::Uring) {
+        UringEngine::instance()->consumeCompletions(false);
+    }
+}
+
+uint64_t ioCompletionGeneration() {
+    return completionGeneration.load();
+}
+
+void completeExternalIo(atomic<size_t>& outstanding) {
+    outstanding.fetch_sub(1, memory_order_release);
+    {
+        lock_guard<mutex> lock(completionMutex);
+        completionGeneration++;
+    }
+    completionReady.notify_all();
+}
+
+void waitForIoCompletion(uint64_t generation) {
+    pollIoCompletions();
+
+    unique_lock<mutex> lock(completionMutex);
+    completionReady.wait(lock, [&]() { return completionGeneration.load() != generation; });
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// Host I/O for the paravirtual devices. With io_uring a batch goes to the
+// kernel in one submission and a reaper thread completes it, so the VM
+// that issued it can park while its scheduler thread runs other VMs. The
+// blocking engine runs every request inline with pread/pwrite; it is the
+// fallback when the kernel refuses io_uring.
+enum class IoEngineKind { Uring, Blocking };
+
+struct IoRequest {
+    enum Operation : uint8_t { Read, Write, Invalid };
+
+    Operation operation = Invalid;
+    int fd = -1;
+    void* buffer = nullptr;
+    uint32_t length = 0;
+    // -1 for the file's current position, as for a pipe.
+    off_t offset = 0;
+    // Bytes transferred or -errno; Invalid requests are never submitted and
+    // keep their result.
+    int64_t result = -1;
+    // Decremented once the request has completed.
+    std::atomic<size_t>* outstanding = nullptr;
+};
+
+// An outstanding-request count for objects that get copied, like a VM; a
+// copy starts with nothing in flight.
+struct IoCounter : std::atomic<size_t> {
+    IoCounter() : std::atomic<size_t>(0) {}
+    IoCounter(const IoCounter&) : std::atomic<size_t>(0) {}
+    IoCounter& operator=(const IoCounter&) { store(0); return *this; }
+};
+
+// Picks the engine for requests submitted afterwards; Uring falls back to
+// Blocking when io_uring is unavailable.
+void selectIoEngine(IoEngineKind kind);
+IoEngineKind ioEngine();
+const char* ioEngineName(IoEngineKind kind);
+
+// Starts the requests in one go. Invalid requests are skipped.
+void submitIoRequests(IoRequest* requests, size_t count);
+
+// Completes whatever the kernel has finished without waiting for the reaper
+// thread; schedulers call it once a round.
+void pollIoCompletions();
+
+// Bumped after every completion, so a scheduler can read it, find all of
+// its VMs waiting, and sleep until it moves.
+uint64_t ioCompletionGeneration();
+void waitForIoCompletion(uint64_t generation);
+
+// Completes work a VM parks on that does not go through the engine, like a
+// migration transfer: drops outstanding by one and bumps the generation.
+void completeExternalIo(std::atomic<size_t>& outstanding);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Lane-wise register operations; add/sub/mul/sll wrap like two's complement
+// hardware and srl keeps the arithmetic shift of executeAssemblyInstruction.
+struct ScalarLanes {
+    typedef int32_t Vector;
+    static const size_t width = 1;
+
+    static Vector load(const int32_t* lanes) { return *lanes; }
+    static void store(int32_t* lanes, Vector value) { *lanes = value; }
+    static Vector broadcast(int32_t value) { return value; }
+    static Vector add(Vector a, Vector b) { return static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b)); }
+    static Vector sub(Vector a, Vector b) { return static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b)); }
+    static Vector mul(Vector a, Vector b) { return static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b)); }
+    static Vector bitAnd(Vector a, Vector b) { return a & b; }
+    static Vector bitOr(Vector a, Vector b) { return a | b; }
+    static Vector bitXor(Vector a, Vector b) { return a ^ b; }
+    static Vector shiftLeft(Vector a, int amount) { return static_cast<int32_t>(static_cast<uint32_t>(a) << amount); }
+    static Vector shiftRight(Vector a, int amount) { return a >> amount; }
+};
+
+#if defined(__AVX2__)
+struct Avx2Lanes {
+    typedef __m256i Vector;
+    static const size_t width = 8;
+
+    static Vector load(const int32_t* lanes) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes)); }
+    static void store(int32_t* lanes, Vector value) { _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), value); }
+    static Vector broadcast(int32_t value) { return _mm256_set1_epi32(value); }
+    static Vector add(Vector a, Vector b) { return _mm256_add_epi32(a, b); }
+    static Vector sub(Vector a, Vector b) { return _mm256_sub_epi32(a, b); }
+    static Vector mul(Vector a, Vector b) { return _mm256_mullo_epi32(a, b); }
+    static Vector bitAnd(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+    static Vector bitOr(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+    static Vector bitXor(Vector a, Vector b) { return _mm256_xor_si256(a, b); }
+    static Vector shiftLeft(Vector a, int amount) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(amount)); }
+    static Vector shiftRight(Vector a, int amount) { return _mm256_sra_epi32(a, _mm_cvtsi32_si128(amount)); }
+};
+typedef Avx2Lanes NarrowLanes;
+#else
+typedef ScalarLanes NarrowLanes;
+#endif
+
+#if defined(__AVX512F__)
+struct Avx512Lanes {
+    typedef __m512i Vector;
+    static const size_t width = 16;
+
+    static Vector load(const int32_t* lanes) { return _mm512_load_si512(lanes); }
+    static void store(int32_t* lanes, Vector value) { _mm512_store_si512(lanes, value); }
+    static Vector broadcast(int32_t value) { return _mm512_set1_epi32(value); }
+    static Vector add(Vector a, Vector b) { return _mm512_add_epi32(a, b); }
+    static Vector sub(Vector a, Vector b) { return _mm512_sub_epi32(a, b); }
+    static Vector mul(Vector a, Vector b) { return _mm512_mullo_epi32(a, b); }
+    static Vector bitAnd(Vector a, Vector b) { return _mm512_and_si512(a, b); }
+    static Vector bitOr(Vector a, Vector b) { return _mm512_or_si512(a, b); }
+    static Vector bitXor(Vector a, Vector b) { return _mm512_xor_si512(a, b); }
+    static Vector shiftLeft(Vector a, int amount) { return _mm512_sll_epi32(a, _mm_cvtsi32_si128(amount)); }
+    static Vector shiftRight(Vector a, int amount) { return _mm512_sra_epi32(a, _mm_cvtsi32_si128(amount)); }
+};
+typedef Avx512Lanes WideLanes;
+#else
+typedef NarrowLanes WideLanes;
+#endif
+
+template <size_t Lanes>
+using BatchLanes = std::conditional_t<Lanes % WideLanes::width == 0, WideLanes,
+                   std::conditional_t<Lanes % NarrowLanes::width == 0, NarrowLanes, ScalarLanes>>;
+
+const size_t kBatchLanes = WideLanes::width >= 16 ? 16 : 8;
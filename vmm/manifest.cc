@@ -0,0 +1,243 @@
+#include "vmm/manifest.h"
+
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string_view>
+#include <unordered_set>
+
+#include "vmm/virtual_io.h"
+
+using namespace std;
+
+// Word addresses are 32 bits, so guest memory tops out at 16 GiB.
+static const uint64_t kMaxMemoryKb = uint64_t(16) << 20;
+
+static string_view trim(string_view text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == string_view::npos) {
+        return string_view();
+    }
+
+    return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool parseNumber(string_view text, uint64_t& value, uint64_t minimum, uint64_t maximum) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size() && value >= minimum && value <= maximum;
+}
+
+bool parseNumber(string_view text, int64_t& value, int64_t minimum, int64_t maximum) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size() && value >= minimum && value <= maximum;
+}
+
+class ManifestParser {
+	public:
+	    ManifestParser(const string& path);
+
+	    void error(size_t line, const string& message);
+	    void apply(size_t line, string_view key, string_view value, VirtualMachineManifest& target);
+	    void validate(size_t line, const VirtualMachineManifest& manifest);
+	    bool failed() const;
+
+	private:
+	    bool readNumber(size_t line, string_view key, string_view value, uint64_t minimum, uint64_t maximum, uint64_t& result);
+
+	    const string& path;
+	    bool errors = false;
+};
+
+ManifestParser::ManifestParser(const string& path) : path(path) {
+}
+
+void ManifestParser::error(size_t line, const string& message) {
+    cerr << path << ":" << line << ": " << message << endl;
+    errors = true;
+}
+
+bool ManifestParser::failed() const {
+    return errors;
+}
+
+bool ManifestParser::readNumber(size_t line, string_view key, string_view value, uint64_t minimum, uint64_t maximum, uint64_t& result) {
+    if (!parseNumber(value, result, minimum, maximum)) {
+        error(line, string(key) + " must be a number from " + to_string(minimum) + " to " + to_string(maximum));
+        return false;
+    }
+    return true;
+}
+
+// Keys before the first section land on the defaults.
+void ManifestParser::apply(size_t line, string_view key, string_view value, VirtualMachineManifest& target) {
+    uint64_t number = 0;
+
+    if (key == "vm_binary") {
+        target.binary = value;
+    } else if (key == "vm_exec_slice_in_instructions") {
+        if (readNumber(line, key, value, 1, numeric_limits<int>::max(), number)) {
+            target.execSliceInInstructions = static_cast<int>(number);
+        }
+    } else if (key == "vm_weight") {
+        if (readNumber(line, key, value, 1, 1024, number)) {
+            target.weight = static_cast<unsigned>(number);
+        }
+    } else if (key == "vm_memory_kb") {
+        if (readNumber(line, key, value, 1, kMaxMemoryKb, number)) {
+            if (number & (number - 1)) {
+                error(line, "vm_memory_kb must be a power of two");
+            } else {
+                target.memoryBytes = number * 1024;
+            }
+        }
+    } else if (key == "vm_snapshot") {
+        target.snapshot = value;
+    } else if (key == "vm_clones") {
+        if (readNumber(line, key, value, 0, 1 << 20, number)) {
+            target.clones = number;
+        }
+    } else if (key == "vm_hugepages") {
+        if (value == "on" || value == "off") {
+            target.hugePages = value == "on";
+        } else {
+            error(line, "vm_hugepages must be on or off");
+        }
+    } else if (key == "vm_async_snapshots") {
+        if (value == "on" || value == "off") {
+            target.asyncSnapshots = value == "on";
+        } else {
+            error(line, "vm_async_snapshots must be on or off");
+        }
+    } else if (key == "vm_console") {
+        target.console = value;
+    } else if (key == "vm_block") {
+        target.block = value;
+    } else if (key == "vm_checkpoint_instructions") {
+        if (readNumber(line, key, value, 0, numeric_limits<uint32_t>::max(), number)) {
+            target.checkpoint.intervalInstructions = number;
+        }
+    } else if (key == "vm_checkpoint_ms") {
+        if (readNumber(line, key, value, 0, numeric_limits<uint32_t>::max(), number)) {
+            target.checkpoint.intervalMilliseconds = number;
+        }
+    } else if (key == "vm_checkpoint_path") {
+        target.checkpoint.pathPrefix = value;
+    } else if (key == "vm_checkpoint_retention") {
+        if (readNumber(line, key, value, 1, 1024, number)) {
+            target.checkpoint.retention = static_cast<unsigned>(number);
+        }
+    } else if (key == "vm_migration_port") {
+        if (readNumber(line, key, value, 1, numeric_limits<uint16_t>::max(), number)) {
+            target.migrationPort = static_cast<uint16_t>(number);
+        }
+    } else if (key == "vm_migration_rate_mbit") {
+        if (readNumber(line, key, value, 0, 1000000, number)) {
+            target.migrationBytesPerSecond = number * 1000000 / 8;
+        }
+    } else if (key == "vm_migration_key") {
+        if (parseSecureKey(string(value), target.migrationKey)) {
+            target.migrationEncrypted = true;
+        } else {
+            error(line, "vm_migration_key must be 64 hex digits");
+        }
+    } else {
+        error(line, "unknown key " + string(key));
+    }
+}
+
+void ManifestParser::validate(size_t line, const VirtualMachineManifest& manifest) {
+    if (manifest.binary.empty()) {
+        error(line, manifest.name + " has no vm_binary");
+    }
+    if (manifest.execSliceInInstructions == 0) {
+        error(line, manifest.name + " has no vm_exec_slice_in_instructions");
+    }
+    if (manifest.memoryBytes > 0 && (!manifest.console.empty() || !manifest.block.empty())) {
+        uint64_t ringBytes = ioRingMemoryBytes(manifest.block.empty() ? kConsoleDevice : kBlockDevice);
+        if (manifest.memoryBytes < ringBytes) {
+            error(line, manifest.name + " needs vm_memory_kb of at least " + to_string(ringBytes / 1024) + " for its device rings");
+        }
+    }
+    if (manifest.checkpoint.enabled() && (!manifest.console.empty() || !manifest.block.empty())) {
+        error(line, manifest.name + " has devices, whose rings and guest memory a checkpoint would not hold");
+    }
+    if (!manifest.checkpoint.pathPrefix.empty() && !manifest.checkpoint.enabled()) {
+        error(line, manifest.name + " has vm_checkpoint_path but no checkpoint interval");
+    }
+}
+
+bool loadManifest(const string& path, const string& defaultName, vector<VirtualMachineManifest>& virtualMachines) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "Unable to open manifest " << path << endl;
+        return false;
+    }
+
+    stringstream contents;
+    contents << file.rdbuf();
+    const string text = contents.str();
+
+    ManifestParser parser(path);
+    VirtualMachineManifest defaults;
+    vector<VirtualMachineManifest> parsed;
+    vector<size_t> sectionLines;
+    unordered_set<string> names;
+
+    size_t lineNumber = 0;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        if (end == string::npos) {
+            end = text.size();
+        }
+
+        string_view line = trim(string_view(text).substr(start, end - start));
+        start = end + 1;
+        lineNumber++;
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (line[0] == '[') {
+            string_view name = line.back() == ']' ? trim(line.substr(1, line.size() - 2)) : string_view();
+
+            if (name.empty()) {
+                parser.error(lineNumber, "malformed section " + string(line));
+            } else if (!names.insert(string(name)).second) {
+                parser.error(lineNumber, "duplicate virtual machine " + string(name));
+            } else {
+                parsed.push_back(defaults);
+                parsed.back().name = name;
+                sectionLines.push_back(lineNumber);
+            }
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == string_view::npos) {
+            parser.error(lineNumber, "expected key=value");
+            continue;
+        }
+
+        parser.apply(lineNumber, trim(line.substr(0, equals)), trim(line.substr(equals + 1)), parsed.empty() ? defaults : parsed.back());
+    }
+
+    if (parsed.empty() && !parser.failed()) {
+        parsed.push_back(defaults);
+        parsed.back().name = defaultName;
+        sectionLines.push_back(lineNumber);
+    }
+
+    for (size_t i = 0; i < parsed.size(); ++i) {
+        parser.validate(sectionLines[i], parsed[i]);
+    }
+
+    if (parser.failed()) {
+        return false;
+    }
+
+    virtualMachines.insert(virtualMachines.end(), parsed.begin(), parsed.end());
+    return true;
+}
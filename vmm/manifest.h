@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vmm/checkpoint_policy.h"
+#include "vmm/secure_channel.h"
+
+// A manifest is a file of key=value lines describing one or more VMs. A
+// "[name]" line starts the section of a VM with that name; keys above the
+// first section are defaults every VM starts from. A file without sections
+// describes a single VM, so a plain per-VM config file is a manifest too.
+//
+//   vm_binary=PATH                    program to run, required
+//   vm_exec_slice_in_instructions=N   slice length, required
+//   vm_weight=N                       slices per scheduler round, 1 when unset
+//   vm_memory_kb=N                    guest memory size, a power of two;
+//                                     addresses wrap, unlimited when unset
+//   vm_snapshot=PATH                  snapshot or checkpoint to start from
+//   vm_clones=N                       copies started from the VM's state
+//   vm_hugepages=on|off               back guest memory with 2 MiB pages
+//   vm_async_snapshots=on|off         SNAPSHOT parks the VM until written
+//   vm_console=stdout|PATH            console device, see virtual_io.h
+//   vm_block=PATH                     block device backed by the file
+//   vm_checkpoint_*                   see checkpoint_policy.h
+//   vm_migration_port=N               migration server port, 8080 when unset
+//   vm_migration_rate_mbit=N          per-migration bandwidth limit,
+//                                     unlimited when unset or 0
+//   vm_migration_key=HEX              64 hex digits; migrations are then
+//                                     encrypted, see secure_channel.h
+//
+// Blank lines and lines starting with '#' are skipped.
+struct VirtualMachineManifest {
+    std::string name;
+    std::string binary;
+    int execSliceInInstructions = 0;
+    unsigned weight = 1;
+    uint64_t memoryBytes = 0;
+    std::string snapshot;
+    size_t clones = 0;
+    bool hugePages = false;
+    bool asyncSnapshots = false;
+    std::string console;
+    std::string block;
+    CheckpointConfig checkpoint;
+    uint16_t migrationPort = 8080;
+    uint64_t migrationBytesPerSecond = 0;
+    bool migrationEncrypted = false;
+    SecureKey migrationKey = {};
+};
+
+// Reads the file in one pass and appends its VMs, named defaultName when
+// the file has no sections. Every problem is reported on cerr as
+// path:line: message; returns false if there was any, leaving
+// virtualMachines untouched.
+bool loadManifest(const std::string& path, const std::string& defaultName, std::vector<VirtualMachineManifest>& virtualMachines);
+
+// Reads all of text as a decimal number from minimum to maximum, the way
+// manifest values are read; command-line options use it too.
+bool parseNumber(std::string_view text, uint64_t& value, uint64_t minimum, uint64_t maximum);
+bool parseNumber(std::string_view text, int64_t& value, int64_t minimum, int64_t maximum);
@@ -0,0 +1,114 @@
+#include "vmm/metrics.h"
+#include "vmm/asio_compat.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using asio::local::stream_protocol;
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+shared_ptr<VirtualMachineMetrics> MetricsRegistry::registerVirtualMachine(const string& virtualMachineName) {
+    auto metrics = make_shared<VirtualMachineMetrics>(virtualMachineName);
+
+    lock_guard<mutex> lock(virtualMachinesMutex);
+    virtualMachines.push_back(metrics);
+    return metrics;
+}
+
+static void renderFamily(ostringstream& out, const char* name, const char* type, const char* help,
+                         const vector<shared_ptr<VirtualMachineMetrics>>& virtualMachines, const MetricCounter VirtualMachineMetrics::*counter, double scale = 1) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+
+    for (const auto& metrics : virtualMachines) {
+        uint64_t value = ((*metrics).*counter).read();
+        out << name << "{vm=\"" << metrics->name << "\"} ";
+        if (scale == 1) {
+            out << value << "\n";
+        } else {
+            out << value * scale << "\n";
+        }
+    }
+}
+
+string MetricsRegistry::render() const {
+    vector<shared_ptr<VirtualMachineMetrics>> snapshot;
+    {
+        lock_guard<mutex> lock(virtualMachinesMutex);
+        snapshot = virtualMachines;
+    }
+
+    ostringstream out;
+    renderFamily(out, "vmm_instructions_retired_total", "counter", "Guest instructions retired.", snapshot, &VirtualMachineMetrics::instructionsRetired);
+    renderFamily(out, "vmm_slices_total", "counter", "Execution slices run.", snapshot, &VirtualMachineMetrics::slicesRun);
+    renderFamily(out, "vmm_snapshots_total", "counter", "Snapshots written.", snapshot, &VirtualMachineMetrics::snapshots);
+    renderFamily(out, "vmm_snapshot_bytes_total", "counter", "Bytes written to snapshot files.", snapshot, &VirtualMachineMetrics::snapshotBytes);
+    renderFamily(out, "vmm_snapshot_seconds_total", "counter", "Time spent writing snapshots.", snapshot, &VirtualMachineMetrics::snapshotNanoseconds, 1e-9);
+    renderFamily(out, "vmm_migration_bytes_sent", "gauge", "Bytes of the current migration sent so far.", snapshot, &VirtualMachineMetrics::migrationBytesSent);
+    renderFamily(out, "vmm_migration_bytes_total", "gauge", "Total bytes of the current migration.", snapshot, &VirtualMachineMetrics::migrationBytesTotal);
+    renderFamily(out, "vmm_migration_target_bytes_per_second", "gauge", "Bandwidth limit of the current migration, 0 if unlimited.", snapshot, &VirtualMachineMetrics::migrationTargetBytesPerSecond);
+    renderFamily(out, "vmm_migration_achieved_bytes_per_second", "gauge", "Bandwidth the current migration has achieved.", snapshot, &VirtualMachineMetrics::migrationAchievedBytesPerSecond);
+
+    out << "# HELP vmm_scheduler_queue_depth Runnable VMs in the current scheduler round.\n";
+    out << "# TYPE vmm_scheduler_queue_depth gauge\n";
+    out << "vmm_scheduler_queue_depth " << schedulerQueueDepth.read() << "\n";
+    out << "# HELP vmm_scheduler_rounds_total Scheduler rounds completed.\n";
+    out << "# TYPE vmm_scheduler_rounds_total counter\n";
+    out << "vmm_scheduler_rounds_total " << schedulerRounds.read() << "\n";
+
+    return out.str();
+}
+
+struct MetricsServer::State {
+    explicit State(const string& socketPath) : acceptor(context, stream_protocol::endpoint(socketPath)) {}
+
+    void accept() {
+        acceptor.async_accept([this](const AsioErrorCode& error, stream_protocol::socket socket) {
+            if (error) {
+                return;
+            }
+
+            auto connection = make_shared<stream_protocol::socket>(move(socket));
+            auto request = make_shared<asio::streambuf>();
+            asio::async_read_until(*connection, *request, "\r\n\r\n", [connection, request](const AsioErrorCode&, size_t) {
+                string body = MetricsRegistry::instance().render();
+                auto response = make_shared<string>("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                                    to_string(body.size()) + "\r\n\r\n" + body);
+                asio::async_write(*connection, asio::buffer(*response), [connection, response](const AsioErrorCode&, size_t) {});
+            });
+
+            accept();
+        });
+    }
+
+    asio::io_context context;
+    stream_protocol::acceptor acceptor;
+};
+
+MetricsServer::MetricsServer(const string& socketPath) : socketPath(socketPath) {
+    remove(socketPath.c_str());
+
+    try {
+        state.reset(new State(socketPath));
+        state->accept();
+        serverThread = thread([this]() { state->context.run(); });
+    } catch (exception& e) {
+        cerr << "Exception in MetricsServer: " << e.what() << endl;
+        state.reset();
+    }
+}
+
+MetricsServer::~MetricsServer() {
+    if (state) {
+        state->context.stop();
+        serverThread.join();
+        state.reset();
+        remove(socketPath.c_str());
+    }
+}
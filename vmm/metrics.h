@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A counter with a single writer, the thread running the VM that owns it.
+// Updates are a relaxed load and store with no locked instruction; scrapes
+// from the metrics thread read it with a relaxed load.
+class MetricCounter {
+	public:
+	    void add(uint64_t amount) { value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed); }
+	    void set(uint64_t amount) { value.store(amount, std::memory_order_relaxed); }
+	    uint64_t read() const { return value.load(std::memory_order_relaxed); }
+
+	private:
+	    std::atomic<uint64_t> value{0};
+};
+
+struct VirtualMachineMetrics {
+    explicit VirtualMachineMetrics(const std::string& virtualMachineName) : name(virtualMachineName) {}
+
+    const std::string name;
+    MetricCounter instructionsRetired;
+    MetricCounter slicesRun;
+    MetricCounter snapshots;
+    MetricCounter snapshotBytes;
+    MetricCounter snapshotNanoseconds;
+    MetricCounter migrationBytesSent;
+    MetricCounter migrationBytesTotal;
+    MetricCounter migrationTargetBytesPerSecond;
+    MetricCounter migrationAchievedBytesPerSecond;
+};
+
+// Process-wide set of VM counters plus scheduler gauges, rendered in the
+// Prometheus text exposition format when scraped.
+class MetricsRegistry {
+	public:
+	    static MetricsRegistry& instance();
+
+	    std::shared_ptr<VirtualMachineMetrics> registerVirtualMachine(const std::string& virtualMachineName);
+	    std::string render() const;
+
+	    MetricCounter schedulerQueueDepth;
+	    MetricCounter schedulerRounds;
+
+	private:
+	    mutable std::mutex virtualMachinesMutex;
+	    std::vector<std::shared_ptr<VirtualMachineMetrics>> virtualMachines;
+};
+
+// Serves MetricsRegistry::render() over HTTP/1.0 on a Unix domain socket,
+// e.g. curl --unix-socket <path> http://localhost/metrics.
+class MetricsServer {
+	public:
+	    explicit MetricsServer(const std::string& socketPath);
+	    ~MetricsServer();
+
+	private:
+	    struct State;
+
+	    std::string socketPath;
+	    std::unique_ptr<State> state;
+	    std::thread serverThread;
+};
@@ -0,0 +1,775 @@
+#include "vmm/migration_session.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+using namespace std;
+using asio::ip::tcp;
+
+static const int kCommitRounds = 3;
+// Keeps the held-page bitmap a destination allocates small.
+static const uint32_t kMinMigrationPageBytes = 512;
+
+static void putBigEndian(vector<uint8_t>& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * (bytes - 1 - i))));
+    }
+}
+
+static uint64_t getBigEndian(const uint8_t* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value = value << 8 | in[i];
+    }
+    return value;
+}
+
+// Runs context until done is set. Past timeout, or once interrupted says
+// so, the socket is closed, which completes the pending operation as
+// aborted, and false is returned; timedOut tells the two apart.
+static bool runOperation(asio::io_context& context, tcp::socket& socket, const bool& done, chrono::milliseconds timeout, const function<bool()>& interrupted, bool& timedOut) {
+    auto deadline = chrono::steady_clock::now() + timeout;
+
+    while (!done) {
+        if (context.stopped()) {
+            context.restart();
+        }
+        if (chrono::steady_clock::now() >= deadline || (interrupted && interrupted())) {
+            break;
+        }
+        context.run_one_until(deadline);
+    }
+    if (done) {
+        return true;
+    }
+
+    timedOut = chrono::steady_clock::now() >= deadline;
+    AsioErrorCode ignored;
+    socket.close(ignored);
+    while (!done) {
+        if (context.stopped()) {
+            context.restart();
+        }
+        context.run_one();
+    }
+    return false;
+}
+
+// Framing for one connection. Each connection gets its own SecureChannel,
+// keyed afresh by the handshake, so frame counters restart with it. Every
+// read and write has a deadline, so a peer lost without a FIN or RST, or
+// one that stops reading, cannot hold the connection open.
+class MigrationConnection {
+	public:
+	    MigrationConnection(asio::io_context& context, tcp::socket socket, const SecureKey* key, bool initiator, chrono::milliseconds timeout);
+	    // Exchanges hellos on an encrypted connection; must come first.
+	    bool handshake();
+	    bool send(const vector<uint8_t>& message);
+	    // Sends header followed by bytes of file from offset as one
+	    // plaintext message, the file part by sendfile.
+	    bool sendFile(const vector<uint8_t>& header, int file, uint64_t offset, size_t bytes);
+	    bool encrypted() const;
+	    bool receive(vector<uint8_t>& message);
+
+	    // Polled while waiting on the peer; returning true drops the
+	    // connection.
+	    function<bool()> interrupted;
+	    // Set once a frame was malformed or failed authentication.
+	    bool rejected;
+	    // Set once the peer missed a deadline.
+	    bool timedOut;
+
+	private:
+	    template <typename Start>
+	    bool complete(Start start);
+
+	    asio::io_context& context;
+	    tcp::socket socket;
+	    chrono::milliseconds timeout;
+	    unique_ptr<SecureChannel> channel;
+	    vector<uint8_t> frame;
+};
+
+MigrationConnection::MigrationConnection(asio::io_context& context, tcp::socket socket, const SecureKey* key, bool initiator, chrono::milliseconds timeout)
+    : rejected(false), timedOut(false), context(context), socket(move(socket)), timeout(timeout) {
+    if (key) {
+        channel.reset(new SecureChannel(*key, initiator));
+    }
+}
+
+// Starts one asynchronous operation, passing it the handler, and waits
+// for it within the deadline.
+template <typename Start>
+bool MigrationConnection::complete(Start start) {
+    bool done = false;
+    AsioErrorCode result;
+
+    start([&](const AsioErrorCode& error, auto&&...) {
+        result = error;
+        done = true;
+    });
+    return runOperation(context, socket, done, timeout, interrupted, timedOut) && !result;
+}
+
+bool MigrationConnection::handshake() {
+    if (!channel) {
+        return true;
+    }
+
+    uint8_t peerHello[kSecureHelloBytes];
+    bool exchanged = complete([&](auto handler) { asio::async_write(socket, asio::buffer(channel->hello(), kSecureHelloBytes), handler); }) &&
+                     complete([&](auto handler) { asio::async_read(socket, asio::buffer(peerHello), handler); });
+    if (!exchanged) {
+        return false;
+    }
+
+    rejected = !channel->accept(peerHello);
+    return !rejected;
+}
+
+bool MigrationConnection::send(const vector<uint8_t>& message) {
+    frame.clear();
+    if (channel) {
+        if (!channel->seal(message.data(), message.size(), frame)) {
+            return false;
+        }
+    } else {
+        putBigEndian(frame, message.size(), 4);
+        frame.insert(frame.end(), message.begin(), message.end());
+    }
+
+    return complete([&](auto handler) { asio::async_write(socket, asio::buffer(frame), handler); });
+}
+
+bool MigrationConnection::sendFile(const vector<uint8_t>& header, int file, uint64_t offset, size_t bytes) {
+    frame.clear();
+    putBigEndian(frame, header.size() + bytes, 4);
+    frame.insert(frame.end(), header.begin(), header.end());
+
+    if (!complete([&](auto handler) { asio::async_write(socket, asio::buffer(frame), handler); })) {
+        return false;
+    }
+
+    // Asio has made the socket non-blocking, so a full send buffer is
+    // waited out like any other write.
+    off_t position = static_cast<off_t>(offset);
+    while (bytes > 0) {
+        ssize_t sent = sendfile(socket.native_handle(), file, &position, bytes);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!complete([&](auto handler) { socket.async_wait(tcp::socket::wait_write, handler); })) {
+                return false;
+            }
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        bytes -= sent;
+    }
+    return true;
+}
+
+bool MigrationConnection::encrypted() const {
+    return channel != nullptr;
+}
+
+bool MigrationConnection::receive(vector<uint8_t>& message) {
+    size_t header = channel ? kSecureFrameHeaderBytes : 4;
+
+    frame.resize(header);
+    if (!complete([&](auto handler) { asio::async_read(socket, asio::buffer(frame), handler); })) {
+        return false;
+    }
+
+    size_t bytes = channel ? SecureChannel::frameBytes(frame.data()) : header + getBigEndian(frame.data(), 4);
+    if (bytes == 0 || bytes - header > kSecureMaxFrameBytes + kSecureTagBytes) {
+        rejected = true;
+        return false;
+    }
+
+    frame.resize(bytes);
+    if (!complete([&](auto handler) { asio::async_read(socket, asio::buffer(frame.data() + header, bytes - header), handler); })) {
+        return false;
+    }
+
+    message.clear();
+    if (channel) {
+        rejected = !channel->open(frame.data(), frame.size(), message);
+        return !rejected;
+    }
+    message.assign(frame.begin() + header, frame.end());
+    return true;
+}
+
+// Keeps an accept outstanding while a connection is served, so a source
+// that reconnects is seen even while its old connection hangs.
+class MigrationListener {
+	public:
+	    MigrationListener(asio::io_context& context, tcp::acceptor& acceptor);
+	    ~MigrationListener();
+
+	    // Takes a connection that has arrived, if there is one.
+	    bool take(unique_ptr<tcp::socket>& socket);
+	    // Waits for a connection; false once the acceptor fails.
+	    bool wait(unique_ptr<tcp::socket>& socket, AsioErrorCode& error);
+
+	private:
+	    void accept();
+
+	    asio::io_context& context;
+	    tcp::acceptor& acceptor;
+	    unique_ptr<tcp::socket> arrived;
+	    AsioErrorCode failure;
+	    bool accepting;
+};
+
+MigrationListener::MigrationListener(asio::io_context& context, tcp::acceptor& acceptor) : context(context), acceptor(acceptor), accepting(false) {
+    accept();
+}
+
+// The accept handler refers to the listener, so it has to have run.
+MigrationListener::~MigrationListener() {
+    AsioErrorCode ignored;
+    acceptor.cancel(ignored);
+    while (accepting) {
+        if (context.stopped()) {
+            context.restart();
+        }
+        context.run_one();
+    }
+}
+
+void MigrationListener::accept() {
+    accepting = true;
+    acceptor.async_accept([this](const AsioErrorCode& error, tcp::socket socket) {
+        accepting = false;
+        if (error) {
+            failure = error;
+            return;
+        }
+        arrived.reset(new tcp::socket(move(socket)));
+    });
+}
+
+bool MigrationListener::take(unique_ptr<tcp::socket>& socket) {
+    if (!arrived) {
+        return false;
+    }
+
+    socket = move(arrived);
+    accept();
+    return true;
+}
+
+bool MigrationListener::wait(unique_ptr<tcp::socket>& socket, AsioErrorCode& error) {
+    while (!arrived && !failure) {
+        if (context.stopped()) {
+            context.restart();
+        }
+        context.run_one();
+    }
+
+    error = failure;
+    return !failure && take(socket);
+}
+
+static vector<uint8_t> heldRanges(const vector<bool>& held) {
+    vector<pair<uint32_t, uint32_t>> ranges;
+
+    for (uint32_t page = 0; page < held.size();) {
+        if (!held[page]) {
+            ++page;
+            continue;
+        }
+
+        uint32_t first = page;
+        while (page < held.size() && held[page]) {
+            ++page;
+        }
+        ranges.emplace_back(first, page - first);
+    }
+
+    vector<uint8_t> message(1, 'R');
+    putBigEndian(message, ranges.size(), 4);
+    for (const auto& range : ranges) {
+        putBigEndian(message, range.first, 4);
+        putBigEndian(message, range.second, 4);
+    }
+    return message;
+}
+
+// Marks the pages an 'R' message lists; pages already marked stay so.
+static bool readHeldRanges(const vector<uint8_t>& message, vector<bool>& held) {
+    if (message.size() < 5 || message[0] != 'R') {
+        return false;
+    }
+
+    uint64_t ranges = getBigEndian(&message[1], 4);
+    if (message.size() != 5 + ranges * 8) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < ranges; ++i) {
+        uint64_t first = getBigEndian(&message[5 + i * 8], 4);
+        uint64_t count = getBigEndian(&message[9 + i * 8], 4);
+        if (first + count > held.size()) {
+            return false;
+        }
+        fill(held.begin() + first, held.begin() + first + count, true);
+    }
+    return true;
+}
+
+static uint64_t randomSessionId() {
+    random_device device;
+    return (static_cast<uint64_t>(device()) << 32) | device();
+}
+
+MigrationSender::MigrationSender(vector<uint8_t> migrationImage)
+    : image(move(migrationImage)), imageFile(-1), imageBytes(image.size()), imageValid(true), format(MigrationImageFormat::VirtualMachineState), session(randomSessionId()),
+      encrypted(false), key(), limiter(nullptr), attempts(5), retryDelay(200), ioTimeout(kMigrationIoTimeout), sent(0), reconnected(0) {
+    acknowledged.assign((imageBytes + kMigrationPageBytes - 1) / kMigrationPageBytes, false);
+}
+
+MigrationSender::MigrationSender(const string& imagePath, MigrationImageFormat imageFormat)
+    : imageFile(open(imagePath.c_str(), O_RDONLY)), imageBytes(0), imageValid(false), format(imageFormat), session(randomSessionId()),
+      encrypted(false), key(), limiter(nullptr), attempts(5), retryDelay(200), ioTimeout(kMigrationIoTimeout), sent(0), reconnected(0) {
+    struct stat status;
+
+    if (imageFile < 0 || fstat(imageFile, &status) != 0) {
+        cerr << "Unable to open " << imagePath << endl;
+        return;
+    }
+
+    imageBytes = status.st_size;
+    imageValid = true;
+    acknowledged.assign((imageBytes + kMigrationPageBytes - 1) / kMigrationPageBytes, false);
+}
+
+MigrationSender::~MigrationSender() {
+    if (imageFile >= 0) {
+        close(imageFile);
+    }
+}
+
+bool MigrationSender::valid() const {
+    return imageValid;
+}
+
+void MigrationSender::setKey(const SecureKey& migrationKey) {
+    key = migrationKey;
+    encrypted = true;
+}
+
+void MigrationSender::setRateLimiter(MigrationRateLimiter* rateLimiter) {
+    limiter = rateLimiter;
+}
+
+void MigrationSender::setRetries(int connectionAttempts, chrono::milliseconds delay) {
+    attempts = max(1, connectionAttempts);
+    retryDelay = delay;
+}
+
+void MigrationSender::setIoTimeout(chrono::milliseconds timeout) {
+    ioTimeout = timeout;
+}
+
+// Once a commit may have reached the destination, a lost connection can no
+// longer be read as failure: the destination may have taken over.
+MigrationOutcome MigrationSender::run(const string& host, const string& port) {
+    bool commitSent = false;
+    chrono::milliseconds delay = retryDelay;
+
+    for (int attempt = 0; attempt < attempts; ++attempt) {
+        if (attempt > 0) {
+            this_thread::sleep_for(delay);
+            delay *= 2;
+            reconnected++;
+        }
+
+        asio::io_context context;
+        tcp::resolver resolver(context);
+        tcp::socket socket(context);
+        AsioErrorCode error;
+
+        auto endpoints = resolver.resolve(host, port, error);
+        if (!error) {
+            bool connected = false;
+            bool timedOut = false;
+            asio::async_connect(socket, endpoints, [&](const AsioErrorCode& result, const tcp::endpoint&) {
+                error = result;
+                connected = true;
+            });
+            if (!runOperation(context, socket, connected, ioTimeout, nullptr, timedOut)) {
+                error = asio::error::timed_out;
+            }
+        }
+        if (error) {
+            cerr << "Unable to connect to " << host << ":" << port << ": " << error.message() << endl;
+            continue;
+        }
+
+        MigrationConnection connection(context, move(socket), encrypted ? &key : nullptr, true, ioTimeout);
+        bool cutOver = false;
+        runConnection(connection, commitSent, cutOver);
+        if (cutOver) {
+            return MigrationOutcome::CutOver;
+        }
+        cerr << "Migration connection to " << host << ":" << port << (connection.timedOut ? " stalled" : " lost") << endl;
+    }
+
+    return commitSent ? MigrationOutcome::Unknown : MigrationOutcome::Failed;
+}
+
+bool MigrationSender::runConnection(MigrationConnection& connection, bool& commitSent, bool& cutOver) {
+    if (!connection.handshake()) {
+        return false;
+    }
+
+    vector<uint8_t> message(1, 'H');
+    putBigEndian(message, session, 8);
+    putBigEndian(message, imageBytes, 8);
+    putBigEndian(message, kMigrationPageBytes, 4);
+    message.push_back(static_cast<uint8_t>(format));
+
+    if (!connection.send(message) || !connection.receive(message) || !readHeldRanges(message, acknowledged)) {
+        return false;
+    }
+
+    for (int round = 0; round < kCommitRounds; ++round) {
+        for (uint32_t page = 0; page < acknowledged.size(); ++page) {
+            if (acknowledged[page]) {
+                continue;
+            }
+            if (!sendPage(connection, page)) {
+                return false;
+            }
+            sent++;
+        }
+
+        // Marked before sending: a partly written commit may still land.
+        commitSent = true;
+        message.assign(1, 'C');
+        if (!connection.send(message) || !connection.receive(message)) {
+            return false;
+        }
+
+        if (message.size() == 1 && message[0] == 'D') {
+            cutOver = true;
+            return true;
+        }
+        if (!readHeldRanges(message, acknowledged)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+bool MigrationSender::sendPage(MigrationConnection& connection, uint32_t page) {
+    uint64_t offset = static_cast<uint64_t>(page) * kMigrationPageBytes;
+    size_t bytes = min<uint64_t>(kMigrationPageBytes, imageBytes - offset);
+
+    vector<uint8_t> message(1, 'P');
+    putBigEndian(message, page, 4);
+
+    if (limiter) {
+        limiter->throttle(message.size() + bytes);
+    }
+
+    if (imageFile >= 0 && !connection.encrypted()) {
+        return connection.sendFile(message, imageFile, offset, bytes);
+    }
+
+    // Sealing needs the bytes in memory, so file pages are read first.
+    if (imageFile >= 0) {
+        message.resize(message.size() + bytes);
+        if (pread(imageFile, message.data() + 5, bytes, static_cast<off_t>(offset)) != static_cast<ssize_t>(bytes)) {
+            return false;
+        }
+    } else {
+        message.insert(message.end(), image.begin() + offset, image.begin() + offset + bytes);
+    }
+    return connection.send(message);
+}
+
+uint64_t MigrationSender::sessionId() const {
+    return session;
+}
+
+uint32_t MigrationSender::pageCount() const {
+    return static_cast<uint32_t>(acknowledged.size());
+}
+
+uint64_t MigrationSender::pagesSent() const {
+    return sent;
+}
+
+int MigrationSender::reconnects() const {
+    return reconnected;
+}
+
+MigrationReceiver::MigrationReceiver() : encrypted(false), key(), ioTimeout(kMigrationIoTimeout), cutOverSession(0) {
+}
+
+void MigrationReceiver::setKey(const SecureKey& migrationKey) {
+    key = migrationKey;
+    encrypted = true;
+}
+
+void MigrationReceiver::setIoTimeout(chrono::milliseconds timeout) {
+    ioTimeout = timeout;
+}
+
+// Connections whose hello has arrived wait in ready. While one is served,
+// a new connection is greeted as it arrives: if it resumes the same
+// session, the old connection is dropped, whatever state it hangs in.
+bool MigrationReceiver::run(asio::io_context& context, tcp::acceptor& acceptor) {
+    MigrationListener listener(context, acceptor);
+    deque<pair<unique_ptr<MigrationConnection>, vector<uint8_t>>> ready;
+
+    while (true) {
+        if (ready.empty()) {
+            unique_ptr<tcp::socket> socket;
+            AsioErrorCode error;
+
+            if (!listener.wait(socket, error)) {
+                cerr << "Unable to accept migration connection: " << error.message() << endl;
+                return false;
+            }
+
+            vector<uint8_t> hello;
+            unique_ptr<MigrationConnection> connection = greet(context, move(*socket), hello);
+            if (connection) {
+                ready.emplace_back(move(connection), move(hello));
+            }
+            continue;
+        }
+
+        unique_ptr<MigrationConnection> connection = move(ready.front().first);
+        vector<uint8_t> hello = move(ready.front().second);
+        ready.pop_front();
+
+        bool superseded = false;
+        connection->interrupted = [&]() {
+            unique_ptr<tcp::socket> socket;
+            if (superseded || !listener.take(socket)) {
+                return false;
+            }
+
+            vector<uint8_t> candidateHello;
+            unique_ptr<MigrationConnection> candidate = greet(context, move(*socket), candidateHello);
+            if (!candidate) {
+                return false;
+            }
+
+            superseded = getBigEndian(&candidateHello[1], 8) == getBigEndian(&hello[1], 8);
+            if (superseded) {
+                cerr << "Migration session resumed on a new connection; dropping the old one" << endl;
+                ready.emplace_front(move(candidate), move(candidateHello));
+            } else if (ready.size() < kMaxMigrationSessions) {
+                ready.emplace_back(move(candidate), move(candidateHello));
+            }
+            return superseded;
+        };
+
+        if (serveConnection(*connection, hello)) {
+            return true;
+        }
+    }
+}
+
+// Takes the handshake and hello of a new connection; null if either
+// fails or times out.
+unique_ptr<MigrationConnection> MigrationReceiver::greet(asio::io_context& context, tcp::socket socket, vector<uint8_t>& hello) {
+    unique_ptr<MigrationConnection> connection(new MigrationConnection(context, move(socket), encrypted ? &key : nullptr, false, ioTimeout));
+
+    if (!connection->handshake() || !connection->receive(hello) || hello.size() != 22 || hello[0] != 'H') {
+        if (connection->rejected) {
+            cerr << "Rejected migration connection that failed authentication" << endl;
+        }
+        return nullptr;
+    }
+    return connection;
+}
+
+// Returns true once the session on this connection has cut over.
+bool MigrationReceiver::serveConnection(MigrationConnection& connection, const vector<uint8_t>& hello) {
+    uint64_t id = getBigEndian(&hello[1], 8);
+    uint64_t totalBytes = getBigEndian(&hello[9], 8);
+    uint32_t pageBytes = static_cast<uint32_t>(getBigEndian(&hello[17], 4));
+    uint8_t format = hello[21];
+
+    if (pageBytes < kMinMigrationPageBytes || pageBytes + 5 > kSecureMaxFrameBytes || totalBytes > kMaxMigrationImageBytes || format > static_cast<uint8_t>(MigrationImageFormat::Snapshot)) {
+        return false;
+    }
+
+    Session* opened = openSession(id, totalBytes, pageBytes, static_cast<MigrationImageFormat>(format));
+    if (!opened) {
+        return false;
+    }
+    Session& session = *opened;
+
+    if (!connection.send(heldRanges(session.held))) {
+        return false;
+    }
+
+    vector<uint8_t> message;
+    while (connection.receive(message)) {
+        session.lastActive = chrono::steady_clock::now();
+
+        if (message.size() >= 5 && message[0] == 'P') {
+            uint64_t page = getBigEndian(&message[1], 4);
+            size_t offset = page * pageBytes;
+
+            if (page >= session.held.size() || message.size() - 5 != min<size_t>(pageBytes, totalBytes - offset)) {
+                return false;
+            }
+
+            if (session.image.size() != totalBytes) {
+                session.image.resize(totalBytes);
+            }
+            memcpy(session.image.data() + offset, message.data() + 5, message.size() - 5);
+            session.held[page] = true;
+        } else if (message.size() == 1 && message[0] == 'C') {
+            if (all_of(session.held.begin(), session.held.end(), [](bool held) { return held; })) {
+                cutOverSession = id;
+                connection.send(vector<uint8_t>(1, 'D'));
+                return true;
+            }
+
+            if (!connection.send(heldRanges(session.held))) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    if (connection.rejected) {
+        cerr << "Rejected migration frame that failed authentication" << endl;
+    }
+    if (connection.timedOut) {
+        cerr << "Dropped a migration connection that stalled" << endl;
+    }
+    return false;
+}
+
+// Finds the session a source resumes, or starts it, first dropping idle
+// sessions. Returns null for a mismatched resume or when the limits are
+// reached.
+MigrationReceiver::Session* MigrationReceiver::openSession(uint64_t id, uint64_t totalBytes, uint32_t pageBytes, MigrationImageFormat format) {
+    auto now = chrono::steady_clock::now();
+    uint64_t heldBytes = 0;
+
+    for (auto session = sessions.begin(); session != sessions.end();) {
+        bool idle = now - session->second.lastActive > kMigrationSessionIdle;
+        if (session->first != id && session->first != cutOverSession && idle) {
+            session = sessions.erase(session);
+        } else {
+            heldBytes += session->first != id ? session->second.totalBytes : 0;
+            ++session;
+        }
+    }
+
+    auto found = sessions.find(id);
+    if (found != sessions.end()) {
+        Session& session = found->second;
+        if (session.pageBytes != pageBytes || session.totalBytes != totalBytes || session.format != format) {
+            return nullptr;
+        }
+        session.lastActive = now;
+        return &session;
+    }
+
+    if (sessions.size() >= kMaxMigrationSessions || heldBytes + totalBytes > kMaxMigrationImageBytes) {
+        cerr << "Refusing migration session: " << sessions.size() << " sessions of " << heldBytes << " bytes are in progress" << endl;
+        return nullptr;
+    }
+
+    Session& session = sessions[id];
+    session.totalBytes = totalBytes;
+    session.pageBytes = pageBytes;
+    session.format = format;
+    session.held.assign((totalBytes + pageBytes - 1) / pageBytes, false);
+    session.lastActive = now;
+    return &session;
+}
+
+const vector<uint8_t>& MigrationReceiver::image() const {
+    return sessions.at(cutOverSession).image;
+}
+
+MigrationImageFormat MigrationReceiver::imageFormat() const {
+    return sessions.at(cutOverSession).format;
+}
+
+uint64_t MigrationReceiver::sessionId() const {
+    return cutOverSession;
+}
+
+vector<uint8_t> serializeVirtualMachineState(const int32_t registers[32], int32_t programCounter) {
+    map<string, int32_t> named = {{"$R0", 0}};
+    for (int i = 0; i < 32; ++i) {
+        named["$" + to_string(i)] = registers[i];
+    }
+
+    vector<uint8_t> image(sizeof(programCounter));
+    memcpy(image.data(), &programCounter, sizeof(programCounter));
+
+    for (const auto& reg : named) {
+        int32_t nameBytes = static_cast<int32_t>(reg.first.size());
+        size_t position = image.size();
+        image.resize(position + 2 * sizeof(int32_t) + nameBytes);
+
+        memcpy(image.data() + position, &nameBytes, sizeof(nameBytes));
+        memcpy(image.data() + position + sizeof(nameBytes), reg.first.data(), nameBytes);
+        memcpy(image.data() + position + sizeof(nameBytes) + nameBytes, &reg.second, sizeof(reg.second));
+    }
+    return image;
+}
+
+bool deserializeVirtualMachineState(const vector<uint8_t>& image, int32_t registers[32], int32_t& programCounter) {
+    if (image.size() < sizeof(programCounter)) {
+        return false;
+    }
+    memcpy(&programCounter, image.data(), sizeof(programCounter));
+    size_t position = sizeof(programCounter);
+
+    while (position < image.size()) {
+        int32_t nameBytes = 0;
+        if (image.size() - position < sizeof(nameBytes)) {
+            return false;
+        }
+        memcpy(&nameBytes, image.data() + position, sizeof(nameBytes));
+        position += sizeof(nameBytes);
+
+        if (nameBytes < 0 || image.size() - position < nameBytes + sizeof(int32_t)) {
+            return false;
+        }
+        const char* name = reinterpret_cast<const char*>(image.data() + position);
+        position += nameBytes;
+
+        int32_t value;
+        memcpy(&value, image.data() + position, sizeof(value));
+        position += sizeof(value);
+
+        int reg = -1;
+        if (nameBytes > 1 && name[0] == '$' && from_chars(name + 1, name + nameBytes, reg).ptr == name + nameBytes && reg >= 0 && reg < 32) {
+            registers[reg] = value;
+        }
+    }
+    return true;
+}
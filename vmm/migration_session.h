@@ -0,0 +1,159 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vmm/asio_compat.h"
+#include "vmm/rate_limiter.h"
+#include "vmm/secure_channel.h"
+
+// Resumable migration of a state image cut into pages. The source names
+// the session; after a dropped connection it reconnects under the same ID,
+// the destination answers with the pages it already holds, and only the
+// rest are sent again. The destination takes over only once it holds every
+// page and the source has asked it to commit.
+//
+//   source       'H' session:u64 totalBytes:u64 pageBytes:u32 format:u8
+//   destination  'R' ranges:u32 { first:u32 count:u32 }   pages held
+//   source       'P' page:u32 bytes
+//   source       'C'                                      commit
+//   destination  'D'                                      cut over
+//
+// A commit while pages are missing is answered with another 'R'. Integers
+// are big-endian. Each message is one frame, length:u32 and the bytes, or
+// a SecureChannel frame when a key is set.
+//
+// Every connect, read and write has a deadline, kMigrationIoTimeout unless
+// set otherwise, so a link that goes silent without a FIN or RST ends the
+// connection instead of hanging it. The source then reconnects, and the
+// destination drops a hung connection as soon as the same session says
+// hello on a new one.
+
+const uint32_t kMigrationPageBytes = 4096;
+const uint64_t kMaxMigrationImageBytes = 1ull << 30;
+const size_t kMaxMigrationSessions = 8;
+const std::chrono::seconds kMigrationSessionIdle(120);
+const std::chrono::seconds kMigrationIoTimeout(30);
+
+enum class MigrationImageFormat : uint8_t {
+    // The migration client's serialized registers and program counter.
+    VirtualMachineState,
+    // A file written by createSnapshot or createCheckpoint, as it is on disk.
+    Snapshot,
+};
+
+enum class MigrationOutcome {
+    // The destination owns the VM.
+    CutOver,
+    // The destination cannot have taken over; the source keeps the VM.
+    Failed,
+    // The connection was lost after commit was requested and could not
+    // be re-established, so only the destination knows.
+    Unknown,
+};
+
+// The VirtualMachineState image: programCounter:i32, then for each register
+// in name order nameBytes:i32 name value:i32, all in host byte order.
+// Registers are named $0..$31, plus the $R0 the first migration client
+// also sent, which is skipped when read. The layout is the first client's,
+// but the session messages above carry it differently, so the first
+// client and server cannot talk to these programs.
+std::vector<uint8_t> serializeVirtualMachineState(const int32_t registers[32], int32_t programCounter);
+// False if the image is truncated; registers it does not name are left as
+// they were.
+bool deserializeVirtualMachineState(const std::vector<uint8_t>& image, int32_t registers[32], int32_t& programCounter);
+
+class MigrationConnection;
+
+class MigrationSender {
+	public:
+	    explicit MigrationSender(std::vector<uint8_t> image);
+	    // Streams the file's bytes as the image without reading them in;
+	    // plaintext pages go from the page cache to the socket by sendfile.
+	    MigrationSender(const std::string& imagePath, MigrationImageFormat format);
+	    ~MigrationSender();
+
+	    // False if the image file could not be opened.
+	    bool valid() const;
+	    void setKey(const SecureKey& key);
+	    void setRateLimiter(MigrationRateLimiter* limiter);
+	    // Connection attempts in all, with the delay doubling between them.
+	    void setRetries(int attempts, std::chrono::milliseconds delay);
+	    // Longest wait on any one connect, read or write.
+	    void setIoTimeout(std::chrono::milliseconds timeout);
+
+	    MigrationOutcome run(const std::string& host, const std::string& port);
+
+	    uint64_t sessionId() const;
+	    uint32_t pageCount() const;
+	    uint64_t pagesSent() const;
+	    int reconnects() const;
+
+	private:
+	    bool runConnection(MigrationConnection& connection, bool& commitSent, bool& cutOver);
+	    bool sendPage(MigrationConnection& connection, uint32_t page);
+
+	    std::vector<uint8_t> image;
+	    int imageFile;
+	    uint64_t imageBytes;
+	    bool imageValid;
+	    MigrationImageFormat format;
+	    std::vector<bool> acknowledged;
+	    uint64_t session;
+	    bool encrypted;
+	    SecureKey key;
+	    MigrationRateLimiter* limiter;
+	    int attempts;
+	    std::chrono::milliseconds retryDelay;
+	    std::chrono::milliseconds ioTimeout;
+	    uint64_t sent;
+	    int reconnected;
+};
+
+class MigrationReceiver {
+	public:
+	    MigrationReceiver();
+
+	    void setKey(const SecureKey& key);
+	    // Longest wait on any one read or write.
+	    void setIoTimeout(std::chrono::milliseconds timeout);
+
+	    // Serves connections one at a time on context until a session cuts
+	    // over, keeping each session's pages across drops. Returns false if
+	    // the acceptor fails.
+	    //
+	    // At most kMaxMigrationSessions sessions, of kMaxMigrationImageBytes
+	    // together, are kept, and one idle for kMigrationSessionIdle is
+	    // dropped. A session's image is allocated when its first page
+	    // arrives, so on an encrypted receiver only authenticated peers
+	    // hold memory; without a key anyone who connects can.
+	    bool run(asio::io_context& context, asio::ip::tcp::acceptor& acceptor);
+
+	    const std::vector<uint8_t>& image() const;
+	    MigrationImageFormat imageFormat() const;
+	    uint64_t sessionId() const;
+
+	private:
+	    struct Session {
+	        std::vector<uint8_t> image;
+	        std::vector<bool> held;
+	        uint64_t totalBytes = 0;
+	        uint32_t pageBytes = 0;
+	        MigrationImageFormat format = MigrationImageFormat::VirtualMachineState;
+	        std::chrono::steady_clock::time_point lastActive;
+	    };
+
+	    std::unique_ptr<MigrationConnection> greet(asio::io_context& context, asio::ip::tcp::socket socket, std::vector<uint8_t>& hello);
+	    bool serveConnection(MigrationConnection& connection, const std::vector<uint8_t>& hello);
+	    Session* openSession(uint64_t id, uint64_t totalBytes, uint32_t pageBytes, MigrationImageFormat format);
+
+	    bool encrypted;
+	    SecureKey key;
+	    std::chrono::milliseconds ioTimeout;
+	    std::map<uint64_t, Session> sessions;
+	    uint64_t cutOverSession;
+};
@@ -0,0 +1,113 @@
+#include "vmm/profiler.h"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+void VirtualMachineProfile::recordSlice(uint64_t nanoseconds) {
+    minSliceNanoseconds = slices == 0 ? nanoseconds : min(minSliceNanoseconds, nanoseconds);
+    maxSliceNanoseconds = max(maxSliceNanoseconds, nanoseconds);
+    sliceNanoseconds += nanoseconds;
+    slices++;
+}
+
+void VirtualMachineProfile::dump(const string& virtualMachineName) const {
+    cout << endl << "Profile for " + virtualMachineName << endl << endl;
+    cout << "Slices: " << slices << ", total " << sliceNanoseconds / 1000 << " us";
+    if (slices > 0) {
+        cout << ", min " << minSliceNanoseconds << " ns, avg " << sliceNanoseconds / slices << " ns, max " << maxSliceNanoseconds << " ns";
+    }
+    cout << endl;
+
+    if (hardwareCounters) {
+        cout << "Cache misses: " << cacheMisses << ", branch mispredicts: " << branchMisses << endl;
+    } else {
+        cout << "Hardware counters unavailable" << endl;
+    }
+
+    for (size_t i = 0; i < kOpcodeCount; ++i) {
+        if (opcodes[i].executed == 0) {
+            continue;
+        }
+
+        cout << setw(20) << left << opcodeName(static_cast<Opcode>(i)) << right
+             << " executed " << setw(12) << opcodes[i].executed
+             << " cycles " << setw(14) << opcodes[i].cycles
+             << " avg " << fixed << setprecision(1) << static_cast<double>(opcodes[i].cycles) / opcodes[i].executed << defaultfloat << endl;
+    }
+}
+
+uint64_t readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static int openHardwareCounter(uint64_t config, int groupFd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+namespace {
+
+struct ThreadHardwareCounters {
+    ThreadHardwareCounters() {
+        groupFd = openHardwareCounter(PERF_COUNT_HW_CACHE_MISSES, -1);
+        branchFd = groupFd >= 0 ? openHardwareCounter(PERF_COUNT_HW_BRANCH_MISSES, groupFd) : -1;
+
+        if (groupFd >= 0 && branchFd < 0) {
+            close(groupFd);
+            groupFd = -1;
+        }
+    }
+
+    ~ThreadHardwareCounters() {
+        if (groupFd >= 0) {
+            close(branchFd);
+            close(groupFd);
+        }
+    }
+
+    int groupFd;
+    int branchFd;
+};
+
+}
+
+HardwareCounterSample readHardwareCounters() {
+    thread_local ThreadHardwareCounters counters;
+    HardwareCounterSample sample;
+
+    struct {
+        uint64_t events;
+        uint64_t values[2];
+    } group;
+
+    if (counters.groupFd >= 0 && read(counters.groupFd, &group, sizeof(group)) == sizeof(group) && group.events == 2) {
+        sample.valid = true;
+        sample.cacheMisses = group.values[0];
+        sample.branchMisses = group.values[1];
+    }
+
+    return sample;
+}
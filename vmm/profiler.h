@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "vmm/decoded_program.h"
+
+struct OpcodeProfile {
+    uint64_t executed = 0;
+    uint64_t cycles = 0;
+};
+
+struct VirtualMachineProfile {
+    OpcodeProfile opcodes[kOpcodeCount];
+    uint64_t slices = 0;
+    uint64_t sliceNanoseconds = 0;
+    uint64_t minSliceNanoseconds = 0;
+    uint64_t maxSliceNanoseconds = 0;
+    // Only meaningful when hardwareCounters is set; perf_event_open is often
+    // unavailable in containers or with a strict perf_event_paranoid.
+    bool hardwareCounters = false;
+    uint64_t cacheMisses = 0;
+    uint64_t branchMisses = 0;
+
+    void recordSlice(uint64_t nanoseconds);
+    void dump(const std::string& virtualMachineName) const;
+};
+
+struct HardwareCounterSample {
+    bool valid = false;
+    uint64_t cacheMisses = 0;
+    uint64_t branchMisses = 0;
+};
+
+// Timestamp counter on x86, steady clock nanoseconds elsewhere.
+uint64_t readCycleCounter();
+
+// Reads user-space cache misses and branch mispredicts for the calling
+// thread. The perf events are opened on first use per thread and a sample
+// is invalid if the kernel refuses them.
+HardwareCounterSample readHardwareCounters();
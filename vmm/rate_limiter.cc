@@ -0,0 +1,133 @@
+#include "vmm/rate_limiter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const uint64_t kMinimumBurstBytes = 64 * 1024;
+
+TokenBucket::TokenBucket(uint64_t bytesPerSecond, uint64_t burstBytes) {
+    setRate(bytesPerSecond, burstBytes);
+}
+
+void TokenBucket::setRate(uint64_t rate, uint64_t burstBytes) {
+    lock_guard<mutex> lock(bucketMutex);
+
+    bytesPerSecond = rate;
+    burst = static_cast<double>(burstBytes > 0 ? burstBytes : max(kMinimumBurstBytes, rate / 100));
+    tokens = burst;
+    refilled = chrono::steady_clock::now();
+}
+
+uint64_t TokenBucket::rate() const {
+    lock_guard<mutex> lock(bucketMutex);
+    return bytesPerSecond;
+}
+
+// A caller takes its tokens at once, going into debt if need be, and then
+// sleeps off its share of the debt outside the lock.
+void TokenBucket::acquire(uint64_t bytes) {
+    chrono::duration<double> wait(0);
+    {
+        lock_guard<mutex> lock(bucketMutex);
+        if (bytesPerSecond == 0) {
+            return;
+        }
+
+        auto now = chrono::steady_clock::now();
+        tokens = min(burst, tokens + chrono::duration<double>(now - refilled).count() * bytesPerSecond);
+        refilled = now;
+        tokens -= static_cast<double>(bytes);
+
+        if (tokens < 0) {
+            wait = chrono::duration<double>(-tokens / bytesPerSecond);
+        }
+    }
+
+    if (wait.count() > 0) {
+        this_thread::sleep_for(wait);
+    }
+}
+
+TokenBucket& migrationBandwidth() {
+    static TokenBucket bucket;
+    return bucket;
+}
+
+MigrationRateLimiter::MigrationRateLimiter(uint64_t bytesPerSecond) : stream(bytesPerSecond), sent(0) {
+}
+
+void MigrationRateLimiter::attachMetrics(shared_ptr<VirtualMachineMetrics> virtualMachineMetrics) {
+    metrics = move(virtualMachineMetrics);
+    if (metrics) {
+        metrics->migrationTargetBytesPerSecond.set(targetBytesPerSecond());
+    }
+}
+
+void MigrationRateLimiter::throttle(size_t bytes) {
+    if (sent == 0) {
+        started = chrono::steady_clock::now();
+    }
+
+    stream.acquire(bytes);
+    migrationBandwidth().acquire(bytes);
+    sent += bytes;
+
+    if (metrics) {
+        metrics->migrationBytesSent.set(sent);
+        metrics->migrationAchievedBytesPerSecond.set(static_cast<uint64_t>(achievedBytesPerSecond()));
+    }
+}
+
+uint64_t MigrationRateLimiter::bytesSent() const {
+    return sent;
+}
+
+uint64_t MigrationRateLimiter::targetBytesPerSecond() const {
+    uint64_t streamRate = stream.rate();
+    uint64_t hostRate = migrationBandwidth().rate();
+
+    if (streamRate == 0 || hostRate == 0) {
+        return max(streamRate, hostRate);
+    }
+    return min(streamRate, hostRate);
+}
+
+double MigrationRateLimiter::achievedBytesPerSecond() const {
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    return sent > 0 && seconds > 0 ? sent / seconds : 0;
+}
+
+// With NPTL, PRIO_PROCESS on a thread id sets that thread's nice value.
+bool applyMigrationSenderPolicy(int niceness, int cpu) {
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), niceness) != 0) {
+        cerr << "Unable to set migration sender niceness " << niceness << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    if (cpu >= CPU_SETSIZE) {
+        cerr << "Unable to pin migration sender to CPU " << cpu << ": past CPU_SETSIZE" << endl;
+        return false;
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            cerr << "Unable to pin migration sender to CPU " << cpu << ": " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
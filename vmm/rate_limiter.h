@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "vmm/metrics.h"
+
+// Token bucket over bytes. Tokens accrue at the rate up to one burst, so a
+// stream that has been idle may send a burst at once and is then held to
+// the rate. A rate of 0 means unlimited.
+class TokenBucket {
+	public:
+	    explicit TokenBucket(uint64_t bytesPerSecond = 0, uint64_t burstBytes = 0);
+
+	    // The burst defaults to 10 ms at the rate, and is never less than
+	    // 64 KiB.
+	    void setRate(uint64_t bytesPerSecond, uint64_t burstBytes = 0);
+	    uint64_t rate() const;
+
+	    // Takes bytes of tokens, sleeping until they have accrued. Callers
+	    // reserve in turn, so threads sharing a bucket split its rate.
+	    void acquire(uint64_t bytes);
+
+	private:
+	    mutable std::mutex bucketMutex;
+	    uint64_t bytesPerSecond;
+	    double burst;
+	    double tokens;
+	    std::chrono::steady_clock::time_point refilled;
+};
+
+// Host-wide cap shared by every migration stream in the process. Unlimited
+// until setRate is called on it.
+TokenBucket& migrationBandwidth();
+
+// Paces one migration stream by its own limit and the host-wide one, and
+// keeps what it sent so stats can compare the achieved rate to the target.
+class MigrationRateLimiter {
+	public:
+	    explicit MigrationRateLimiter(uint64_t bytesPerSecond = 0);
+
+	    // Publishes target and achieved rates and bytes sent on metrics.
+	    void attachMetrics(std::shared_ptr<VirtualMachineMetrics> virtualMachineMetrics);
+
+	    // Call before sending bytes; blocks until both limits allow them.
+	    void throttle(size_t bytes);
+
+	    uint64_t bytesSent() const;
+	    // The lower of the stream and host-wide limits; 0 when neither is set.
+	    uint64_t targetBytesPerSecond() const;
+	    // Since the first throttle call.
+	    double achievedBytesPerSecond() const;
+
+	private:
+	    TokenBucket stream;
+	    uint64_t sent;
+	    std::chrono::steady_clock::time_point started;
+	    std::shared_ptr<VirtualMachineMetrics> metrics;
+};
+
+// Lowers the calling thread's priority to niceness and, for cpu >= 0, pins
+// it to that CPU, so a migration sender yields to the guests it shares the
+// host with. Returns false, after reporting on cerr, if either step fails;
+// a cpu of CPU_SETSIZE or more fails without touching the thread.
+bool applyMigrationSenderPolicy(int niceness, int cpu);
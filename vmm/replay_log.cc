@@ -0,0 +1,237 @@
+#include "vmm/replay_log.h"
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static const char kReplayMagic[] = "VMMRLOG";
+static const uint8_t kReplayVersion = 1;
+static const uint64_t kMaxReplayString = 4096;
+
+bool ReplayLogWriter::open(const string& logPath) {
+    log.open(logPath, ios::binary | ios::trunc);
+
+    if (!log) {
+        cerr << "Unable to create replay log " << logPath << endl;
+        return false;
+    }
+
+    log.write(kReplayMagic, sizeof(kReplayMagic) - 1);
+    writeByte(kReplayVersion);
+    return true;
+}
+
+void ReplayLogWriter::recordVirtualMachine(const ReplayVirtualMachineState& state) {
+    writeByte('V');
+    writeString(state.name);
+    writeString(state.binaryPath);
+    writeVarint(state.execSliceInInstructions);
+    writeByte(state.optimize);
+    writeState(state);
+}
+
+void ReplayLogWriter::recordSlice(size_t virtualMachine, int programCounter) {
+    writeByte('S');
+    writeVarint(virtualMachine);
+    writeVarint(programCounter);
+    slices++;
+}
+
+bool ReplayLogWriter::checkpointDue() const {
+    return slices % kReplayCheckpointInterval == 0;
+}
+
+void ReplayLogWriter::recordCheckpoint(const vector<ReplayVirtualMachineState>& states) {
+    writeByte('C');
+    writeVarint(slices);
+
+    for (const auto& state : states) {
+        writeState(state);
+    }
+}
+
+void ReplayLogWriter::recordFinal(const vector<ReplayVirtualMachineState>& states) {
+    writeByte('F');
+
+    for (const auto& state : states) {
+        writeState(state);
+    }
+
+    log.flush();
+}
+
+void ReplayLogWriter::writeByte(uint8_t value) {
+    log.put(static_cast<char>(value));
+}
+
+void ReplayLogWriter::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        writeByte(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    writeByte(static_cast<uint8_t>(value));
+}
+
+void ReplayLogWriter::writeString(const string& value) {
+    writeVarint(value.size());
+    log.write(value.data(), value.size());
+}
+
+void ReplayLogWriter::writeState(const ReplayVirtualMachineState& state) {
+    writeVarint(state.programCounter);
+    log.write(reinterpret_cast<const char*>(state.registers), sizeof(state.registers));
+}
+
+bool ReplayLogReader::open(const string& logPath) {
+    log.open(logPath, ios::binary);
+
+    if (!log) {
+        cerr << "Unable to open replay log " << logPath << endl;
+        return false;
+    }
+
+    char magic[sizeof(kReplayMagic) - 1];
+    log.read(magic, sizeof(magic));
+    if (!log || memcmp(magic, kReplayMagic, sizeof(magic)) != 0 || readByte() != kReplayVersion) {
+        cerr << "Not a replay log " << logPath << endl;
+        return false;
+    }
+
+    while (log.peek() == 'V') {
+        readByte();
+
+        ReplayVirtualMachineState state;
+        state.name = readString();
+        state.binaryPath = readString();
+        state.execSliceInInstructions = static_cast<int>(readVarint());
+        state.optimize = readByte() != 0;
+        readState(state);
+        initial.push_back(state);
+    }
+
+    if (!log || initial.empty()) {
+        cerr << "Replay log " << logPath << " has no virtual machines" << endl;
+        return false;
+    }
+
+    firstSlice = log.tellg();
+    return true;
+}
+
+const vector<ReplayVirtualMachineState>& ReplayLogReader::initialState() const {
+    return initial;
+}
+
+uint64_t ReplayLogReader::seek(uint64_t slice, vector<ReplayVirtualMachineState>& states) {
+    log.clear();
+    log.seekg(firstSlice);
+    states = initial;
+
+    uint64_t restored = 0;
+    streampos resume = firstSlice;
+
+    // Checkpoints are not indexed, so walk the slice records up to the
+    // target, keeping the position of the last checkpoint passed.
+    while (true) {
+        int tag = log.peek();
+
+        if (tag == 'S') {
+            readByte();
+            readVarint();
+            readVarint();
+        } else if (tag == 'C') {
+            readByte();
+            uint64_t checkpoint = readVarint();
+            if (checkpoint > slice) {
+                break;
+            }
+
+            for (auto& state : states) {
+                readState(state);
+            }
+            restored = checkpoint;
+            resume = log.tellg();
+        } else {
+            break;
+        }
+    }
+
+    log.clear();
+    log.seekg(resume);
+    return restored;
+}
+
+bool ReplayLogReader::nextSlice(size_t& virtualMachine, int& programCounter) {
+    while (true) {
+        int tag = log.peek();
+
+        if (tag == 'S') {
+            readByte();
+            virtualMachine = readVarint();
+            programCounter = static_cast<int>(readVarint());
+            return static_cast<bool>(log) && virtualMachine < initial.size();
+        } else if (tag == 'C') {
+            readByte();
+            readVarint();
+            ReplayVirtualMachineState skipped;
+            for (size_t i = 0; i < initial.size(); ++i) {
+                readState(skipped);
+            }
+        } else if (tag == 'F') {
+            readByte();
+            recordedFinal = initial;
+            for (auto& state : recordedFinal) {
+                readState(state);
+            }
+            finalSeen = static_cast<bool>(log);
+            return false;
+        } else {
+            return false;
+        }
+    }
+}
+
+bool ReplayLogReader::hasFinalState() const {
+    return finalSeen;
+}
+
+const vector<ReplayVirtualMachineState>& ReplayLogReader::finalState() const {
+    return recordedFinal;
+}
+
+uint8_t ReplayLogReader::readByte() {
+    return static_cast<uint8_t>(log.get());
+}
+
+uint64_t ReplayLogReader::readVarint() {
+    uint64_t value = 0;
+
+    for (int shift = 0; shift < 64 && log; shift += 7) {
+        uint8_t byte = readByte();
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+
+    return value;
+}
+
+string ReplayLogReader::readString() {
+    uint64_t length = readVarint();
+    if (length > kMaxReplayString) {
+        log.setstate(ios::failbit);
+        return string();
+    }
+
+    string value(length, '\0');
+    log.read(&value[0], value.size());
+    return value;
+}
+
+void ReplayLogReader::readState(ReplayVirtualMachineState& state) {
+    state.programCounter = static_cast<int>(readVarint());
+    log.read(reinterpret_cast<char*>(state.registers), sizeof(state.registers));
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Append-only binary log of a scheduler run. The log starts with the
+// initial state of every VM, then holds one record per slice naming the VM
+// the scheduler picked, with periodic checkpoints of all VM state so replay
+// can seek without re-running the whole log. Without devices or
+// asynchronous snapshots guest code has no other source of
+// nondeterminism, so the slice order is enough to replay the run
+// bit-exactly. Device input, guest memory and when a VM parks are not
+// logged, so VMs with vm_console, vm_block or vm_async_snapshots cannot be
+// recorded.
+//
+//   header      "VMMRLOG" version:u8
+//   'V'         name binary_path slice:varint optimize:u8 pc:varint registers:32 x i32
+//   'S'         vm:varint pc:varint
+//   'C'         slice:varint { pc:varint registers:32 x i32 } per VM
+//   'F'         { pc:varint registers:32 x i32 } per VM
+//
+// Strings are a varint length followed by the bytes; integers are host order
+// like the snapshot files.
+
+const uint64_t kReplayCheckpointInterval = 4096;
+
+struct ReplayVirtualMachineState {
+    std::string name;
+    std::string binaryPath;
+    int execSliceInInstructions = 0;
+    bool optimize = false;
+    int programCounter = 0;
+    int32_t registers[32] = {};
+};
+
+class ReplayLogWriter {
+	public:
+	    bool open(const std::string& logPath);
+	    void recordVirtualMachine(const ReplayVirtualMachineState& state);
+	    void recordSlice(size_t virtualMachine, int programCounter);
+	    bool checkpointDue() const;
+	    void recordCheckpoint(const std::vector<ReplayVirtualMachineState>& states);
+	    void recordFinal(const std::vector<ReplayVirtualMachineState>& states);
+
+	private:
+	    void writeByte(uint8_t value);
+	    void writeVarint(uint64_t value);
+	    void writeString(const std::string& value);
+	    void writeState(const ReplayVirtualMachineState& state);
+
+	    std::ofstream log;
+	    uint64_t slices = 0;
+};
+
+class ReplayLogReader {
+	public:
+	    bool open(const std::string& logPath);
+	    const std::vector<ReplayVirtualMachineState>& initialState() const;
+
+	    // Restores the last checkpoint at or before slice into states and
+	    // positions the reader on the slice after it. Returns that checkpoint's
+	    // slice index.
+	    uint64_t seek(uint64_t slice, std::vector<ReplayVirtualMachineState>& states);
+
+	    // Returns false once the final state record (or the end of a truncated
+	    // log) is reached.
+	    bool nextSlice(size_t& virtualMachine, int& programCounter);
+	    bool hasFinalState() const;
+	    const std::vector<ReplayVirtualMachineState>& finalState() const;
+
+	private:
+	    uint8_t readByte();
+	    uint64_t readVarint();
+	    std::string readString();
+	    void readState(ReplayVirtualMachineState& state);
+
+	    std::ifstream log;
+	    std::streampos firstSlice;
+	    std::vector<ReplayVirtualMachineState> initial;
+	    std::vector<ReplayVirtualMachineState> recordedFinal;
+	    bool finalSeen = false;
+};
@@ -0,0 +1,98 @@
+#include "vmm/scheduler_arena.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <vector>
+#include <sched.h>
+
+#if defined(VMM_HAVE_NUMA)
+#include <numa.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Upstream for a node's pool: whole chunks bound to that node.
+class NumaNodeResource : public pmr::memory_resource {
+	public:
+	    explicit NumaNodeResource(int node) : node(node) {}
+
+	private:
+	    void* do_allocate(size_t bytes, size_t alignment) override {
+#if defined(VMM_HAVE_NUMA)
+	        if (numa_available() >= 0) {
+	            if (void* pointer = numa_alloc_onnode(bytes, node)) {
+	                return pointer;
+	            }
+	            throw bad_alloc();
+	        }
+#endif
+	        return pmr::new_delete_resource()->allocate(bytes, alignment);
+	    }
+
+	    void do_deallocate(void* pointer, size_t bytes, size_t alignment) override {
+#if defined(VMM_HAVE_NUMA)
+	        if (numa_available() >= 0) {
+	            numa_free(pointer, bytes);
+	            return;
+	        }
+#endif
+	        pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+	    }
+
+	    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+	        return this == &other;
+	    }
+
+	    int node;
+};
+
+// Guest pages are a little over 4 KiB with their reference count, so the
+// pools must serve blocks that size rather than pass them upstream one
+// mapping at a time.
+const size_t kLargestPooledBlock = 64 << 10;
+
+struct NodeArena {
+    explicit NodeArena(int node) : upstream(node), pool(pmr::pool_options{0, kLargestPooledBlock}, &upstream) {}
+
+    NumaNodeResource upstream;
+    pmr::synchronized_pool_resource pool;
+};
+
+}
+
+int numaNodeCount() {
+#if defined(VMM_HAVE_NUMA)
+    if (numa_available() >= 0) {
+        return numa_max_node() + 1;
+    }
+#endif
+    return 1;
+}
+
+int numaNodeOfCpu(int cpu) {
+#if defined(VMM_HAVE_NUMA)
+    if (numa_available() >= 0 && cpu >= 0) {
+        return max(0, numa_node_of_cpu(cpu));
+    }
+#endif
+    (void)cpu;
+    return 0;
+}
+
+pmr::memory_resource* schedulerArena() {
+    static vector<unique_ptr<NodeArena>> arenas = []() {
+        vector<unique_ptr<NodeArena>> nodes;
+        for (int node = 0; node < numaNodeCount(); ++node) {
+            nodes.emplace_back(new NodeArena(node));
+        }
+        return nodes;
+    }();
+
+    // A thread's node is fixed at its first allocation; workers pin
+    // themselves before building any VM.
+    thread_local pmr::memory_resource* arena = &arenas[min<size_t>(numaNodeOfCpu(sched_getcpu()), arenas.size() - 1)]->pool;
+    return arena;
+}
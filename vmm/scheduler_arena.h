@@ -0,0 +1,12 @@
+#pragma once
+
+#include <memory_resource>
+
+// Pool for VM state on the calling thread's NUMA node. Threads allocate from
+// their own pools inside the resource, so VMs on different threads don't
+// contend, and memory may be released from any thread once a VM moves.
+// Without libnuma every thread uses a single node.
+std::pmr::memory_resource* schedulerArena();
+
+int numaNodeCount();
+int numaNodeOfCpu(int cpu);
@@ -0,0 +1,252 @@
+#include "vmm/secure_channel.h"
+
+#include <cstring>
+#include <iostream>
+
+#if defined(VMM_HAVE_OPENSSL)
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#endif
+
+using namespace std;
+
+static const size_t kNonceBytes = 12;
+
+bool parseSecureKey(const string& hex, SecureKey& key) {
+    if (hex.size() != key.size() * 2) {
+        return false;
+    }
+
+    for (size_t i = 0; i < key.size(); ++i) {
+        uint8_t byte = 0;
+
+        for (char digit : {hex[2 * i], hex[2 * i + 1]}) {
+            byte <<= 4;
+            if (digit >= '0' && digit <= '9') {
+                byte |= digit - '0';
+            } else if (digit >= 'a' && digit <= 'f') {
+                byte |= digit - 'a' + 10;
+            } else if (digit >= 'A' && digit <= 'F') {
+                byte |= digit - 'A' + 10;
+            } else {
+                return false;
+            }
+        }
+        key[i] = byte;
+    }
+
+    return true;
+}
+
+static void writeBigEndian(uint8_t* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+    }
+}
+
+static uint64_t readBigEndian(const uint8_t* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value = value << 8 | in[i];
+    }
+    return value;
+}
+
+size_t SecureChannel::frameBytes(const uint8_t* header) {
+    uint64_t length = readBigEndian(header, 4);
+    return length <= kSecureMaxFrameBytes ? kSecureFrameHeaderBytes + length + kSecureTagBytes : 0;
+}
+
+#if defined(VMM_HAVE_OPENSSL)
+
+// The key is set once per context; each frame only re-initialises the
+// nonce, which keeps the per-frame cost to the cipher itself.
+struct SecureChannel::State {
+    EVP_CIPHER_CTX* sealContext = nullptr;
+    EVP_CIPHER_CTX* openContext = nullptr;
+    SecureKey preSharedKey = {};
+    uint8_t hello[kSecureHelloBytes] = {};
+    bool initiator = false;
+    uint64_t sealed = 0;
+    uint64_t opened = 0;
+    bool valid = false;
+    bool keyed = false;
+
+    ~State() {
+        OPENSSL_cleanse(preSharedKey.data(), preSharedKey.size());
+        EVP_CIPHER_CTX_free(sealContext);
+        EVP_CIPHER_CTX_free(openContext);
+    }
+};
+
+bool secureChannelAvailable() {
+    return true;
+}
+
+SecureChannel::SecureChannel(const SecureKey& key, bool initiator) : state(new State()) {
+    state->sealContext = EVP_CIPHER_CTX_new();
+    state->openContext = EVP_CIPHER_CTX_new();
+    state->preSharedKey = key;
+    state->initiator = initiator;
+
+    state->valid = state->sealContext && state->openContext &&
+                   EVP_EncryptInit_ex(state->sealContext, EVP_aes_256_gcm(), nullptr, nullptr, nullptr) == 1 &&
+                   EVP_DecryptInit_ex(state->openContext, EVP_aes_256_gcm(), nullptr, nullptr, nullptr) == 1 &&
+                   RAND_bytes(state->hello, sizeof(state->hello)) == 1;
+
+    if (!state->valid) {
+        cerr << "Unable to set up AES-256-GCM" << endl;
+    }
+}
+
+const uint8_t* SecureChannel::hello() const {
+    return state->hello;
+}
+
+// HKDF-SHA256 (RFC 5869) with one block of output, which is a whole key.
+static bool deriveKey(const uint8_t* pseudoRandomKey, const char* label, SecureKey& key) {
+    vector<uint8_t> info(label, label + strlen(label));
+    info.push_back(1);
+    unsigned int written = 0;
+
+    return HMAC(EVP_sha256(), pseudoRandomKey, static_cast<int>(key.size()), info.data(), info.size(), key.data(), &written) && written == key.size();
+}
+
+bool SecureChannel::accept(const uint8_t* peerHello) {
+    if (!state->valid) {
+        return false;
+    }
+
+    uint8_t salt[2 * kSecureHelloBytes];
+    memcpy(salt, state->initiator ? state->hello : peerHello, kSecureHelloBytes);
+    memcpy(salt + kSecureHelloBytes, state->initiator ? peerHello : state->hello, kSecureHelloBytes);
+
+    uint8_t pseudoRandomKey[32];
+    unsigned int written = 0;
+    SecureKey initiatorKey;
+    SecureKey responderKey;
+
+    bool derived = HMAC(EVP_sha256(), salt, sizeof(salt), state->preSharedKey.data(), state->preSharedKey.size(), pseudoRandomKey, &written) && written == sizeof(pseudoRandomKey) &&
+                   deriveKey(pseudoRandomKey, "vmm migration initiator", initiatorKey) &&
+                   deriveKey(pseudoRandomKey, "vmm migration responder", responderKey);
+
+    const SecureKey& sealKey = state->initiator ? initiatorKey : responderKey;
+    const SecureKey& openKey = state->initiator ? responderKey : initiatorKey;
+    state->keyed = derived &&
+                   EVP_EncryptInit_ex(state->sealContext, nullptr, nullptr, sealKey.data(), nullptr) == 1 &&
+                   EVP_DecryptInit_ex(state->openContext, nullptr, nullptr, openKey.data(), nullptr) == 1;
+
+    OPENSSL_cleanse(pseudoRandomKey, sizeof(pseudoRandomKey));
+    OPENSSL_cleanse(initiatorKey.data(), initiatorKey.size());
+    OPENSSL_cleanse(responderKey.data(), responderKey.size());
+    return state->keyed;
+}
+
+bool SecureChannel::seal(const void* plaintext, size_t length, vector<uint8_t>& frame) {
+    if (!state->keyed || length > kSecureMaxFrameBytes) {
+        return false;
+    }
+
+    size_t start = frame.size();
+    frame.resize(start + kSecureFrameHeaderBytes + length + kSecureTagBytes);
+    uint8_t* header = frame.data() + start;
+    uint8_t* nonce = header + 4;
+    uint8_t* ciphertext = header + kSecureFrameHeaderBytes;
+
+    writeBigEndian(header, length, 4);
+    writeBigEndian(nonce, 0, 4);
+    writeBigEndian(nonce + 4, state->sealed, 8);
+
+    EVP_CIPHER_CTX* context = state->sealContext;
+    int written = 0;
+    bool sealed = EVP_EncryptInit_ex(context, nullptr, nullptr, nullptr, nonce) == 1 &&
+                  EVP_EncryptUpdate(context, nullptr, &written, header, kSecureFrameHeaderBytes) == 1 &&
+                  EVP_EncryptUpdate(context, ciphertext, &written, static_cast<const uint8_t*>(plaintext), static_cast<int>(length)) == 1 &&
+                  EVP_EncryptFinal_ex(context, ciphertext + written, &written) == 1 &&
+                  EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_GET_TAG, kSecureTagBytes, ciphertext + length) == 1;
+
+    if (!sealed) {
+        frame.resize(start);
+        return false;
+    }
+
+    state->sealed++;
+    return true;
+}
+
+bool SecureChannel::open(const uint8_t* frame, size_t length, vector<uint8_t>& plaintext) {
+    if (!state->keyed || length < kSecureFrameHeaderBytes || frameBytes(frame) != length) {
+        return false;
+    }
+
+    const uint8_t* nonce = frame + 4;
+    if (readBigEndian(nonce, 4) != 0 || readBigEndian(nonce + 4, 8) != state->opened) {
+        return false;
+    }
+
+    size_t payload = length - kSecureFrameHeaderBytes - kSecureTagBytes;
+    const uint8_t* ciphertext = frame + kSecureFrameHeaderBytes;
+    size_t start = plaintext.size();
+    plaintext.resize(start + payload);
+
+    EVP_CIPHER_CTX* context = state->openContext;
+    int written = 0;
+    bool opened = EVP_DecryptInit_ex(context, nullptr, nullptr, nullptr, nonce) == 1 &&
+                  EVP_DecryptUpdate(context, nullptr, &written, frame, kSecureFrameHeaderBytes) == 1 &&
+                  EVP_DecryptUpdate(context, plaintext.data() + start, &written, ciphertext, static_cast<int>(payload)) == 1 &&
+                  EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_TAG, kSecureTagBytes, const_cast<uint8_t*>(ciphertext + payload)) == 1 &&
+                  EVP_DecryptFinal_ex(context, plaintext.data() + start + written, &written) == 1;
+
+    if (!opened) {
+        plaintext.resize(start);
+        return false;
+    }
+
+    state->opened++;
+    return true;
+}
+
+#else
+
+struct SecureChannel::State {
+};
+
+bool secureChannelAvailable() {
+    return false;
+}
+
+SecureChannel::SecureChannel(const SecureKey&, bool) : state(new State()) {
+    cerr << "Built without OpenSSL; encrypted migration is unavailable" << endl;
+}
+
+const uint8_t* SecureChannel::hello() const {
+    static const uint8_t none[kSecureHelloBytes] = {};
+    return none;
+}
+
+bool SecureChannel::accept(const uint8_t*) {
+    return false;
+}
+
+bool SecureChannel::seal(const void*, size_t, vector<uint8_t>&) {
+    return false;
+}
+
+bool SecureChannel::open(const uint8_t*, size_t, vector<uint8_t>&) {
+    return false;
+}
+
+#endif
+
+SecureChannel::~SecureChannel() {
+}
+
+bool SecureChannel::valid() const {
+#if defined(VMM_HAVE_OPENSSL)
+    return state->valid;
+#else
+    return false;
+#endif
+}
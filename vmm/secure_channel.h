@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// AES-256-GCM framing for migration streams under a pre-shared key. The
+// pre-shared key never encrypts anything itself: each side of a connection
+// first sends a random hello, and each direction is keyed with
+// HKDF-SHA256 of the pre-shared key, salted with both hellos. A frame's
+// nonce is its counter, which never repeats under one such key.
+//
+// The header is authenticated with the payload, and the receiver accepts
+// frames only in counter order, so frames cannot be dropped, replayed or
+// reordered within a connection unnoticed. Replaying a recorded connection
+// fails too, as the side it is replayed to derives other keys from its
+// own fresh hello. There is no forward secrecy: whoever learns the
+// pre-shared key can decrypt recorded connections.
+//
+//   hello   random:32, each side, before any frame
+//   frame   length:u32 big-endian  nonce:12  ciphertext:length  tag:16
+//   nonce   0:u32 counter:u64 big-endian
+//
+// A channel is used by one stream at a time; streams encrypt in parallel
+// by each having their own.
+
+const size_t kSecureFrameHeaderBytes = 4 + 12;
+const size_t kSecureTagBytes = 16;
+const size_t kSecureMaxFrameBytes = 1 << 20;
+const size_t kSecureHelloBytes = 32;
+
+typedef std::array<uint8_t, 32> SecureKey;
+
+// Reads a key written as 64 hex digits.
+bool parseSecureKey(const std::string& hex, SecureKey& key);
+
+// False when built without OpenSSL.
+bool secureChannelAvailable();
+
+class SecureChannel {
+	public:
+	    // The initiator is the side that opened the connection; the two
+	    // sides seal under each other's opening key.
+	    SecureChannel(const SecureKey& key, bool initiator);
+	    ~SecureChannel();
+
+	    // False if the cipher could not be set up; the reason went to cerr.
+	    bool valid() const;
+
+	    // kSecureHelloBytes of this side's random hello for the peer.
+	    const uint8_t* hello() const;
+	    // Derives the connection's keys from the peer's hello. seal and open
+	    // fail until it has been called.
+	    bool accept(const uint8_t* peerHello);
+
+	    // Appends one frame carrying length bytes, at most
+	    // kSecureMaxFrameBytes, to frame.
+	    bool seal(const void* plaintext, size_t length, std::vector<uint8_t>& frame);
+
+	    // Size of the whole frame starting with header, or 0 if the header
+	    // is malformed.
+	    static size_t frameBytes(const uint8_t* header);
+
+	    // Authenticates and decrypts one whole frame, appending its payload
+	    // to plaintext. On failure plaintext is left as it was.
+	    bool open(const uint8_t* frame, size_t length, std::vector<uint8_t>& plaintext);
+
+	private:
+	    struct State;
+
+	    std::unique_ptr<State> state;
+};
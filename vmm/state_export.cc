@@ -0,0 +1,305 @@
+#include "vmm/state_export.h"
+
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+
+using namespace std;
+
+static const char kStateMagic[] = "VMMSTATE";
+static const uint8_t kStateVersion = 1;
+static const uint64_t kMaxStateName = 4096;
+
+static bool isCsvPath(const string& path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+}
+
+static int32_t stateField(const ProcessorState& state, int reg) {
+    return reg == kStateExportProgramCounter ? state.programCounter : state.registers[reg];
+}
+
+static void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static void putZigzag(string& out, int64_t value) {
+    putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+static void putString(string& out, const string& value) {
+    putVarint(out, value.size());
+    out += value;
+}
+
+static void putHeader(string& out, const vector<ProcessorState>& states, bool diff) {
+    out.append(kStateMagic, sizeof(kStateMagic) - 1);
+    out.push_back(static_cast<char>(kStateVersion));
+    out.push_back(static_cast<char>(diff));
+    putVarint(out, states.size());
+
+    for (const auto& state : states) {
+        putString(out, state.name);
+    }
+}
+
+static void putNumber(string& out, int64_t value) {
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+static void putRegisterName(string& out, int reg) {
+    if (reg == kStateExportProgramCounter) {
+        out += "pc";
+    } else {
+        out.push_back('r');
+        putNumber(out, reg);
+    }
+}
+
+// Names come from manifests, so quote the ones CSV would split.
+static void putCsvName(string& out, const string& name) {
+    if (name.find_first_of(",\"\n") == string::npos) {
+        out += name;
+        return;
+    }
+
+    out.push_back('"');
+    for (char c : name) {
+        if (c == '"') {
+            out.push_back('"');
+        }
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+static bool writeBuffer(const string& exportPath, const string& buffer) {
+    ofstream file(exportPath, ios::binary | ios::trunc);
+
+    if (!file) {
+        cerr << "Unable to create state export " << exportPath << endl;
+        return false;
+    }
+
+    file.write(buffer.data(), buffer.size());
+    file.close();
+
+    if (!file) {
+        cerr << "Unable to write state export " << exportPath << endl;
+        return false;
+    }
+    return true;
+}
+
+bool writeStateExport(const string& exportPath, const vector<ProcessorState>& states) {
+    string out;
+
+    if (isCsvPath(exportPath)) {
+        out.reserve(states.size() * 33 * 8);
+        out += "name,pc";
+        for (int reg = 0; reg < 32; ++reg) {
+            out.push_back(',');
+            putRegisterName(out, reg);
+        }
+        out.push_back('\n');
+
+        for (const auto& state : states) {
+            putCsvName(out, state.name);
+            out.push_back(',');
+            putNumber(out, state.programCounter);
+            for (int reg = 0; reg < 32; ++reg) {
+                out.push_back(',');
+                putNumber(out, state.registers[reg]);
+            }
+            out.push_back('\n');
+        }
+    } else {
+        out.reserve(states.size() * 48);
+        putHeader(out, states, false);
+
+        for (int column = -1; column < 32; ++column) {
+            int reg = column < 0 ? kStateExportProgramCounter : column;
+            int64_t previous = 0;
+
+            for (const auto& state : states) {
+                int64_t value = stateField(state, reg);
+                putZigzag(out, value - previous);
+                previous = value;
+            }
+        }
+    }
+
+    return writeBuffer(exportPath, out);
+}
+
+bool writeStateDiff(const string& exportPath, const vector<ProcessorState>& states, const vector<ProcessorState>& baseline) {
+    static const ProcessorState zeros;
+
+    unordered_map<string, const ProcessorState*> baselineByName;
+    for (const auto& state : baseline) {
+        baselineByName.emplace(state.name, &state);
+    }
+
+    struct Change {
+        uint64_t virtualMachine;
+        uint8_t reg;
+        int32_t previous;
+        int32_t value;
+    };
+    vector<Change> changes;
+
+    for (size_t i = 0; i < states.size(); ++i) {
+        auto found = baselineByName.find(states[i].name);
+        const ProcessorState& before = found == baselineByName.end() ? zeros : *found->second;
+
+        for (int reg = 0; reg <= kStateExportProgramCounter; ++reg) {
+            if (stateField(states[i], reg) != stateField(before, reg)) {
+                changes.push_back({i, static_cast<uint8_t>(reg), stateField(before, reg), stateField(states[i], reg)});
+            }
+        }
+    }
+
+    string out;
+
+    if (isCsvPath(exportPath)) {
+        out.reserve(changes.size() * 32);
+        out += "name,register,previous,value\n";
+
+        for (const auto& change : changes) {
+            putCsvName(out, states[change.virtualMachine].name);
+            out.push_back(',');
+            putRegisterName(out, change.reg);
+            out.push_back(',');
+            putNumber(out, change.previous);
+            out.push_back(',');
+            putNumber(out, change.value);
+            out.push_back('\n');
+        }
+    } else {
+        out.reserve(states.size() * 16 + changes.size() * 4);
+        putHeader(out, states, true);
+        putVarint(out, changes.size());
+
+        uint64_t previousVirtualMachine = 0;
+        for (const auto& change : changes) {
+            putVarint(out, change.virtualMachine - previousVirtualMachine);
+            previousVirtualMachine = change.virtualMachine;
+        }
+        for (const auto& change : changes) {
+            out.push_back(static_cast<char>(change.reg));
+        }
+        for (const auto& change : changes) {
+            putZigzag(out, change.value);
+        }
+    }
+
+    return writeBuffer(exportPath, out);
+}
+
+// Bounds-checked reads over a whole export held in memory; any overrun
+// clears ok and yields zeros.
+struct StateReader {
+    const string& data;
+    size_t position = 0;
+    bool ok = true;
+
+    uint8_t byte() {
+        if (position >= data.size()) {
+            ok = false;
+            return 0;
+        }
+        return static_cast<uint8_t>(data[position++]);
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && ok; shift += 7) {
+            uint8_t next = byte();
+            value |= static_cast<uint64_t>(next & 0x7f) << shift;
+            if (!(next & 0x80)) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    int64_t zigzag() {
+        uint64_t value = varint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    string text() {
+        uint64_t length = varint();
+        if (length > kMaxStateName || length > data.size() - position) {
+            ok = false;
+            return string();
+        }
+        position += length;
+        return data.substr(position - length, length);
+    }
+};
+
+bool readStateExport(const string& exportPath, vector<ProcessorState>& states) {
+    if (isCsvPath(exportPath)) {
+        cerr << "Only binary state exports can be read back, not " << exportPath << endl;
+        return false;
+    }
+
+    ifstream file(exportPath, ios::binary);
+    if (!file) {
+        cerr << "Unable to open state export " << exportPath << endl;
+        return false;
+    }
+
+    string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    StateReader reader{data};
+
+    size_t magicBytes = sizeof(kStateMagic) - 1;
+    if (data.compare(0, magicBytes, kStateMagic) != 0) {
+        cerr << exportPath << " is not a state export" << endl;
+        return false;
+    }
+    reader.position = magicBytes;
+
+    uint8_t version = reader.byte();
+    uint8_t diff = reader.byte();
+    if (version != kStateVersion || diff) {
+        cerr << exportPath << " is not a full state export of version " << static_cast<int>(kStateVersion) << endl;
+        return false;
+    }
+
+    // Every VM takes at least a byte per column, which bounds the count.
+    uint64_t count = reader.varint();
+    if (!reader.ok || count > data.size()) {
+        cerr << exportPath << " is truncated" << endl;
+        return false;
+    }
+
+    states.assign(count, ProcessorState());
+    for (auto& state : states) {
+        state.name = reader.text();
+    }
+
+    for (int column = -1; column < 32 && reader.ok; ++column) {
+        int64_t previous = 0;
+
+        for (auto& state : states) {
+            previous += reader.zigzag();
+            int32_t& field = column < 0 ? state.programCounter : state.registers[column];
+            field = static_cast<int32_t>(previous);
+        }
+    }
+
+    if (!reader.ok) {
+        cerr << exportPath << " is truncated" << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bulk export of every VM's end state, built in memory and written with one
+// write instead of a flushed line per register. The binary format is
+// columnar: each column holds one field for all VMs, delta-coded against
+// the VM before, so clones that end alike cost a byte per field.
+//
+//   header   "VMMSTATE" version:u8 diff:u8 vms:varint { name } per VM
+//   full     pc, then $0..$31: one column each, { value:zvarint } per VM
+//   diff     changes:varint, then the columns vm:varint reg:u8 value:zvarint
+//
+// Full columns store each value minus the previous VM's. In a diff the VM
+// column stores the step from the previous change's VM, reg is 0..31 or 32
+// for the program counter, and values are the new ones. Strings are a
+// varint length and the bytes; zvarints are zigzag varints.
+//
+// Paths ending in .csv get CSV instead: name,pc,r0..r31 per VM, or
+// name,register,previous,value per change.
+
+const int kStateExportProgramCounter = 32;
+
+struct ProcessorState {
+    std::string name;
+    int32_t programCounter = 0;
+    int32_t registers[32] = {};
+};
+
+bool writeStateExport(const std::string& exportPath, const std::vector<ProcessorState>& states);
+
+// Writes only the registers and program counters that differ from the
+// baseline state of the same name. VMs missing from it are compared
+// against all zeros.
+bool writeStateDiff(const std::string& exportPath, const std::vector<ProcessorState>& states, const std::vector<ProcessorState>& baseline);
+
+// Reads a full binary export, e.g. an earlier run's, to diff against.
+bool readStateExport(const std::string& exportPath, std::vector<ProcessorState>& states);
@@ -0,0 +1,311 @@
+#include "vmm/virtual_io.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+const uint32_t kSubmissionProducer = 0;
+const uint32_t kSubmissionConsumer = 1;
+const uint32_t kCompletionProducer = 2;
+const uint32_t kCompletionConsumer = 3;
+const uint32_t kSubmissionRing = 4;
+const uint32_t kCompletionRing = kSubmissionRing + kIoRingEntries;
+const int32_t kMaxBlockRequestWords = 1 << 20;
+// Host buffer one doorbell may allocate for the data of all its requests.
+const size_t kMaxBlockBatchWords = 1 << 20;
+
+VirtualIoDevice::VirtualIoDevice(uint32_t slot, unique_ptr<IoBackend> backend)
+    : ringBase(kIoRingBase + slot * kIoRingStride), backend(move(backend)) {
+    submitted.reserve(kIoRingEntries);
+    requests.reserve(kIoRingEntries);
+    completed.reserve(kIoRingEntries);
+}
+
+// Requests point into the backend's buffers, so they have to land first.
+VirtualIoDevice::~VirtualIoDevice() {
+    waitIdle();
+}
+
+uint64_t ioRingMemoryBytes(uint32_t slot) {
+    return (uint64_t(slot) + 1) * kIoRingStride * sizeof(int32_t);
+}
+
+uint32_t VirtualIoDevice::ringWord(uint32_t offset) const {
+    return ringBase + offset;
+}
+
+bool VirtualIoDevice::busy() const {
+    return outstanding.load(memory_order_acquire) > 0;
+}
+
+const atomic<size_t>& VirtualIoDevice::pendingRequests() const {
+    return outstanding;
+}
+
+void VirtualIoDevice::waitIdle() {
+    while (busy()) {
+        uint64_t generation = ioCompletionGeneration();
+        if (busy()) {
+            waitForIoCompletion(generation);
+        }
+    }
+}
+
+bool VirtualIoDevice::out(GuestMemory& memory, int32_t value) {
+    uint32_t producer = memory.load(ringWord(kSubmissionProducer));
+
+    if (producer - static_cast<uint32_t>(memory.load(ringWord(kSubmissionConsumer))) >= kIoRingEntries && !doorbell(memory)) {
+        return false;
+    }
+
+    memory.store(ringWord(kSubmissionRing + producer % kIoRingEntries), value);
+    memory.store(ringWord(kSubmissionProducer), producer + 1);
+    return true;
+}
+
+// Guest memory is only touched from the VM's own thread: records are copied
+// out here and completions copied in by collectCompletions, while the host
+// I/O works on the backend's buffers.
+bool VirtualIoDevice::doorbell(GuestMemory& memory) {
+    if (busy()) {
+        return false;
+    }
+    collectCompletions(memory);
+
+    uint32_t producer = memory.load(ringWord(kSubmissionProducer));
+    uint32_t consumer = memory.load(ringWord(kSubmissionConsumer));
+    if (producer == consumer) {
+        return true;
+    }
+
+    submitted.clear();
+    for (; consumer != producer; ++consumer) {
+        submitted.push_back(memory.load(ringWord(kSubmissionRing + consumer % kIoRingEntries)));
+    }
+    memory.store(ringWord(kSubmissionConsumer), consumer);
+
+    if (completedTaken == completed.size()) {
+        completed.clear();
+        completedTaken = 0;
+    }
+
+    requests.clear();
+    backend->prepare(submitted.data(), submitted.size(), requests);
+
+    size_t started = 0;
+    for (auto& request : requests) {
+        request.outstanding = &outstanding;
+        started += request.operation != IoRequest::Invalid;
+    }
+
+    completionsPending = true;
+    outstanding.store(started, memory_order_release);
+    submitIoRequests(requests.data(), requests.size());
+    return true;
+}
+
+bool VirtualIoDevice::in(GuestMemory& memory, int32_t& value) {
+    uint32_t consumer = memory.load(ringWord(kCompletionConsumer));
+    collectCompletions(memory);
+
+    if (static_cast<uint32_t>(memory.load(ringWord(kCompletionProducer))) == consumer) {
+        if (!doorbell(memory) || busy()) {
+            return false;
+        }
+        collectCompletions(memory);
+
+        if (static_cast<uint32_t>(memory.load(ringWord(kCompletionProducer))) == consumer) {
+            value = 0;
+            return true;
+        }
+    }
+
+    value = memory.load(ringWord(kCompletionRing + consumer % kIoRingEntries));
+    memory.store(ringWord(kCompletionConsumer), consumer + 1);
+    return true;
+}
+
+// Moves a finished batch's completions into the ring as far as it has
+// room; the rest wait here for the guest to drain it.
+void VirtualIoDevice::collectCompletions(GuestMemory& memory) {
+    if (busy()) {
+        return;
+    }
+
+    if (completionsPending) {
+        backend->complete(requests, completed);
+        completionsPending = false;
+    }
+
+    if (completedTaken == completed.size()) {
+        return;
+    }
+
+    uint32_t producer = memory.load(ringWord(kCompletionProducer));
+    uint32_t consumer = memory.load(ringWord(kCompletionConsumer));
+
+    for (; completedTaken < completed.size() && producer - consumer < kIoRingEntries; ++producer) {
+        memory.store(ringWord(kCompletionRing + producer % kIoRingEntries), completed[completedTaken++]);
+    }
+    memory.store(ringWord(kCompletionProducer), producer);
+}
+
+class ConsoleBackend : public IoBackend {
+	public:
+	    explicit ConsoleBackend(int fd) : fd(fd) {
+	        bytes.reserve(kIoRingEntries);
+	    }
+
+	    ~ConsoleBackend() {
+	        close(fd);
+	    }
+
+	    void prepare(const int32_t* records, size_t count, vector<IoRequest>& requests) override {
+	        bytes.clear();
+	        for (size_t i = 0; i < count; ++i) {
+	            bytes.push_back(static_cast<char>(records[i]));
+	        }
+
+	        IoRequest request;
+	        request.operation = IoRequest::Write;
+	        request.fd = fd;
+	        request.buffer = bytes.data();
+	        request.length = bytes.size();
+	        request.offset = -1;
+	        requests.push_back(request);
+	    }
+
+	    void complete(const vector<IoRequest>&, vector<int32_t>&) override {
+	    }
+
+	private:
+	    int fd;
+	    vector<char> bytes;
+};
+
+// Requests may straddle doorbells, so the parser keeps its place between
+// batches. All of a batch's data lives in one buffer, laid out once the
+// batch is parsed.
+class BlockBackend : public IoBackend {
+	public:
+	    explicit BlockBackend(int fd) : fd(fd) {
+	    }
+
+	    ~BlockBackend() {
+	        close(fd);
+	    }
+
+	    void prepare(const int32_t* records, size_t count, vector<IoRequest>& requests) override {
+	        buffer.clear();
+	        bufferOffsets.clear();
+
+	        for (size_t i = 0; i < count; ++i) {
+	            if (header < 3) {
+	                request[header++] = records[i];
+
+	                if (header == 3) {
+	                    begin(requests);
+	                }
+	            } else {
+	                writeData.push_back(records[i]);
+
+	                if (writeData.size() == static_cast<size_t>(request[2])) {
+	                    if (buffer.size() + writeData.size() > kMaxBlockBatchWords) {
+	                        add(requests, IoRequest::Invalid, 0, -1);
+	                    } else {
+	                        add(requests, IoRequest::Write, writeData.size(), 0);
+	                        buffer.insert(buffer.end(), writeData.begin(), writeData.end());
+	                    }
+	                    header = 0;
+	                }
+	            }
+	        }
+
+	        for (size_t i = 0; i < requests.size(); ++i) {
+	            requests[i].buffer = buffer.data() + bufferOffsets[i];
+	        }
+	    }
+
+	    void complete(const vector<IoRequest>& requests, vector<int32_t>& completions) override {
+	        for (size_t i = 0; i < requests.size(); ++i) {
+	            const IoRequest& completedRequest = requests[i];
+
+	            if (completedRequest.operation == IoRequest::Read) {
+	                // Reads past the end of the file see zeros, like a sparse
+	                // disk; the buffer was zeroed when the batch was laid out.
+	                const int32_t* words = buffer.data() + bufferOffsets[i];
+	                completions.insert(completions.end(), words, words + completedRequest.length / sizeof(int32_t));
+	                completions.push_back(completedRequest.result < 0 ? -1 : 0);
+	            } else if (completedRequest.operation == IoRequest::Write) {
+	                completions.push_back(completedRequest.result == completedRequest.length ? 0 : -1);
+	            } else {
+	                completions.push_back(static_cast<int32_t>(completedRequest.result));
+	            }
+	        }
+	    }
+
+	private:
+	    void add(vector<IoRequest>& requests, IoRequest::Operation operation, size_t words, int64_t result) {
+	        IoRequest added;
+	        added.operation = operation;
+	        added.fd = fd;
+	        added.length = words * sizeof(int32_t);
+	        added.offset = static_cast<off_t>(request[1]) * sizeof(int32_t);
+	        added.result = result;
+	        requests.push_back(added);
+	        bufferOffsets.push_back(buffer.size());
+	    }
+
+	    void begin(vector<IoRequest>& requests) {
+	        int32_t operation = request[0];
+	        int32_t offset = request[1];
+	        int32_t words = request[2];
+	        writeData.clear();
+
+	        if ((operation != 0 && operation != 1) || offset < 0 || words < 0 || words > kMaxBlockRequestWords ||
+	            (operation == 0 && buffer.size() + words > kMaxBlockBatchWords)) {
+	            add(requests, IoRequest::Invalid, 0, -1);
+	            header = 0;
+	        } else if (operation == 0) {
+	            add(requests, IoRequest::Read, words, 0);
+	            buffer.resize(buffer.size() + words, 0);
+	            header = 0;
+	        } else if (words == 0) {
+	            add(requests, IoRequest::Invalid, 0, 0);
+	            header = 0;
+	        }
+	    }
+
+	    int fd;
+	    int32_t request[3] = {};
+	    int header = 0;
+	    vector<int32_t> writeData;
+	    vector<int32_t> buffer;
+	    vector<size_t> bufferOffsets;
+};
+
+shared_ptr<VirtualIoDevice> openConsoleDevice(const string& path) {
+    int fd = path == "stdout" ? dup(STDOUT_FILENO) : open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (fd < 0) {
+        cerr << "Unable to open console " << path << ": " << strerror(errno) << endl;
+        return nullptr;
+    }
+
+    return make_shared<VirtualIoDevice>(kConsoleDevice, unique_ptr<IoBackend>(new ConsoleBackend(fd)));
+}
+
+shared_ptr<VirtualIoDevice> openBlockDevice(const string& path) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        cerr << "Unable to open block device " << path << ": " << strerror(errno) << endl;
+        return nullptr;
+    }
+
+    return make_shared<VirtualIoDevice>(kBlockDevice, unique_ptr<IoBackend>(new BlockBackend(fd)));
+}
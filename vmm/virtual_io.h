@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vmm/guest_memory.h"
+#include "vmm/io_engine.h"
+
+// Paravirtual devices in the style of virtio. Every device slot owns a
+// submission and a completion ring in guest memory, at
+// kIoRingBase + slot * kIoRingStride:
+//
+//   +0  submission producer    +2  completion producer
+//   +1  submission consumer    +3  completion consumer
+//   +4  kIoRingEntries submission records, then as many completion records
+//
+// "out $rs, slot" appends a record without leaving the guest, "doorbell
+// slot" submits every record since the last doorbell as one batch of host
+// I/O, and "in $rd, slot" takes the next completion. A full submission ring
+// rings the doorbell itself. Records that are never doorbelled are not
+// delivered. A device has one batch in flight at a time; an instruction
+// that has to wait for it fails, and the VM parks on the device and retries
+// the instruction once the batch completes.
+//
+// Ring addresses wrap like any other, so guest memory smaller than
+// ioRingMemoryBytes would put rings of different slots on the same words;
+// manifests with such a size and devices are rejected.
+const uint32_t kIoRingEntries = 256;
+const uint32_t kIoRingBase = 0xffff0000u;
+const uint32_t kIoRingStride = 0x1000;
+
+const uint32_t kConsoleDevice = 0;
+const uint32_t kBlockDevice = 1;
+
+// Guest memory in which the rings of slots 0 to slot stay apart.
+uint64_t ioRingMemoryBytes(uint32_t slot);
+
+// Turns records into host requests and their results into completions,
+// both on the VM's thread.
+class IoBackend {
+	public:
+	    virtual ~IoBackend() {}
+	    virtual void prepare(const int32_t* records, size_t count, std::vector<IoRequest>& requests) = 0;
+	    virtual void complete(const std::vector<IoRequest>& requests, std::vector<int32_t>& completions) = 0;
+};
+
+class VirtualIoDevice {
+	public:
+	    VirtualIoDevice(uint32_t slot, std::unique_ptr<IoBackend> backend);
+	    ~VirtualIoDevice();
+
+	    // False while the batch in flight blocks the instruction; guest
+	    // memory is then left as it was.
+	    bool out(GuestMemory& memory, int32_t value);
+	    bool in(GuestMemory& memory, int32_t& value);
+	    bool doorbell(GuestMemory& memory);
+
+	    bool busy() const;
+	    const std::atomic<size_t>& pendingRequests() const;
+	    void waitIdle();
+
+	private:
+	    void collectCompletions(GuestMemory& memory);
+	    uint32_t ringWord(uint32_t offset) const;
+
+	    uint32_t ringBase;
+	    std::unique_ptr<IoBackend> backend;
+
+	    std::vector<int32_t> submitted;
+	    std::vector<IoRequest> requests;
+	    std::atomic<size_t> outstanding{0};
+	    bool completionsPending = false;
+
+	    // Completions not yet moved into the ring.
+	    std::vector<int32_t> completed;
+	    size_t completedTaken = 0;
+};
+
+// Console records are bytes, the low 8 bits of each value, written to
+// stdout when path is "stdout" and appended to path otherwise, which may
+// be a FIFO. The console posts no completions.
+std::shared_ptr<VirtualIoDevice> openConsoleDevice(const std::string& path);
+
+// A word-addressed disk backed by a file. Requests are records
+//
+//   0 offset count              read count words at word offset
+//   1 offset count data...      write count words
+//
+// and complete with the words read, if any, then a status word: 0 on
+// success, -1 on an I/O error or a malformed request. A request is at most
+// 1M words, and so is the data of all requests in one doorbell; requests
+// beyond that fail with -1.
+std::shared_ptr<VirtualIoDevice> openBlockDevice(const std::string& path);
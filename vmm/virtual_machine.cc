@@ -0,0 +1,440 @@
+#include "vmm/virtual_machine.h"
+#include "vmm/lanes.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+VirtualMachine::VirtualMachine(): programCounter(0), virtualMachineExecSliceInInstructions(0), program(make_shared<DecodedProgram>()), registers(), profiling(false), tracing(false), traceId(0), asyncSnapshots(false), parkedOn(nullptr), parkedSliceEnd(0), migrated(false) {
+}
+
+void VirtualMachine::configureVirtualMachine(int execSliceInInstructions) {
+    this->virtualMachineExecSliceInInstructions = execSliceInInstructions;
+}
+
+void VirtualMachine::setRegister(int reg, int32_t value) {
+    registers[reg] = value;
+}
+
+int32_t VirtualMachine::getRegister(int reg) const {
+    return registers[reg];
+}
+
+size_t VirtualMachine::programLength() const {
+    return program->programLength();
+}
+
+void VirtualMachine::enableProfiling() {
+    profiling = true;
+}
+
+void VirtualMachine::enableTracing(const string& virtualMachineName) {
+#if defined(VMM_NO_INSTRUCTION_TRACE)
+    cerr << "Instruction tracing is not compiled in; rebuild with VMM_INSTRUCTION_TRACE" << endl;
+#else
+    tracing = true;
+    traceId = registerTracedVirtualMachine(virtualMachineName);
+#endif
+}
+
+const VirtualMachineProfile& VirtualMachine::profile() const {
+    return executionProfile;
+}
+
+void VirtualMachine::attachMetrics(shared_ptr<VirtualMachineMetrics> virtualMachineMetrics) {
+    metrics = move(virtualMachineMetrics);
+}
+
+// Children share the decoded program and guest memory pages with this VM
+// and get their own registers, program counter, profile and metrics. They
+// start without devices, tracing or a migration handler.
+vector<VirtualMachine> VirtualMachine::cloneVirtualMachine(size_t children) const {
+    vector<VirtualMachine> clones(children, *this);
+
+    for (auto& clone : clones) {
+        clone.executionProfile = VirtualMachineProfile();
+        clone.metrics.reset();
+        clone.tracing = false;
+
+        for (auto& device : clone.devices) {
+            device.reset();
+        }
+        clone.pendingSnapshot.file = -1;
+        clone.parkedOn = nullptr;
+        clone.migrationHandler = nullptr;
+        clone.pendingMigration.started = false;
+    }
+
+    return clones;
+}
+
+GuestMemory& VirtualMachine::guestMemory() {
+    return memory;
+}
+
+void VirtualMachine::attachDevice(uint32_t slot, shared_ptr<VirtualIoDevice> device) {
+    devices[slot] = move(device);
+}
+
+bool VirtualMachine::waitingOnIo() const {
+    return parkedOn && parkedOn->load(memory_order_acquire) > 0;
+}
+
+void VirtualMachine::setAsyncSnapshots(bool enabled) {
+    asyncSnapshots = enabled;
+}
+
+void MigrationTransfer::finish(bool destinationTookOver) {
+    migrated = destinationTookOver;
+    completeExternalIo(outstanding);
+}
+
+void VirtualMachine::setMigrationHandler(MigrationHandler handler) {
+    migrationHandler = move(handler);
+}
+
+// Returns where the slice ends, which for a VM resuming from a park is the
+// end of the slice it parked in, so slices stay aligned for the optimizer.
+// A VM restored from a checkpoint taken while it was parked starts mid-slice
+// too, and runs up to the next multiple of the slice length.
+int VirtualMachine::beginSlice() {
+    if (parkedOn) {
+        parkedOn = nullptr;
+        return parkedSliceEnd;
+    }
+    if (virtualMachineExecSliceInInstructions <= 0) {
+        return programCounter + virtualMachineExecSliceInInstructions;
+    }
+    return (programCounter / virtualMachineExecSliceInInstructions + 1) * virtualMachineExecSliceInInstructions;
+}
+
+void VirtualMachine::endSlice(int sliceEnd, size_t instruction) {
+    if (migrated) {
+        programCounter = static_cast<int>(program->programLength());
+    } else if (parkedOn) {
+        parkedSliceEnd = sliceEnd;
+        programCounter = program->programCounterAt(instruction);
+    } else {
+        programCounter = min(sliceEnd, static_cast<int>(program->programLength()));
+    }
+}
+
+// Counters are bumped once per slice so the execute loop itself stays
+// untouched when metrics are attached.
+void VirtualMachine::recordSliceMetrics(size_t instructionsRetired) {
+    if (metrics) {
+        metrics->instructionsRetired.add(instructionsRetired);
+        metrics->slicesRun.add(1);
+    }
+}
+
+void VirtualMachine::readAssemblyInstructions(const string& filePath) {
+    binaryPath = filePath;
+
+    if (auto sharedProgram = acquireDecodedProgram(filePath, false, 0)) {
+        program = sharedProgram;
+    }
+}
+
+void VirtualMachine::optimizeAssemblyInstructions() {
+    if (binaryPath.empty()) {
+        return;
+    }
+
+    if (auto sharedProgram = acquireDecodedProgram(binaryPath, true, virtualMachineExecSliceInInstructions)) {
+        program = sharedProgram;
+    }
+}
+
+void VirtualMachine::executeAssemblyInstructions(const string& virtualMachineName) {
+    if (profiling) {
+        executeProfiledInstructions(virtualMachineName);
+        return;
+    }
+#if !defined(VMM_NO_INSTRUCTION_TRACE)
+    // Checked once per slice, so the loop below is the same whether or not
+    // tracing is compiled in.
+    if (tracing) {
+        executeTracedInstructions(virtualMachineName);
+        return;
+    }
+#endif
+
+    int sliceEnd = beginSlice();
+    size_t instruction = program->instructionIndexAt(programCounter);
+    size_t firstInstruction = instruction;
+    program->ensureDecoded(instruction + virtualMachineExecSliceInInstructions);
+
+    while (instruction < program->code.size() && program->programCounterAt(instruction) < sliceEnd) {
+        if (!executeDecodedInstruction(program->code[instruction], virtualMachineName)) {
+            break;
+        }
+        instruction++;
+    }
+
+    endSlice(sliceEnd, instruction);
+    recordSliceMetrics(instruction - firstInstruction);
+}
+
+// Same slice as executeAssemblyInstructions, timing every instruction with
+// the cycle counter and the slice with the steady clock and perf counters.
+void VirtualMachine::executeProfiledInstructions(const string& virtualMachineName) {
+    auto sliceStart = chrono::steady_clock::now();
+    HardwareCounterSample countersBefore = readHardwareCounters();
+
+    int sliceEnd = beginSlice();
+    size_t instruction = program->instructionIndexAt(programCounter);
+    size_t firstInstruction = instruction;
+    program->ensureDecoded(instruction + virtualMachineExecSliceInInstructions);
+
+    while (instruction < program->code.size() && program->programCounterAt(instruction) < sliceEnd) {
+        const DecodedInstruction& decoded = program->code[instruction];
+        uint64_t cycles = readCycleCounter();
+        if (!executeDecodedInstruction(decoded, virtualMachineName)) {
+            break;
+        }
+
+        OpcodeProfile& opcode = executionProfile.opcodes[static_cast<size_t>(decoded.opcode)];
+        opcode.cycles += readCycleCounter() - cycles;
+        opcode.executed++;
+        instruction++;
+    }
+
+    endSlice(sliceEnd, instruction);
+    recordSliceMetrics(instruction - firstInstruction);
+
+    HardwareCounterSample countersAfter = readHardwareCounters();
+    if (countersBefore.valid && countersAfter.valid) {
+        executionProfile.hardwareCounters = true;
+        executionProfile.cacheMisses += countersAfter.cacheMisses - countersBefore.cacheMisses;
+        executionProfile.branchMisses += countersAfter.branchMisses - countersBefore.branchMisses;
+    }
+    executionProfile.recordSlice(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - sliceStart).count());
+}
+
+// Same slice as executeAssemblyInstructions, recording each instruction that
+// completes. One that parks on a device is recorded when it is retried.
+void VirtualMachine::executeTracedInstructions(const string& virtualMachineName) {
+    InstructionTraceRing& trace = threadInstructionTrace();
+
+    int sliceEnd = beginSlice();
+    size_t instruction = program->instructionIndexAt(programCounter);
+    size_t firstInstruction = instruction;
+    program->ensureDecoded(instruction + virtualMachineExecSliceInInstructions);
+
+    while (instruction < program->code.size() && program->programCounterAt(instruction) < sliceEnd) {
+        const DecodedInstruction& decoded = program->code[instruction];
+        bool completed = executeDecodedInstruction(decoded, virtualMachineName);
+
+        if (completed || migrated) {
+            trace.record(traceId, program->programCounterAt(instruction), decoded, registers);
+        }
+        if (!completed) {
+            break;
+        }
+        instruction++;
+    }
+
+    endSlice(sliceEnd, instruction);
+    recordSliceMetrics(instruction - firstInstruction);
+}
+
+// Returns false when the instruction has to wait for a busy device; the VM
+// is then parked on it and the instruction has had no effect. Also false
+// once MIGRATE has moved the guest away, which ends the program.
+bool VirtualMachine::executeDecodedInstruction(const DecodedInstruction& instruction, const string& virtualMachineName) {
+    int32_t& rd = registers[instruction.rd];
+    const int32_t rs = registers[instruction.rs];
+    const int32_t rt = registers[instruction.rt];
+    VirtualIoDevice* device = nullptr;
+    const atomic<size_t>* pending = nullptr;
+    bool completed = true;
+
+    switch (instruction.opcode) {
+        case Opcode::Li: rd = instruction.immediate; break;
+        case Opcode::Add: rd = ScalarLanes::add(rs, rt); break;
+        case Opcode::Addi: rd = ScalarLanes::add(rs, instruction.immediate); break;
+        case Opcode::Sub: rd = ScalarLanes::sub(rs, rt); break;
+        case Opcode::Mul: rd = ScalarLanes::mul(rs, rt); break;
+        case Opcode::And: rd = ScalarLanes::bitAnd(rs, rt); break;
+        case Opcode::Or: rd = ScalarLanes::bitOr(rs, rt); break;
+        case Opcode::Ori: rd = ScalarLanes::bitOr(rs, instruction.immediate); break;
+        case Opcode::Xor: rd = ScalarLanes::bitXor(rs, rt); break;
+        case Opcode::Sll: rd = ScalarLanes::shiftLeft(rt, instruction.immediate); break;
+        case Opcode::Srl: rd = ScalarLanes::shiftRight(rt, instruction.immediate); break;
+        case Opcode::In:
+            device = devices[instruction.immediate].get();
+            if (!device) rd = 0; else completed = device->in(memory, rd);
+            break;
+        case Opcode::Out:
+            device = devices[instruction.immediate].get();
+            if (device) completed = device->out(memory, rs);
+            break;
+        case Opcode::Doorbell:
+            device = devices[instruction.immediate].get();
+            if (device) completed = device->doorbell(memory);
+            break;
+        case Opcode::Snapshot:
+            if (!asyncSnapshots) createSnapshot(program->snapshotPath(instruction.immediate));
+            else if (!(completed = snapshotInstruction(program->snapshotPath(instruction.immediate)))) pending = &pendingSnapshot.outstanding;
+            break;
+        case Opcode::Migrate:
+            if (!migrationHandler) break;
+            if (!(completed = migrateInstruction(instruction.immediate))) pending = &pendingMigration.outstanding;
+            else if (migrated) return false;
+            break;
+        case Opcode::DumpProcessorState: dumpProcessorState(virtualMachineName); break;
+        case Opcode::Nop: break;
+    }
+
+    if (!completed) {
+        parkedOn = pending ? pending : &device->pendingRequests();
+    }
+    return completed;
+}
+        
+void VirtualMachine::dumpProcessorState(const string& virtualMachineName) {
+    cout << endl << "Register values for " << virtualMachineName << endl << endl;
+    
+	for (int i = 1; i <= 31; ++i) {
+        cout << "R" << i << ": " << registers[i] << endl;
+    }
+}
+
+// Snapshots go through plain file descriptors: an fstream allocates its
+// buffer on every open, and SNAPSHOT runs inside the execute loop.
+bool VirtualMachine::loadSnapshot(const string& snapshotPath) {
+    int snapshotFile = open(snapshotPath.c_str(), O_RDONLY);
+
+  	if (snapshotFile < 0) {
+    	cerr << "Unable to load snapshot " << snapshotPath << ": " << strerror(errno) << endl;
+    	return false;
+    }
+
+    // Checkpoints written by the monitor carry the program counter after the
+    // registers; guest snapshots stop at the registers.
+    int32_t snapshot[33];
+    ssize_t bytes = read(snapshotFile, snapshot, sizeof(snapshot));
+
+    if (bytes > 0) {
+        memcpy(registers, snapshot, min<size_t>(bytes, sizeof(registers)));
+    }
+    if (bytes == static_cast<ssize_t>(sizeof(snapshot))) {
+        programCounter = snapshot[32];
+    }
+
+    close(snapshotFile);
+    return true;
+}
+
+void VirtualMachine::createSnapshot(const string& snapshotPath) {
+    writeSnapshot(snapshotPath, false);
+}
+
+bool VirtualMachine::createCheckpoint(const string& checkpointPath) {
+    return writeSnapshot(checkpointPath, true);
+}
+
+// Starts the write on first execution and retires the instruction once it
+// has landed; the VM re-executes SNAPSHOT after parking, with its registers
+// unchanged. The open stays synchronous.
+bool VirtualMachine::snapshotInstruction(const string& snapshotPath) {
+    SnapshotWrite& snapshot = pendingSnapshot;
+
+    if (snapshot.file < 0) {
+        snapshot.start = chrono::steady_clock::now();
+        snapshot.file = open(snapshotPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (snapshot.file < 0) {
+            cout << "Unable to create snapshotFile" << endl;
+            return true;
+        }
+
+        memcpy(snapshot.registers, registers, sizeof(registers));
+        snapshot.request.operation = IoRequest::Write;
+        snapshot.request.fd = snapshot.file;
+        snapshot.request.buffer = snapshot.registers;
+        snapshot.request.length = sizeof(snapshot.registers);
+        snapshot.request.offset = 0;
+        snapshot.request.outstanding = &snapshot.outstanding;
+        snapshot.outstanding.store(1, memory_order_release);
+        submitIoRequests(&snapshot.request, 1);
+    }
+
+    if (snapshot.outstanding.load(memory_order_acquire) > 0) {
+        return false;
+    }
+
+    finishSnapshot();
+    return true;
+}
+
+// Starts the transfer on first execution and retires MIGRATE once it is
+// over; like SNAPSHOT, the VM re-executes it after parking.
+bool VirtualMachine::migrateInstruction(int migrateProgramCounter) {
+    MigrationTransfer& transfer = pendingMigration;
+
+    if (!transfer.started) {
+        transfer.started = true;
+        transfer.migrated = false;
+        transfer.outstanding.store(1, memory_order_release);
+        migrationHandler(*this, program->migrationDestination(migrateProgramCounter), migrateProgramCounter, transfer);
+    }
+
+    if (transfer.outstanding.load(memory_order_acquire) > 0) {
+        return false;
+    }
+
+    transfer.started = false;
+    migrated = transfer.migrated;
+    return true;
+}
+
+void VirtualMachine::finishSnapshot() {
+    SnapshotWrite& snapshot = pendingSnapshot;
+    close(snapshot.file);
+    snapshot.file = -1;
+
+    if (metrics) {
+        metrics->snapshots.add(1);
+        metrics->snapshotBytes.add(sizeof(snapshot.registers));
+        metrics->snapshotNanoseconds.add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - snapshot.start).count());
+    }
+}
+
+bool VirtualMachine::writeSnapshot(const string& snapshotPath, bool withProgramCounter) {
+    auto snapshotStart = chrono::steady_clock::now();
+    int snapshotFile = open(snapshotPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  	if (snapshotFile < 0) {
+    	cout << "Unable to create snapshotFile" << endl;
+    	return false;
+  	}
+
+    int32_t snapshot[33];
+    memcpy(snapshot, registers, sizeof(registers));
+    snapshot[32] = programCounter;
+
+    size_t bytes = withProgramCounter ? sizeof(snapshot) : sizeof(registers);
+    bool written = write(snapshotFile, snapshot, bytes) == static_cast<ssize_t>(bytes);
+    // Checkpoints are renamed into place afterwards, which only survives a
+    // crash if the data reached the disk first.
+    if (withProgramCounter) {
+        written = written && fsync(snapshotFile) == 0;
+    }
+    written = close(snapshotFile) == 0 && written;
+
+    if (metrics) {
+        metrics->snapshots.add(1);
+        metrics->snapshotBytes.add(bytes);
+        metrics->snapshotNanoseconds.add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - snapshotStart).count());
+    }
+
+    return written;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vmm/decoded_program.h"
+#include "vmm/guest_memory.h"
+#include "vmm/instruction_trace.h"
+#include "vmm/io_engine.h"
+#include "vmm/metrics.h"
+#include "vmm/profiler.h"
+#include "vmm/virtual_io.h"
+
+class VirtualMachine;
+
+// A MIGRATE in progress. The VM parks on it like on a busy device, so its
+// scheduler thread runs other VMs during the transfer.
+struct MigrationTransfer {
+    IoCounter outstanding;
+    bool started = false;
+    bool migrated = false;
+
+    // Called once, from any thread, when the transfer is over; true if the
+    // guest has left this host.
+    void finish(bool destinationTookOver);
+};
+
+// Called for MIGRATE with its destination and program counter. Starts the
+// transfer and returns without waiting for it; the VM stays parked until
+// transfer.finish. A guest that left ends its program here; otherwise it
+// keeps running from the next instruction.
+typedef std::function<void(VirtualMachine& virtualMachine, const std::string& destination, int programCounter, MigrationTransfer& transfer)> MigrationHandler;
+
+class VirtualMachine {
+	public:
+	    VirtualMachine();
+	    void configureVirtualMachine(int execSliceInInstructions);
+	    void readAssemblyInstructions(const std::string& filePath);
+	    void optimizeAssemblyInstructions();
+	    void executeAssemblyInstructions(const std::string& virtualMachineName);
+	    void dumpProcessorState(const std::string& virtualMachineName);
+	    bool loadSnapshot(const std::string& snapshotPath);
+        void createSnapshot(const std::string& snapshotPath);
+        bool createCheckpoint(const std::string& checkpointPath);
+        void setRegister(int reg, int32_t value);
+        int32_t getRegister(int reg) const;
+        size_t programLength() const;
+        void enableProfiling();
+        const VirtualMachineProfile& profile() const;
+        // Records every instruction this VM retires, under the given name,
+        // into the running thread's trace ring. Profiling takes precedence.
+        void enableTracing(const std::string& virtualMachineName);
+        void attachMetrics(std::shared_ptr<VirtualMachineMetrics> virtualMachineMetrics);
+        std::vector<VirtualMachine> cloneVirtualMachine(size_t children) const;
+        GuestMemory& guestMemory();
+        // in on an empty slot reads 0; out and doorbell are dropped.
+        void attachDevice(uint32_t slot, std::shared_ptr<VirtualIoDevice> device);
+        // A VM parked on a busy device has stopped before the I/O
+        // instruction; schedulers skip it until the device completes, and
+        // its next slice finishes the one it parked in.
+        bool waitingOnIo() const;
+        // With asynchronous snapshots SNAPSHOT submits its write through
+        // the I/O engine and parks the VM like a busy device until the
+        // write lands. Off by default, so a run's slice trace stays
+        // independent of host I/O timing.
+        void setAsyncSnapshots(bool enabled);
+        // Without a handler MIGRATE is dropped. The handler's transfer parks
+        // the VM, so waitingOnIo covers it too.
+        void setMigrationHandler(MigrationHandler handler);
+	
+	    int programCounter;
+	
+	private:
+	    bool executeDecodedInstruction(const DecodedInstruction& instruction, const std::string& virtualMachineName);
+	    int beginSlice();
+	    void endSlice(int sliceEnd, size_t instruction);
+	    void executeProfiledInstructions(const std::string& virtualMachineName);
+	    void executeTracedInstructions(const std::string& virtualMachineName);
+	    void recordSliceMetrics(size_t instructionsRetired);
+	    bool writeSnapshot(const std::string& snapshotPath, bool withProgramCounter);
+	    bool snapshotInstruction(const std::string& snapshotPath);
+	    bool migrateInstruction(int migrateProgramCounter);
+	    void finishSnapshot();
+
+	    struct SnapshotWrite {
+	        int file = -1;
+	        int32_t registers[32];
+	        IoRequest request;
+	        IoCounter outstanding;
+	        std::chrono::steady_clock::time_point start;
+	    };
+	
+	    int virtualMachineExecSliceInInstructions;
+	    std::string binaryPath;
+	    std::shared_ptr<const DecodedProgram> program;
+	    GuestMemory memory;
+	    int32_t registers[32];
+	    bool profiling;
+	    VirtualMachineProfile executionProfile;
+	    bool tracing;
+	    uint32_t traceId;
+	    std::shared_ptr<VirtualMachineMetrics> metrics;
+	    std::shared_ptr<VirtualIoDevice> devices[kIoDevices];
+	    bool asyncSnapshots;
+	    SnapshotWrite pendingSnapshot;
+	    const std::atomic<size_t>* parkedOn;
+	    int parkedSliceEnd;
+	    MigrationHandler migrationHandler;
+	    MigrationTransfer pendingMigration;
+	    bool migrated;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "vmm/decoded_program.h"
+#include "vmm/lanes.h"
+#include "vmm/virtual_machine.h"
+
+// Runs one decoded program for a batch of lockstep virtual machines. The
+// guest ISA has no control flow, so every lane shares the program counter
+// and the register file is kept structure-of-arrays, one row per register.
+template <size_t Lanes>
+class VirtualMachineBatch {
+	public:
+	    VirtualMachineBatch(const DecodedProgram& decodedProgram, size_t firstVirtualMachine, size_t activeLanes);
+	    void configureVirtualMachine(int execSliceInInstructions);
+	    void executeAssemblyInstructions();
+	    bool loadSnapshot(size_t lane, const std::string& snapshotPath);
+	    void createSnapshot(size_t lane, const std::string& snapshotPath);
+	    VirtualMachine extractVirtualMachine(size_t lane) const;
+	    std::string virtualMachineName(size_t lane) const;
+
+	    int programCounter;
+	    size_t activeLanes;
+
+	private:
+	    typedef BatchLanes<Lanes> Isa;
+
+	    void executeDecodedInstruction(const DecodedInstruction& instruction);
+
+	    const DecodedProgram& program;
+	    size_t firstVirtualMachine;
+	    int virtualMachineExecSliceInInstructions;
+	    alignas(64) int32_t registers[32][Lanes];
+};
+
+template <size_t Lanes>
+VirtualMachineBatch<Lanes>::VirtualMachineBatch(const DecodedProgram& decodedProgram, size_t firstVirtualMachine, size_t activeLanes)
+    : programCounter(0), activeLanes(activeLanes), program(decodedProgram), firstVirtualMachine(firstVirtualMachine), virtualMachineExecSliceInInstructions(0), registers() {
+}
+
+template <size_t Lanes>
+void VirtualMachineBatch<Lanes>::configureVirtualMachine(int execSliceInInstructions) {
+    this->virtualMachineExecSliceInInstructions = execSliceInInstructions;
+}
+
+template <size_t Lanes>
+void VirtualMachineBatch<Lanes>::executeAssemblyInstructions() {
+    int sliceEnd = programCounter + virtualMachineExecSliceInInstructions;
+    size_t instruction = program.instructionIndexAt(programCounter);
+    program.ensureDecoded(instruction + virtualMachineExecSliceInInstructions);
+
+    while (instruction < program.code.size() && program.programCounterAt(instruction) < sliceEnd) {
+        executeDecodedInstruction(program.code[instruction]);
+        instruction++;
+    }
+
+    programCounter = std::min(sliceEnd, static_cast<int>(program.programLength()));
+}
+
+template <size_t Lanes>
+void VirtualMachineBatch<Lanes>::executeDecodedInstruction(const DecodedInstruction& instruction) {
+    int32_t* rd = registers[instruction.rd];
+    const int32_t* rs = registers[instruction.rs];
+    const int32_t* rt = registers[instruction.rt];
+
+    switch (instruction.opcode) {
+        case Opcode::Li:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::broadcast(instruction.immediate));
+            break;
+        case Opcode::Add:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::add(Isa::load(rs + i), Isa::load(rt + i)));
+            break;
+        case Opcode::Addi:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::add(Isa::load(rs + i), Isa::broadcast(instruction.immediate)));
+            break;
+        case Opcode::Sub:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::sub(Isa::load(rs + i), Isa::load(rt + i)));
+            break;
+        case Opcode::Mul:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::mul(Isa::load(rs + i), Isa::load(rt + i)));
+            break;
+        case Opcode::And:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::bitAnd(Isa::load(rs + i), Isa::load(rt + i)));
+            break;
+        case Opcode::Or:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::bitOr(Isa::load(rs + i), Isa::load(rt + i)));
+            break;
+        case Opcode::Ori:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::bitOr(Isa::load(rs + i), Isa::broadcast(instruction.immediate)));
+            break;
+        case Opcode::Xor:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::bitXor(Isa::load(rs + i), Isa::load(rt + i)));
+            break;
+        case Opcode::Sll:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::shiftLeft(Isa::load(rt + i), instruction.immediate));
+            break;
+        case Opcode::Srl:
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::shiftRight(Isa::load(rt + i), instruction.immediate));
+            break;
+        case Opcode::In:
+            // Batched VMs have no devices, so in reads 0 like an empty slot.
+            for (size_t i = 0; i < Lanes; i += Isa::width) Isa::store(rd + i, Isa::broadcast(0));
+            break;
+        case Opcode::Out:
+        case Opcode::Doorbell:
+            break;
+        case Opcode::Migrate:
+            // Nor a migration handler, so MIGRATE is dropped.
+            break;
+        case Opcode::Snapshot:
+            // PATH.N for Virtual Machine N.
+            for (size_t lane = 0; lane < activeLanes; ++lane) {
+                createSnapshot(lane, program.snapshotPath(instruction.immediate) + "." + std::to_string(firstVirtualMachine + lane + 1));
+            }
+            break;
+        case Opcode::DumpProcessorState:
+            for (size_t lane = 0; lane < activeLanes; ++lane) {
+                extractVirtualMachine(lane).dumpProcessorState(virtualMachineName(lane));
+            }
+            break;
+        case Opcode::Nop:
+            break;
+    }
+}
+
+// Lanes read and write the same files as VirtualMachine. They share the
+// program counter, so a checkpoint resuming elsewhere is refused, as is a
+// file that cannot be read.
+template <size_t Lanes>
+bool VirtualMachineBatch<Lanes>::loadSnapshot(size_t lane, const std::string& snapshotPath) {
+    VirtualMachine virtualMachine = extractVirtualMachine(lane);
+    if (!virtualMachine.loadSnapshot(snapshotPath)) {
+        return false;
+    }
+
+    if (virtualMachine.programCounter != programCounter) {
+        std::cerr << snapshotPath << " resumes at program counter " << virtualMachine.programCounter << ", but " << virtualMachineName(lane) << " runs in a batch at " << programCounter << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < 32; ++i) {
+        registers[i][lane] = virtualMachine.getRegister(i);
+    }
+    return true;
+}
+
+template <size_t Lanes>
+void VirtualMachineBatch<Lanes>::createSnapshot(size_t lane, const std::string& snapshotPath) {
+    extractVirtualMachine(lane).createSnapshot(snapshotPath);
+}
+
+template <size_t Lanes>
+VirtualMachine VirtualMachineBatch<Lanes>::extractVirtualMachine(size_t lane) const {
+    VirtualMachine virtualMachine;
+
+    for (int i = 0; i < 32; ++i) {
+        virtualMachine.setRegister(i, registers[i][lane]);
+    }
+
+    virtualMachine.programCounter = programCounter;
+    return virtualMachine;
+}
+
+template <size_t Lanes>
+std::string VirtualMachineBatch<Lanes>::virtualMachineName(size_t lane) const {
+    return "Virtual Machine " + std::to_string(firstVirtualMachine + lane + 1);
+}
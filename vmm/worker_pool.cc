@@ -0,0 +1,318 @@
+#include "vmm/worker_pool.h"
+#include "vmm/io_engine.h"
+#include "vmm/scheduler_arena.h"
+
+#include <chrono>
+#include <sched.h>
+
+using namespace std;
+
+// An idle worker yields this many times before it starts sleeping, and
+// sleeps at most kMaxIdleSleep between looks at the other queues.
+static const unsigned kIdleYields = 16;
+static const chrono::microseconds kMaxIdleSleep(1000);
+
+struct WorkerPool::Worker {
+    int cpu = -1;
+    int node = 0;
+    thread workerThread;
+
+    mutex mailboxMutex;
+    condition_variable mailbox;
+    function<void()> task;
+    bool taskDone = false;
+    uint64_t runGeneration = 0;
+    bool stopping = false;
+
+    mutex queueMutex;
+    deque<Entry*> queue;
+};
+
+struct WorkerPool::Entry {
+    VirtualMachine* virtualMachine = nullptr;
+    pmr::memory_resource* arena = nullptr;
+    string name;
+    function<void(VirtualMachine&)> afterSlice;
+    unsigned weight = 1;
+};
+
+static vector<int> allowedCpus() {
+    vector<int> cpus;
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    return cpus;
+}
+
+WorkerPool::WorkerPool(size_t workerCount, bool numaPlacement)
+    : numaPlacement(numaPlacement), remaining(0), sameNode(0), crossNode(0), finishedWorkers(0) {
+    vector<int> cpus = allowedCpus();
+
+    for (size_t i = 0; i < max<size_t>(1, workerCount); ++i) {
+        workers.emplace_back(new Worker());
+
+        if (numaPlacement && !cpus.empty()) {
+            workers.back()->cpu = cpus[i % cpus.size()];
+            workers.back()->node = numaNodeOfCpu(workers.back()->cpu);
+        }
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->workerThread = thread([this, i]() { workerLoop(i); });
+    }
+}
+
+// VMs are freed while their workers are still alive: a pool thread that
+// exits with live blocks hands its chunks to the shared pool, where later
+// threads never reuse them.
+WorkerPool::~WorkerPool() {
+    for (auto& entry : entries) {
+        entry->virtualMachine->~VirtualMachine();
+        entry->arena->deallocate(entry->virtualMachine, sizeof(VirtualMachine), alignof(VirtualMachine));
+    }
+
+    for (auto& worker : workers) {
+        {
+            lock_guard<mutex> lock(worker->mailboxMutex);
+            worker->stopping = true;
+        }
+        worker->mailbox.notify_all();
+        worker->workerThread.join();
+    }
+}
+
+size_t WorkerPool::workerCount() const {
+    return workers.size();
+}
+
+int WorkerPool::workerNode(size_t worker) const {
+    return workers[worker]->node;
+}
+
+size_t WorkerPool::spawn(size_t worker, const string& name, const function<void(VirtualMachine&)>& setup, function<void(VirtualMachine&)> afterSlice, unsigned weight) {
+    worker %= workers.size();
+
+    unique_ptr<Entry> entry(new Entry());
+    entry->name = name;
+    entry->afterSlice = move(afterSlice);
+    entry->weight = max(1u, weight);
+
+    auto build = [&]() {
+        entry->arena = schedulerArena();
+        entry->virtualMachine = new (entry->arena->allocate(sizeof(VirtualMachine), alignof(VirtualMachine))) VirtualMachine();
+        setup(*entry->virtualMachine);
+    };
+
+    if (numaPlacement) {
+        execute(worker, build);
+    } else {
+        build();
+    }
+
+    {
+        lock_guard<mutex> lock(workers[worker]->queueMutex);
+        workers[worker]->queue.push_back(entry.get());
+    }
+
+    entries.push_back(move(entry));
+    return entries.size() - 1;
+}
+
+void WorkerPool::execute(size_t worker, const function<void()>& task) {
+    Worker& target = *workers[worker];
+    unique_lock<mutex> lock(target.mailboxMutex);
+
+    target.task = task;
+    target.taskDone = false;
+    target.mailbox.notify_all();
+    target.mailbox.wait(lock, [&]() { return target.taskDone; });
+}
+
+void WorkerPool::runToCompletion() {
+    remaining = 0;
+    for (auto& entry : entries) {
+        remaining += entry->virtualMachine->programCounter < entry->virtualMachine->programLength();
+    }
+
+    {
+        lock_guard<mutex> lock(runMutex);
+        finishedWorkers = 0;
+    }
+
+    for (auto& worker : workers) {
+        lock_guard<mutex> lock(worker->mailboxMutex);
+        worker->runGeneration++;
+        worker->mailbox.notify_all();
+    }
+
+    unique_lock<mutex> lock(runMutex);
+    runDone.wait(lock, [&]() { return finishedWorkers == workers.size(); });
+}
+
+void WorkerPool::workerLoop(size_t index) {
+    Worker& worker = *workers[index];
+
+    if (worker.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker.cpu, &cpus);
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+
+    uint64_t seenGeneration = 0;
+    unique_lock<mutex> lock(worker.mailboxMutex);
+
+    while (true) {
+        worker.mailbox.wait(lock, [&]() { return worker.task || worker.stopping || worker.runGeneration != seenGeneration; });
+
+        if (worker.task) {
+            function<void()> task = move(worker.task);
+            worker.task = nullptr;
+            lock.unlock();
+            task();
+            lock.lock();
+            worker.taskDone = true;
+            worker.mailbox.notify_all();
+        } else if (worker.stopping) {
+            return;
+        } else {
+            seenGeneration = worker.runGeneration;
+            lock.unlock();
+            runSlices(index);
+
+            {
+                lock_guard<mutex> runLock(runMutex);
+                finishedWorkers++;
+            }
+            runDone.notify_all();
+            lock.lock();
+        }
+    }
+}
+
+// A worker that finds every VM in its queue parked sleeps on the I/O
+// completion generation, as ContextScheduler does; one with nothing queued
+// or to steal backs off from yielding to short sleeps.
+void WorkerPool::runSlices(size_t index) {
+    Worker& worker = *workers[index];
+    uint64_t generation = 0;
+    size_t parkedInARow = 0;
+    unsigned idleRounds = 0;
+
+    while (remaining.load() > 0) {
+        // Read before the first parked VM of a run is seen, so a completion
+        // after that cannot be missed.
+        if (parkedInARow == 0) {
+            generation = ioCompletionGeneration();
+        }
+
+        Entry* entry = nullptr;
+        {
+            lock_guard<mutex> lock(worker.queueMutex);
+            if (!worker.queue.empty()) {
+                entry = worker.queue.front();
+                worker.queue.pop_front();
+            }
+        }
+
+        if (!entry && !(entry = steal(index))) {
+            parkedInARow = 0;
+            if (idleRounds < kIdleYields) {
+                this_thread::yield();
+            } else {
+                this_thread::sleep_for(min(kMaxIdleSleep, chrono::microseconds(1 << min(idleRounds - kIdleYields, 10u))));
+            }
+            idleRounds++;
+            continue;
+        }
+        idleRounds = 0;
+
+        VirtualMachine& virtualMachine = *entry->virtualMachine;
+        if (virtualMachine.programCounter >= virtualMachine.programLength()) {
+            continue;
+        }
+
+        // A VM parked on I/O goes to the back of the queue untouched.
+        for (unsigned slice = 0; slice < entry->weight && virtualMachine.programCounter < virtualMachine.programLength() && !virtualMachine.waitingOnIo(); ++slice) {
+            virtualMachine.executeAssemblyInstructions(entry->name);
+            if (entry->afterSlice) {
+                entry->afterSlice(virtualMachine);
+            }
+        }
+
+        if (virtualMachine.waitingOnIo()) {
+            size_t queued = 0;
+            {
+                lock_guard<mutex> lock(worker.queueMutex);
+                worker.queue.push_back(entry);
+                queued = worker.queue.size();
+            }
+
+            if (++parkedInARow >= queued) {
+                waitForIoCompletion(generation);
+                parkedInARow = 0;
+            }
+            continue;
+        }
+
+        parkedInARow = 0;
+        if (virtualMachine.programCounter < virtualMachine.programLength()) {
+            lock_guard<mutex> lock(worker.queueMutex);
+            worker.queue.push_back(entry);
+        } else {
+            remaining--;
+        }
+    }
+}
+
+// Takes from the back of the victim's queue, the VM it would reach last.
+// Same-node victims go first so a migrated VM keeps its memory local.
+WorkerPool::Entry* WorkerPool::steal(size_t thief) {
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t offset = 1; offset < workers.size(); ++offset) {
+            Worker& victim = *workers[(thief + offset) % workers.size()];
+            bool local = victim.node == workers[thief]->node;
+
+            if (local != (pass == 0)) {
+                continue;
+            }
+
+            lock_guard<mutex> lock(victim.queueMutex);
+            if (!victim.queue.empty()) {
+                Entry* entry = victim.queue.back();
+                victim.queue.pop_back();
+                (local ? sameNode : crossNode)++;
+                return entry;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+size_t WorkerPool::virtualMachineCount() const {
+    return entries.size();
+}
+
+VirtualMachine& WorkerPool::virtualMachine(size_t index) {
+    return *entries[index]->virtualMachine;
+}
+
+const string& WorkerPool::virtualMachineName(size_t index) const {
+    return entries[index]->name;
+}
+
+uint64_t WorkerPool::sameNodeSteals() const {
+    return sameNode.load();
+}
+
+uint64_t WorkerPool::crossNodeSteals() const {
+    return crossNode.load();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vmm/virtual_machine.h"
+
+// Each worker is a thread with its own arena; far more than there are CPUs
+// only adds contention.
+const size_t kMaxWorkers = 1024;
+
+// Runs VMs slice by slice on a fixed set of worker threads. With NUMA
+// placement every worker is pinned to one CPU and each VM is built on its
+// home worker, so its registers and guest memory come from that node's
+// scheduler arena. A worker whose queue runs dry steals from the others,
+// trying workers on its own node before crossing to a remote one.
+class WorkerPool {
+	public:
+	    WorkerPool(size_t workers, bool numaPlacement);
+	    ~WorkerPool();
+
+	    size_t workerCount() const;
+	    int workerNode(size_t worker) const;
+
+	    // Builds a VM owned by worker and queues it there; with placement the
+	    // setup runs on the worker's own thread. afterSlice runs on whichever
+	    // worker executed the slice. A VM runs weight slices each time it
+	    // is picked. Returns the VM's index.
+	    size_t spawn(size_t worker, const std::string& name, const std::function<void(VirtualMachine&)>& setup,
+	                 std::function<void(VirtualMachine&)> afterSlice = nullptr, unsigned weight = 1);
+	    void runToCompletion();
+
+	    size_t virtualMachineCount() const;
+	    VirtualMachine& virtualMachine(size_t index);
+	    const std::string& virtualMachineName(size_t index) const;
+
+	    uint64_t sameNodeSteals() const;
+	    uint64_t crossNodeSteals() const;
+
+	private:
+	    struct Worker;
+	    struct Entry;
+
+	    void workerLoop(size_t worker);
+	    void execute(size_t worker, const std::function<void()>& task);
+	    void runSlices(size_t worker);
+	    Entry* steal(size_t worker);
+
+	    bool numaPlacement;
+	    std::vector<std::unique_ptr<Worker>> workers;
+	    std::vector<std::unique_ptr<Entry>> entries;
+	    std::atomic<size_t> remaining;
+	    std::atomic<uint64_t> sameNode;
+	    std::atomic<uint64_t> crossNode;
+
+	    std::mutex runMutex;
+	    std::condition_variable runDone;
+	    size_t finishedWorkers;
+};